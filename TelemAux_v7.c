@@ -63,6 +63,29 @@
  *   decimal. Increased baud rate of radio interface to 38400 (RF baud of
  *   9XCite modules / fastest that can be used without flow control) 
  * 
+ * - Binary radio output (RADIO_BINARY). The radio is sent the same frames as
+ *   the main telemetry transmitter (transmitter/telem_frame.h), with every
+ *   value converted to the fixed point encoding of TELEM_FIELD_TABLE in
+ *   transmitter/can_telem.h instead of printed with fprintf. A frame is a
+ *   fraction of the length of the ASCII line and takes no float formatting,
+ *   so aux cells, array current, motor and drive data go out every
+ *   FAST_INTERVAL instead of once per TX_INTERVAL. Temperatures and MPPT
+ *   data go out every TX_INTERVAL. BPS data is not sent in binary; the main
+ *   transmitter sends the current BPS pages. The ground station decodes
+ *   these frames like its own, the aux analog page is TELEM_AUX_ANALOG.
+ * 
+ * - Interrupt driven ADC. Timer2 starts one conversion per ms and the AD
+ *   interrupt sums it and selects the next of AN0-AN3 and AN10, so every
+ *   channel settles for a whole ms (see the input impedance note above) and
+ *   AuxMeasure()/HallMeasure() only read the latest sums instead of waiting
+ *   out five conversions. Each channel is filtered by a CIC decimator and an
+ *   optional IIR (transmitter/adc_filter.c) to take out the noise the cell
+ *   subtraction amplifies; the settings are the *_CIC_* and *_IIR_* defines.
+ * 
+ * - Timer2 ticks every 1 ms (period 250, postscale 5). It used to tick every
+ *   1.024 ms (period 80, postscale 16), so UP_INTERVAL, TX_INTERVAL,
+ *   FAST_INTERVAL, the GetMs() time stamps and the ADC rate all ran 2.4% slow.
+ * 
  ****************************************************************************/
 
 #include <18F26K80.h>
@@ -88,6 +111,13 @@
 // System constants
 #define LED         pin_C2
 #define ADC_HALL    10      // Analog port for array current sensor
+#define N_ADC       5       // Channels in the ADC sequence, aux pack AN0-AN3 then ADC_HALL
+#define ADC_HALL_SEQ 4      // Position of ADC_HALL in the sequence
+#define ADC_CIC_ORDER  2     // CIC order of every channel
+#define ADC_CIC_SHIFT  3     // CIC decimation 2^3; 1 conversion per ms round robin gives 25 readings/s per channel
+#define AUX_IIR_SHIFT  2     // IIR smoothing of the aux pack channels, 0 for none
+#define HALL_IIR_SHIFT 0     // IIR smoothing of the array current, 0 for none
+#define ADC_ONE        (1 << ADC_FILTER_FRAC_BITS)  // One ADC unit in filter output units
 #define UP_INTERVAL 50      // Update interval for polled CAN measurements (ms). Set to be longer than time taken for radio TX
 #define TX_INTERVAL 250     // Update interval for radio TX; must be larger than UP_INTERVAL
 #define canTimeout  8       // Interval to reset data arrays after not hearing from a system over CAN (multiples of TX_INTERVAL)
@@ -98,6 +128,12 @@
 #define MPPTCount   4       // Number of MPPTs/subarrays
 #define N_CAN_poll  6       // Total number of CAN packets to be requested from WS22 and MPPTs 
 
+// Radio output format; comment out to send the original ASCII lines
+#define RADIO_BINARY
+#define FAST_INTERVAL 50    // Binary mode update interval for analog, motor and drive pages (ms)
+#define ENC_LEN     32      // Longest encoded page (bytes)
+#define ADC_VOLTS   (5.0/4096)  // Volts per 12 bit ADC unit
+
 // Print to Radio Codes
 #define btemCode    0       // Battery temperatures 
 #define bvolCode    1       // Battery voltages
@@ -127,6 +163,9 @@
 // NOTE!! CAN IDs 0x7F0-0x7FF are reserved for bootloader updates by the WS22 
 // DO NOT USE CAN IDs in this range!
 
+// CIC/IIR filtering of the ADC channels
+#include "transmitter/adc_filter.c"
+
 // GLOBAL VARIABLES
 
 // Battery pack info (do we want more info from the BPS?)
@@ -135,7 +174,7 @@ int8 battTemp[BattCount]={0};
 unsigned long battCurr=0;
 
 // Aux pack info
-unsigned long AuxVoltRaw[AuxCount]={0}; // Raw readouts from voltage divider network
+unsigned long AuxVoltRaw[AuxCount]={0}; // Filtered readouts from voltage divider network, in 1/ADC_ONE ADC units
 unsigned long AuxCell[AuxCount]={0}; // Aux cell batt voltages in ADC units
 int8 AuxFlags=0;
 
@@ -151,9 +190,11 @@ float motorBusV=0;
 float motorBusI=0;
 float rpm=0;
 float contHStemp=0;
+float contMotorTemp=0;
 float contDSPtemp=0;
 float driveCurr=0;              // Desired motor current (%) from driver controls
 float driveVel=0;               // Desired motor speed (RPM) from driver controls
+float vehVel=0;                 // Vehicle velocity (m/s) from the motor controller
 
 // Other variables
 unsigned long arrayCurr=0;      // ADC reading for array current
@@ -168,6 +209,25 @@ unsigned int  wsTimer=0;
 unsigned int  evTimer=0;
 unsigned int  mpptTimer[mpptCount]={0};
 
+// Binary output variables
+unsigned int32 now_ms=0;        // Free running clock for frame times (ms)
+unsigned int  fast_ms=0;
+unsigned int  Fast_next=0;
+unsigned int32 busStamp=0;      // Time of the last update of each page, for frame ages
+unsigned int32 velStamp=0;
+unsigned int32 hsStamp=0;
+unsigned int32 dspStamp=0;
+unsigned int32 evStamp=0;
+unsigned int32 mpptStamp=0;
+int     encBuf[ENC_LEN]={0};    // Page being encoded
+unsigned int16 encPos=0;        // Bit position in encBuf
+
+// ADC sequencer variables
+const int AdcChannel[N_ADC]={0,1,2,3,ADC_HALL};
+adc_filter_t  adcFilter[N_ADC];
+unsigned long adcReady[N_ADC]={0};  // Latest filter output of each channel
+unsigned int  adcSeq=0;             // Position in the sequence being converted
+
 // CAN variables
 int     C_empty[8]   = {0,0,0,0,0,0,0,0};
 int     Cin_data0[8] = {0,0,0,0,0,0,0,0};
@@ -184,6 +244,9 @@ void HallMeasure(void);
 void RadioTransmit(int out_id);
 void TelemCANparse(int *CANdata, int32 CANid);
 void TelemCANtx(void);
+void RadioFast(void);
+void RadioSlow(void);
+unsigned int32 GetMs(void);
 // void TelemCANpoll(int32 CANid);
 
 // Modified CAN library includes default FIFO mode, timing settings match MPPT,
@@ -193,6 +256,17 @@ void TelemCANtx(void);
 // Library to convert IEEE float data from WS22 to PIC format
 #include <ieeefloat.c>
 
+#ifdef RADIO_BINARY
+// Page IDs, field encodings and framing shared with the main transmitter. With
+// a single rs232 stream the framing's putc() goes to RADIO.
+#include "transmitter/can_telem.h"
+#include "transmitter/telem_frame.c"
+
+const float FieldScale[N_TELEM_FIELD]={TELEM_FIELD_TABLE(EXPAND_AS_FIELD_SCALE_ARRAY)};
+const float FieldBias[N_TELEM_FIELD]={TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BIAS_ARRAY)};
+const int   FieldBits[N_TELEM_FIELD]={TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BITS_ARRAY)};
+#endif
+
 // Interrupt service routines
 #int_canrx0
 void isr_canrx0() { // CAN receive buffer 0 interrupt
@@ -218,9 +292,28 @@ void isr_canrx1() { // CAN receive buffer 1 interrupt
     }
 }
 
+#int_ad
+void isr_ad(void) {  // Conversion done, select the next channel for the next tick
+    if(adc_filter_push(&adcFilter[adcSeq],read_adc(ADC_READ_ONLY))){
+        adcReady[adcSeq]=adcFilter[adcSeq].out;
+    }
+    adcSeq++;
+    if(adcSeq>=N_ADC)adcSeq=0;
+    set_adc_channel(AdcChannel[adcSeq]);
+}
+
 #int_timer2
 void isr_timer2(void) {
+    read_adc(ADC_START_ONLY);
     ms++;
+    now_ms++;
+#ifdef RADIO_BINARY
+    fast_ms++;
+    if (fast_ms == FAST_INTERVAL){
+        Fast_next=1;
+        fast_ms=0;
+    }
+#endif
     if(ms == UP_INTERVAL){
         CAN_poll=1;
     }
@@ -264,26 +357,51 @@ void main() {
             can_putd(IDpoll[poll_count++],C_empty,8,3,0,1);
             if(poll_count > (N_CAN_poll-1))poll_count=0;
             CAN_poll=0;
+#ifdef RADIO_BINARY
+            TelemCANtx(); // Aux voltages to the driver display, at the old rate
+#else
             RadioTransmit(miscCode); // Send priority info quickly
+#endif
+        }
+#ifdef RADIO_BINARY
+        if(Fast_next){
+            AuxMeasure();
+            HallMeasure();
+            RadioFast();
+            Fast_next=0;
+        }
+        if(TX_next){
+            RadioSlow();
+            TX_next=0;
         }
+#else
         if(TX_next){
             RadioTransmit(Gout_id);
          Gout_id++;
          if(Gout_id>mpptCode)Gout_id=0;   
             TX_next=0;
         }
+#endif
     }
 }
 
 void system_init(){
+   int k=0;
+   
    setup_adc(ADC_CLOCK_DIV_64|ADC_TAD_MUL_20); // Input impedance on ADC pins is high from voltage divider network. Need long A/D time
    setup_adc_ports(ALL_ANALOG);
-   setup_timer_2(T2_DIV_BY_4,79,16);
+   set_adc_channel(AdcChannel[0]);
+   for(k=0;k<N_ADC;k++){
+       adc_filter_init(&adcFilter[k],ADC_CIC_ORDER,ADC_CIC_SHIFT,(k==ADC_HALL_SEQ) ? HALL_IIR_SHIFT : AUX_IIR_SHIFT);
+   }
+   setup_timer_2(T2_DIV_BY_4,249,5);   // 5 MHz / 4 / 250 / 5, a 1 ms tick
    setup_comparator(NC_NC_NC_NC);// This device COMP currently not supported by the PICWizard
    
    can_init();
    set_tris_b((*0xF93 & 0xFB) | 0x08);  //b3 is out, b2 is in (default CAN pins)
    
+   clear_interrupt(INT_AD);
+   enable_interrupts(INT_AD);
    clear_interrupt(INT_TIMER2);
    enable_interrupts(INT_TIMER2);
    clear_interrupt(INT_CANRX0);
@@ -297,18 +415,23 @@ void system_init(){
 
 void AuxMeasure(void) {
     int k=0;
+    signed int32 cell[AuxCount];
     
-    for(k=0;k<AuxCount;k++){
-        set_adc_channel(k);
-        delay_us(10);
-        AuxVoltRaw[k] = read_adc();
-    }
+    // Latest readings from the ADC sequencer, taken together
+    disable_interrupts(GLOBAL);
+    for(k=0;k<AuxCount;k++)AuxVoltRaw[k] = adcReady[k];
+    enable_interrupts(GLOBAL);
     
     // Convert to individual cell voltages (take into account voltage dividers) 
-    AuxCell[0] = AuxVoltRaw[3]; // Lowest cell in aux pack
-    AuxCell[1] = 2*AuxVoltRaw[2] - AuxVoltRaw[3];
-    AuxCell[2] = 3*AuxVoltRaw[1] - 2*AuxVoltRaw[2];
-    AuxCell[3] = 4*AuxVoltRaw[0] - 3*AuxVoltRaw[1];
+    // in filter output units, then round back to 12 bit units
+    cell[0] = AuxVoltRaw[3]; // Lowest cell in aux pack
+    cell[1] = 2*(signed int32)AuxVoltRaw[2] - AuxVoltRaw[3];
+    cell[2] = 3*(signed int32)AuxVoltRaw[1] - 2*(signed int32)AuxVoltRaw[2];
+    cell[3] = 4*(signed int32)AuxVoltRaw[0] - 3*(signed int32)AuxVoltRaw[1];
+    for(k=0;k<AuxCount;k++){
+        if(cell[k]<0)cell[k]=0;
+        AuxCell[k] = (cell[k] + ADC_ONE/2) / ADC_ONE;
+    }
     
     // Set voltage warning flags
     // Bits 0-3 are voltage warning flags for cells 0-3
@@ -328,9 +451,12 @@ void AuxMeasure(void) {
 }
 
 void HallMeasure(void) {
-    set_adc_channel(ADC_HALL);
-    delay_us(10);
-    arrayCurr = read_adc();
+    unsigned long sum;
+    
+    disable_interrupts(GLOBAL);
+    sum = adcReady[ADC_HALL_SEQ];
+    enable_interrupts(GLOBAL);
+    arrayCurr = (sum + ADC_ONE/2) / ADC_ONE;
 }
 
 void RadioTransmit(int out_id){
@@ -449,18 +575,24 @@ void TelemCANparse(int *CANdata, int32 CANid){
             case wsBus:
                 motorBusV=f_IEEEtoPIC((float)raw1);
                 motorBusI=f_IEEEtoPIC((float)raw2);
+                busStamp=GetMs();
             break;
             
             case wsVeloc:
                 rpm=f_IEEEtoPIC((float)raw1);
+                vehVel=f_IEEEtoPIC((float)raw2);
+                velStamp=GetMs();
             break;
             
             case wsHStemp:
+                contMotorTemp=f_IEEEtoPIC((float)raw1);
                 contHStemp=f_IEEEtoPIC((float)raw2);
+                hsStamp=GetMs();
             break;
             
             case wsDSPtemp:
                 contDSPtemp=f_IEEEtoPIC((float)raw1);
+                dspStamp=GetMs();
             break;
             
             default:
@@ -478,6 +610,7 @@ void TelemCANparse(int *CANdata, int32 CANid){
                 }
                 driveCurr=f_IEEEtoPIC((float)raw2);
                 driveVel=f_IEEEtoPIC((float)raw1);
+                evStamp=GetMs();
             }         
         break;
         
@@ -506,6 +639,7 @@ void TelemCANparse(int *CANdata, int32 CANid){
             mpptCurrIn[id_lo-1] = ((unsigned int16)CANdata[2] << 8) + (unsigned int16)CANdata[3];
             mpptVoltOut[id_lo-1]= ((unsigned int16)CANdata[4] << 8) + (unsigned int16)CANdata[5];
             mpptTemp[id_lo-1]   = CANdata[6];
+            mpptStamp=GetMs();
         break;
         
         default:        // Unknown / ignored CAN packet
@@ -531,6 +665,143 @@ void TelemCANtx(void){
     can_putd(telemID,out_data,tx_len,tx_pri,tx_ext,tx_rtr);
 }
 
+unsigned int32 GetMs(void){
+    unsigned int32 now;
+    
+    disable_interrupts(GLOBAL);
+    now=now_ms;
+    enable_interrupts(GLOBAL);
+    return now;
+}
+
+#ifdef RADIO_BINARY
+// Appends a value to the page being encoded, MSB first
+void EncBits(unsigned int16 value, int bits){
+    int i=0;
+    
+    for(i=bits;i>0;i--){
+        if(bit_test(value,i-1))bit_set(encBuf[encPos>>3],7-(encPos&7));
+        encPos++;
+    }
+}
+
+// Converts a float to the fixed point encoding of a field, clamped to its width
+void EncFloat(float value, int field){
+    float x;
+    unsigned int32 max;
+    
+    x=value*FieldScale[field]+FieldBias[field];
+    max=((unsigned int32)1<<FieldBits[field])-1;
+    if(x<=0){
+        EncBits(0,FieldBits[field]);
+    } else if(x>=(float)max){
+        EncBits((unsigned int16)max,FieldBits[field]);
+    } else {
+        EncBits((unsigned int16)(x+0.5),FieldBits[field]);
+    }
+}
+
+// Integer fields are sent unchanged
+void EncInt(unsigned int16 value, int field){
+    EncBits(value,FieldBits[field]);
+}
+
+// Sends the encoded page as one frame; stamp is when its data was last updated
+void SendPage(int id, unsigned int32 now, unsigned int32 stamp){
+    unsigned int32 age=now-stamp;
+    
+    if(age>TELEM_AGE_MAX)age=TELEM_AGE_MAX;
+    send_frame(id,TELEM_FLAG_ENCODED,(int)((encPos+7)>>3),encBuf,(int16)now,(int16)age);
+    memset(encBuf,0,ENC_LEN);
+    encPos=0;
+    restart_wdt();
+}
+
+// Tells the ground station a page has timed out
+void SendStale(int id, unsigned int32 now){
+    send_frame(id,TELEM_FLAG_STALE,0,0,(int16)now,TELEM_AGE_MAX);
+    restart_wdt();
+}
+
+// Analog measurements, motor bus and speed, and drive commands
+void RadioFast(void){
+    int j=0;
+    unsigned int32 now=GetMs();
+    
+    for(j=0;j<AuxCount;j++)EncFloat((float)AuxCell[j]*ADC_VOLTS,AUX_CELL_VOLTAGE_FIELD);
+    EncInt(arrayCurr,ARRAY_CURRENT_ADC_FIELD);
+    EncInt(AuxFlags,AUX_FLAGS_FIELD);
+    SendPage(TELEM_AUX_ANALOG_ID,now,now);
+    
+    if(wsTimer>canTimeout){
+        SendStale(TELEM_MOTOR_BUS_VI_ID,now);
+        SendStale(TELEM_MOTOR_VELOCITY_ID,now);
+    } else {
+        EncFloat(motorBusV,MOTOR_BUS_VOLTAGE_FIELD);
+        EncFloat(motorBusI,MOTOR_BUS_CURRENT_FIELD);
+        SendPage(TELEM_MOTOR_BUS_VI_ID,now,busStamp);
+        EncFloat(rpm,MOTOR_RPM_FIELD);
+        EncFloat(vehVel,VEHICLE_VELOCITY_FIELD);
+        SendPage(TELEM_MOTOR_VELOCITY_ID,now,velStamp);
+    }
+    
+    if(evTimer>canTimeout){
+        SendStale(TELEM_EVDC_DRIVE_ID,now);
+    } else {
+        EncFloat(driveVel,DRIVE_VELOCITY_FIELD);
+        EncFloat(driveCurr,DRIVE_CURRENT_FIELD);
+        SendPage(TELEM_EVDC_DRIVE_ID,now,evStamp);
+    }
+}
+
+// Temperatures and MPPTs, once per TX_INTERVAL. Timeout counters count
+// TX_INTERVALs as in RadioTransmit() but stop once timed out; a timed out
+// system is announced stale rather than sent as zeroes.
+void RadioSlow(void){
+    int j=0;
+    int fresh=0;
+    unsigned int32 now=GetMs();
+    
+    if(wsTimer<=canTimeout)wsTimer++;
+    if(evTimer<=canTimeout)evTimer++;
+    
+    if(wsTimer>canTimeout){
+        SendStale(TELEM_MOTOR_HS_TEMP_ID,now);
+        SendStale(TELEM_MOTOR_DSP_TEMP_ID,now);
+    } else {
+        EncFloat(contMotorTemp,MOTOR_TEMP_FIELD);
+        EncFloat(contHStemp,HEATSINK_TEMP_FIELD);
+        SendPage(TELEM_MOTOR_HS_TEMP_ID,now,hsStamp);
+        EncFloat(contDSPtemp,DSP_TEMP_FIELD);
+        SendPage(TELEM_MOTOR_DSP_TEMP_ID,now,dspStamp);
+    }
+    
+    // MPPTs that timed out are sent as zeroes, the page is stale once all have
+    for(j=0; j<MPPTCount; j++){
+        if(mpptTimer[j]<=canTimeout)mpptTimer[j]++;
+        if(mpptTimer[j]>canTimeout){
+            mpptStat[j]=0;
+            mpptVoltIn[j]=0;
+            mpptCurrIn[j]=0;
+            mpptVoltOut[j]=0;
+            mpptTemp[j]=0;
+        } else {
+            fresh=1;
+        }
+    }
+    if(!fresh){
+        SendStale(TELEM_MPPT_ID,now);
+        return;
+    }
+    for(j=0;j<MPPTCount;j++)EncInt(mpptStat[j],MPPT_FLAGS_FIELD);
+    for(j=0;j<MPPTCount;j++)EncInt(mpptVoltIn[j],MPPT_VOLTAGE_IN_FIELD);
+    for(j=0;j<MPPTCount;j++)EncInt(mpptCurrIn[j],MPPT_CURRENT_IN_FIELD);
+    for(j=0;j<MPPTCount;j++)EncInt(mpptVoltOut[j],MPPT_VOLTAGE_OUT_FIELD);
+    for(j=0;j<MPPTCount;j++)EncInt(mpptTemp[j],MPPT_TEMP_FIELD);
+    SendPage(TELEM_MPPT_ID,now,mpptStamp);
+}
+#endif
+
 /*
 void TelemCANpoll(int32 CANid){
     int     out_data[8] = {0,0,0,0,0,0,0,0};
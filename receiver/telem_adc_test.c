@@ -0,0 +1,217 @@
+// Spitfire telemetry receiver, ADC filter test
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Runs ADC traces through the transmitter's filter kernel
+// (transmitter/adc_filter.c) at the settings the firmware uses and a few
+// others, and checks every output against a floating point model of the same
+// CIC and IIR. Also checks that a full scale input comes out at full scale
+// for every order and rate, and that settings the integrators cannot hold
+// are lowered.
+//
+// A trace is one 12 bit conversion per line, lines starting with '#' are
+// skipped. The trace in the tree, ADC_TEST_TRACE, is synthetic: no trace
+// recorded from the board is checked in. Recorded traces are only run when
+// they are given on the command line, in place of the synthetic one.
+//
+// Usage: telem_adc_test [trace file...]
+// Exits with 1 if any check fails
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../transmitter/adc_filter.c"
+
+#define ADC_TEST_TRACE     "receiver/testdata/adc_aux_step.txt"
+#define ADC_TEST_MAX_LEN   (1 << 20)
+#define ADC_TEST_FULL      4095
+#define ADC_TEST_ONE       (1 << ADC_FILTER_FRAC_BITS)
+
+// CIC output rounding and the IIR's truncated state, in output units
+#define ADC_TEST_CIC_TOL   0.5
+#define ADC_TEST_IIR_TOL   1.5
+
+typedef struct
+{
+    int order;
+    int rate_shift;
+    int iir_shift;
+} adc_test_setting_t;
+
+static const adc_test_setting_t g_settings[] =
+{
+    {2, 3, 2},      // Aux pack taps in the transmitter and TelemAux
+    {2, 3, 0},      // Array current hall sensor
+    {1, 0, 0},      // Pass through
+    {1, 4, 0},      // Moving average
+    {3, 4, 1},
+    {3, 6, 3},      // Deepest a 3rd order CIC can go
+};
+#define N_SETTINGS (int)(sizeof(g_settings) / sizeof(g_settings[0]))
+
+static int read_trace(const char * path, adc_u16 * x)
+{
+    FILE * fp = fopen(path,"r");
+    char   line[256];
+    int    n = 0;
+    int    v;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    while ((n < ADC_TEST_MAX_LEN) && (fgets(line,sizeof(line),fp) != NULL))
+    {
+        if ((line[0] != '#') && (sscanf(line,"%d",&v) == 1))
+        {
+            x[n++] = (adc_u16)(v & 0xFFF);
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+// Floating point model of a setting, y[j] is the filter's jth output in
+// 1/ADC_TEST_ONE units. Each CIC output is N boxcars of R samples convolved,
+// ending at the last sample of its block, divided by the gain R^N
+static int model(const adc_test_setting_t * s, const adc_u16 * x, int n, double * y)
+{
+    int      r = 1 << s->rate_shift;
+    int      i;
+    int      k;
+    int      m;
+    int      n_out = 0;
+    double * a = malloc(n * sizeof(double));
+    double * b = malloc(n * sizeof(double));
+    double   iir = 0;
+
+    for (i = 0 ; i < n ; i++)
+    {
+        a[i] = x[i];
+    }
+    for (k = 0 ; k < s->order ; k++)
+    {
+        for (i = 0 ; i < n ; i++)
+        {
+            b[i] = 0;
+            for (m = 0 ; (m < r) && (m <= i) ; m++)
+            {
+                b[i] += a[i - m];
+            }
+        }
+        for (i = 0 ; i < n ; i++)
+        {
+            a[i] = b[i];
+        }
+    }
+    for (i = (s->order * r) - 1 ; i < n ; i += r)
+    {
+        double cic = a[i] * ADC_TEST_ONE / pow(r,s->order);
+        iir = (n_out == 0) ? cic : iir + (cic - iir) / (1 << s->iir_shift);
+        y[n_out++] = iir;
+    }
+    free(a);
+    free(b);
+    return n_out;
+}
+
+// Runs a trace through one setting and compares it with the model
+static int check_trace(const char * name, const adc_test_setting_t * s, const adc_u16 * x, int n, double * y)
+{
+    adc_filter_t f;
+    int          i;
+    int          n_out = 0;
+    int          n_model = model(s,x,n,y);
+    double       err;
+    double       max_err = 0;
+    double       tol = s->iir_shift ? ADC_TEST_IIR_TOL : ADC_TEST_CIC_TOL;
+
+    adc_filter_init(&f,s->order,s->rate_shift,s->iir_shift);
+    for (i = 0 ; i < n ; i++)
+    {
+        if (adc_filter_push(&f,x[i]))
+        {
+            if (n_out < n_model)
+            {
+                err = fabs(f.out - y[n_out]);
+                if (err > max_err)
+                {
+                    max_err = err;
+                }
+            }
+            n_out++;
+        }
+    }
+    printf("%-4s %s order %d rate %3d iir %d: %d outputs, max error %.3f/%d\n",
+           ((n_out == n_model) && (max_err <= tol)) ? "ok" : "FAIL",name,s->order,
+           1 << s->rate_shift,s->iir_shift,n_out,max_err,ADC_TEST_ONE);
+    if (n_out != n_model)
+    {
+        printf("     expected %d outputs\n",n_model);
+    }
+    return (n_out == n_model) && (max_err <= tol);
+}
+
+// A constant full scale input must come out at full scale once the filter
+// has started, for every order and rate, including the ones init lowers
+static int check_full_scale(void)
+{
+    adc_filter_t f;
+    int          order;
+    int          shift;
+    int          i;
+    int          pass = 1;
+
+    for (order = 1 ; order <= ADC_FILTER_MAX_ORDER ; order++)
+    {
+        for (shift = 0 ; shift <= 7 ; shift++)
+        {
+            adc_filter_init(&f,order,shift,0);
+            if (12 + f.order * f.rate_shift > 32)
+            {
+                printf("FAIL order %d rate shift %d kept at %d\n",order,shift,f.rate_shift);
+                pass = 0;
+            }
+            for (i = 0 ; i < 4 * (order << 7) ; i++)
+            {
+                if (adc_filter_push(&f,ADC_TEST_FULL) && (f.out != ADC_TEST_FULL * ADC_TEST_ONE))
+                {
+                    printf("FAIL full scale order %d rate shift %d: %u\n",order,shift,f.out);
+                    pass = 0;
+                    break;
+                }
+            }
+        }
+    }
+    printf("%-4s full scale at every order and rate\n",pass ? "ok" : "FAIL");
+    return pass;
+}
+
+int main(int argc, char ** argv)
+{
+    adc_u16 * x = malloc(ADC_TEST_MAX_LEN * sizeof(adc_u16));
+    double *  y = malloc(ADC_TEST_MAX_LEN * sizeof(double));
+    int       pass = check_full_scale();
+    int       n;
+    int       i;
+    int       j;
+
+    for (i = (argc > 1) ? 1 : 0 ; i < ((argc > 1) ? argc : 1) ; i++)
+    {
+        const char * path = (argc > 1) ? argv[i] : ADC_TEST_TRACE;
+
+        n = read_trace(path,x);
+        if (n <= 0)
+        {
+            fprintf(stderr,"Could not read %s\n",path);
+            return 1;
+        }
+        for (j = 0 ; j < N_SETTINGS ; j++)
+        {
+            pass &= check_trace(path,&g_settings[j],x,n,y);
+        }
+    }
+    free(x);
+    free(y);
+    printf("%s\n",pass ? "passed" : "FAILED");
+    return pass ? 0 : 1;
+}
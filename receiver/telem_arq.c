@@ -0,0 +1,109 @@
+// Spitfire telemetry receiver, selective retransmission requests
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Watches frame sequence numbers for gaps and builds CMD_NACK frames asking
+// the transmitter to resend the missing frames. Only frames of critical pages
+// are kept by the transmitter, requests for others are ignored and given up
+// after TELEM_ARQ_MAX_TRIES.
+
+#include <string.h>
+#include "telem_rx.h"
+
+void telem_arq_init(telem_arq_t * a, int timeout_ms)
+{
+    memset(a,0,sizeof(*a));
+    a->timeout_ms = timeout_ms;
+}
+
+static void arq_remove(telem_arq_t * a, int i)
+{
+    a->pending[i] = a->pending[--a->n_pending];
+}
+
+// Records a received frame, adding any skipped sequence numbers to the
+// pending list and clearing recovered ones
+void telem_arq_on_frame(telem_arq_t * a, const telem_frame_t * f)
+{
+    uint8_t gap;
+    int     i;
+
+    if (f->flags & TELEM_FLAG_RETX)
+    {
+        for (i = 0 ; i < a->n_pending ; i++)
+        {
+            if (a->pending[i].seq == f->seq)
+            {
+                arq_remove(a,i);
+                a->n_recovered++;
+                break;
+            }
+        }
+        return;
+    }
+
+    if (!a->valid)
+    {
+        a->valid    = 1;
+        a->next_seq = (uint8_t)(f->seq + 1);
+        return;
+    }
+
+    // Anything more than half the sequence space behind is a duplicate
+    gap = (uint8_t)(f->seq - a->next_seq);
+    if (gap >= 128)
+    {
+        return;
+    }
+    a->n_lost += gap;
+    while (a->next_seq != f->seq)
+    {
+        if (a->n_pending < TELEM_ARQ_MAX_PENDING)
+        {
+            a->pending[a->n_pending].seq     = a->next_seq;
+            a->pending[a->n_pending].tries   = 0;
+            a->pending[a->n_pending].sent_ms = 0;
+            a->n_pending++;
+        }
+        else
+        {
+            a->n_given_up++;
+        }
+        a->next_seq++;
+    }
+    a->next_seq = (uint8_t)(f->seq + 1);
+}
+
+// Builds a NACK frame for lost frames that are due a (repeated) request
+// Returns the frame length to send, or 0 if there is nothing to request
+int telem_arq_poll(telem_arq_t * a, int64_t now_ms, uint8_t * out)
+{
+    uint8_t seqs[TELEM_CMD_MAX_ARGS];
+    int     n = 0;
+    int     i = 0;
+
+    while ((i < a->n_pending) && (n < TELEM_CMD_MAX_ARGS))
+    {
+        telem_arq_pending_t * p = &a->pending[i];
+        if ((p->tries > 0) && (now_ms - p->sent_ms < a->timeout_ms))
+        {
+            i++;
+        }
+        else if (p->tries >= TELEM_ARQ_MAX_TRIES)
+        {
+            arq_remove(a,i);
+            a->n_given_up++;
+        }
+        else
+        {
+            seqs[n++]  = p->seq;
+            p->tries++;
+            p->sent_ms = now_ms;
+            i++;
+        }
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    return telem_cmd_build(CMD_NACK,seqs,n,out);
+}
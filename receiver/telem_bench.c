@@ -0,0 +1,173 @@
+// Spitfire telemetry receiver, compression benchmark
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Replays a recorded radio capture through the frame parser and the stream
+// compressor used by the transmitter, reporting compression ratio and
+// decoding throughput. Captures may be compressed already, they are expanded
+// first and then compressed again by the firmware's rules: only page frames
+// with a payload are compressed and count towards the history reset, control
+// frames, stale notices and retransmissions are sent as they are
+//
+// Usage: telem_bench <capture file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "telem_rx.h"
+
+#define BENCH_LZ_RESET_PERIOD 64    // Must match LZ_RESET_PERIOD in the firmware
+#define BENCH_MAX_FRAMES      (1 << 20)
+
+typedef struct
+{
+    telem_frame_t * frames;
+    int             n_frames;
+} bench_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void on_frame(const telem_frame_t * f, void * ctx)
+{
+    bench_t * b = (bench_t *)ctx;
+    if (b->n_frames < BENCH_MAX_FRAMES)
+    {
+        b->frames[b->n_frames++] = *f;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    FILE *          fp;
+    uint8_t *       buf;
+    long            size;
+    bench_t         b;
+    telem_parser_t  parser;
+    telem_lz_t      plain;
+    telem_lz_t      enc;
+    telem_lz_t      dec;
+    telem_frame_t * packed;
+    telem_frame_t   out;
+    uint8_t         lz_buf[TELEM_MAX_PAYLOAD];
+    long            raw_bytes = 0;
+    long            lz_bytes = 0;
+    int             i;
+    int             n;
+    int             n_lz = 0;
+    int             n_undecodable = 0;
+    int             bad = 0;
+    double          t0;
+    double          t_parse;
+    double          t_lz;
+
+    if (argc < 2)
+    {
+        fprintf(stderr,"usage: %s <capture file>\n",argv[0]);
+        return 1;
+    }
+    fp = fopen(argv[1],"rb");
+    if (fp == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(fp,0,SEEK_END);
+    size = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+    buf = malloc(size > 0 ? size : 1);
+    if ((buf == NULL) || (fread(buf,1,size,fp) != (size_t)size))
+    {
+        fprintf(stderr,"failed to read %s\n",argv[1]);
+        return 1;
+    }
+    fclose(fp);
+
+    b.frames   = malloc(sizeof(telem_frame_t) * BENCH_MAX_FRAMES);
+    packed     = malloc(sizeof(telem_frame_t) * BENCH_MAX_FRAMES);
+    b.n_frames = 0;
+
+    // Frame parsing
+    telem_parser_init(&parser);
+    t0 = now_s();
+    telem_parser_feed_buf(&parser,buf,(int)size,on_frame,&b);
+    t_parse = now_s() - t0;
+
+    // Expand frames the transmitter compressed, dropping the ones that cannot
+    // be expanded after a lost frame until the next history reset
+    telem_lz_init(&plain);
+    for (i = 0, n = 0 ; i < b.n_frames ; i++)
+    {
+        if (telem_lz_apply(&plain,&b.frames[i],&b.frames[n]))
+        {
+            n++;
+        }
+        else
+        {
+            n_undecodable++;
+        }
+    }
+    b.n_frames = n;
+
+    // Compress the page payloads the way the transmitter would
+    telem_lz_init(&enc);
+    for (i = 0 ; i < b.n_frames ; i++)
+    {
+        packed[i] = b.frames[i];
+        if ((b.frames[i].id < TELEM_CONTROL_ID_BASE)
+            && !(b.frames[i].flags & (TELEM_FLAG_RETX | TELEM_FLAG_STALE)))
+        {
+            if ((n_lz++ % BENCH_LZ_RESET_PERIOD) == 0)
+            {
+                telem_lz_reset(&enc);
+                packed[i].flags |= TELEM_FLAG_LZ_RESET;
+            }
+            n = telem_lz_compress(&enc,b.frames[i].payload,b.frames[i].len,lz_buf);
+            if (n > 0)
+            {
+                memcpy(packed[i].payload,lz_buf,n);
+                packed[i].len    = (uint8_t)n;
+                packed[i].flags |= TELEM_FLAG_LZ;
+            }
+        }
+        raw_bytes += b.frames[i].len + TELEM_FRAME_OVERHEAD;
+        lz_bytes  += packed[i].len + TELEM_FRAME_OVERHEAD;
+    }
+
+    // Decompression, checking it round trips
+    telem_lz_init(&dec);
+    t0 = now_s();
+    for (i = 0 ; i < b.n_frames ; i++)
+    {
+        if (!telem_lz_apply(&dec,&packed[i],&out) || (out.len != b.frames[i].len)
+            || memcmp(out.payload,b.frames[i].payload,out.len))
+        {
+            bad++;
+        }
+    }
+    t_lz = now_s() - t0;
+
+    printf("capture:     %ld bytes, %d frames, %u CRC errors, %u bytes skipped\n",
+           size,b.n_frames + n_undecodable,parser.n_crc_errors,parser.n_skipped);
+    if (n_undecodable > 0)
+    {
+        printf("             %d compressed frames left out, history lost\n",n_undecodable);
+    }
+    printf("parse:       %.1f MB/s\n",size / 1e6 / (t_parse > 0 ? t_parse : 1e-9));
+    if (raw_bytes > 0)
+    {
+        printf("compression: %ld -> %ld bytes on the wire (%.1f%%)\n",
+               raw_bytes,lz_bytes,100.0 * lz_bytes / raw_bytes);
+    }
+    printf("decompress:  %.1f MB/s, %d mismatches\n",
+           lz_bytes / 1e6 / (t_lz > 0 ? t_lz : 1e-9),bad);
+
+    free(packed);
+    free(b.frames);
+    free(buf);
+    return bad ? 1 : 0;
+}
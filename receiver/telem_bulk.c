@@ -0,0 +1,594 @@
+// Spitfire telemetry receiver, bulk capture decoder
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Parallel framing and page decoding of recorded captures into columns, see
+// telem_bulk.h
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "telem_bulk.h"
+
+#define MAX_THREADS 64
+
+// Frames found in one chunk of the capture
+typedef struct
+{
+    const uint8_t * buf;
+    size_t          len;
+    size_t          start;                  // Chunk covers frames starting in [start, end)
+    size_t          end;
+    size_t *        off;                    // Offsets of the frames found
+    size_t          n;
+    size_t          cap;
+    uint64_t        n_false_syncs;
+    int             failed;
+} chunk_t;
+
+// A frame ready for telem_decode_frame()
+typedef struct
+{
+    int64_t       source_ms;
+    telem_frame_t page;
+} page_t;
+
+// Decodes a range of pages into columns of its own
+typedef struct
+{
+    const page_t * pages;
+    int            n;
+    telem_column_t columns[TELEM_MAX_SIGNALS];
+    uint64_t       n_samples;
+    int            failed;
+} decoder_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns the first sync byte in [p, end), or NULL
+static const uint8_t * find_sync(const uint8_t * p, const uint8_t * end)
+{
+#if defined(__AVX2__)
+    const __m256i sync = _mm256_set1_epi8((char)TELEM_SYNC);
+    for ( ; p + 32 <= end ; p += 32)
+    {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p),sync));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i sync = _mm_set1_epi8((char)TELEM_SYNC);
+    for ( ; p + 16 <= end ; p += 16)
+    {
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),sync));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for ( ; p < end ; p++)
+    {
+        if (*p == TELEM_SYNC)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static size_t frame_size(const uint8_t * buf, size_t off)
+{
+    return TELEM_FRAME_OVERHEAD + buf[off + 1 + TELEM_HEADER_LEN];
+}
+
+// Finds the first frame starting in [pos, limit) the way telem_parser_t
+// would: a sync byte followed by a header, payload and matching CRC, and if
+// the CRC fails the search goes on from the byte after the sync. Returns 1 and
+// sets *off, or 0 if there is none.
+static int next_frame(const uint8_t * buf, size_t len, size_t pos, size_t limit, size_t * off, uint64_t * n_false)
+{
+    const uint8_t * p;
+    size_t          s;
+    size_t          size;
+
+    while (pos < limit)
+    {
+        p = find_sync(buf + pos,buf + limit);
+        if (p == NULL)
+        {
+            return 0;
+        }
+        s = (size_t)(p - buf);
+        if (s + 1 + TELEM_HEADER_SIZE > len)
+        {
+            return 0;                       // Truncated at the end of the capture
+        }
+        size = frame_size(buf,s);
+        if ((s + size <= len)
+            && (telem_crc8(0,buf + s + 1,(int)size - 2) == buf[s + size - 1]))
+        {
+            *off = s;
+            return 1;
+        }
+        (*n_false)++;
+        pos = s + 1;
+    }
+    return 0;
+}
+
+static int push_offset(chunk_t * c, size_t off)
+{
+    size_t * p;
+
+    if (c->n >= c->cap)
+    {
+        c->cap = (c->cap > 0) ? 2 * c->cap : 4096;
+        p = realloc(c->off,c->cap * sizeof(*p));
+        if (p == NULL)
+        {
+            c->failed = 1;
+            return -1;
+        }
+        c->off = p;
+    }
+    c->off[c->n++] = off;
+    return 0;
+}
+
+static void * frame_thread(void * arg)
+{
+    chunk_t * c   = (chunk_t *)arg;
+    size_t    pos = c->start;
+    size_t    off;
+
+    while (next_frame(c->buf,c->len,pos,c->end,&off,&c->n_false_syncs) && (push_offset(c,off) == 0))
+    {
+        pos = off + frame_size(c->buf,off);
+    }
+    return NULL;
+}
+
+// Appends the frames of chunk c to out, starting the scan at *next (the end
+// of the last frame kept). Until the scan lands on a frame the chunk found on
+// its own, frames are found again from *next, after that the chunk's list is
+// the same as a scan from the start of the capture would give.
+static int stitch(chunk_t * out, const chunk_t * c, size_t * next)
+{
+    size_t   pos = (*next > c->start) ? *next : c->start;
+    size_t   off;
+    size_t   j = 0;
+    uint64_t n_false = 0;                   // Already counted by the chunk's own scan
+
+    for (;;)
+    {
+        while ((j < c->n) && (c->off[j] < pos))
+        {
+            j++;
+        }
+        if (!next_frame(c->buf,c->len,pos,c->end,&off,&n_false))
+        {
+            *next = (pos > c->end) ? pos : c->end;
+            return 0;
+        }
+        if ((j < c->n) && (c->off[j] == off))
+        {
+            break;
+        }
+        if (push_offset(out,off) != 0)
+        {
+            return -1;
+        }
+        pos = off + frame_size(c->buf,off);
+    }
+
+    for ( ; j < c->n ; j++)
+    {
+        if (push_offset(out,c->off[j]) != 0)
+        {
+            return -1;
+        }
+    }
+    off   = c->off[c->n - 1] + frame_size(c->buf,c->off[c->n - 1]);
+    *next = (off > c->end) ? off : c->end;
+    return 0;
+}
+
+// Stage 1, finds every frame in the capture. out->off lists them in order.
+static int find_frames(telem_bulk_t * b, const uint8_t * buf, size_t len, int n_threads, chunk_t * out)
+{
+    chunk_t   chunks[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    int       started[MAX_THREADS];
+    size_t    next = 0;
+    int       i;
+    int       rc = 0;
+
+    memset(chunks,0,sizeof(chunks));
+    memset(out,0,sizeof(*out));
+    out->buf = buf;
+    out->len = len;
+    for (i = 0 ; i < n_threads ; i++)
+    {
+        chunks[i].buf   = buf;
+        chunks[i].len   = len;
+        chunks[i].start = len / n_threads * i;
+        chunks[i].end   = (i == n_threads - 1) ? len : len / n_threads * (i + 1);
+        started[i] = (pthread_create(&threads[i],NULL,frame_thread,&chunks[i]) == 0);
+        if (!started[i])
+        {
+            frame_thread(&chunks[i]);
+        }
+    }
+    for (i = 0 ; i < n_threads ; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i],NULL);
+        }
+    }
+
+    for (i = 0 ; i < n_threads ; i++)
+    {
+        if (chunks[i].failed || (stitch(out,&chunks[i],&next) != 0))
+        {
+            rc = -1;
+        }
+        b->n_false_syncs += chunks[i].n_false_syncs;
+        free(chunks[i].off);
+    }
+    return rc;
+}
+
+static void read_frame(const uint8_t * p, telem_frame_t * f)
+{
+    p++;                                    // Sync
+    f->id    = p[TELEM_HEADER_ID];
+    f->flags = p[TELEM_HEADER_FLAGS];
+    f->seq   = p[TELEM_HEADER_SEQ];
+    f->len   = p[TELEM_HEADER_LEN];
+    f->time  = (uint16_t)(p[TELEM_HEADER_TIME] | (p[TELEM_HEADER_TIME+1] << 8));
+    f->age   = (uint16_t)(p[TELEM_HEADER_AGE]  | (p[TELEM_HEADER_AGE+1]  << 8));
+    memcpy(f->payload,p + TELEM_HEADER_SIZE,f->len);
+}
+
+// Maps a capture file and readies the iterator
+// Returns 0, or -1 if the file could not be opened or mapped
+int telem_capture_open(telem_capture_t * c, const char * path)
+{
+    struct stat st;
+    void *      p = NULL;
+
+    memset(c,0,sizeof(*c));
+    c->fd = open(path,O_RDONLY);
+    if (c->fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(c->fd,&st) != 0)
+    {
+        close(c->fd);
+        return -1;
+    }
+    if (st.st_size > 0)
+    {
+        p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,c->fd,0);
+        if (p == MAP_FAILED)
+        {
+            close(c->fd);
+            return -1;
+        }
+        madvise(p,(size_t)st.st_size,MADV_SEQUENTIAL);
+    }
+    c->buf = (const uint8_t *)p;
+    c->len = (size_t)st.st_size;
+    telem_schema_init();
+    telem_crc8(0,c->buf,0);
+    telem_lz_init(&c->lz);
+    telem_delta_init(&c->delta);
+    telem_clock_init(&c->clock);
+    return 0;
+}
+
+// Gives up the pages of the mapping more than TELEM_CAPTURE_RELEASE behind the
+// iterator. They are clean file pages, so this only drops them from the
+// process and a later access would read them in again.
+static void capture_release(telem_capture_t * c)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end;
+
+    if (c->pos < c->released + 2 * TELEM_CAPTURE_RELEASE)
+    {
+        return;
+    }
+    end = (c->pos - TELEM_CAPTURE_RELEASE) / page * page;
+    madvise((void *)(c->buf + c->released),end - c->released,MADV_DONTNEED);
+    c->released = end;
+}
+
+// Decodes the next page of the capture, undoing LZ and delta coding
+// Returns 1 and sets *page and *source_ms, or 0 at the end of the capture
+int telem_capture_next(telem_capture_t * c, telem_frame_t * page, int64_t * source_ms)
+{
+    telem_frame_t f;
+    telem_frame_t plain;
+    size_t        off;
+
+    while (next_frame(c->buf,c->len,c->pos,c->len,&off,&c->n_false_syncs))
+    {
+        c->n_frames++;
+        c->pos = off + frame_size(c->buf,off);
+        read_frame(c->buf + off,&f);
+        capture_release(c);
+        if (telem_lz_apply(&c->lz,&f,&plain) && telem_delta_apply(&c->delta,&plain,page))
+        {
+            *source_ms = telem_frame_source_ms(&c->clock,page);
+            return 1;
+        }
+    }
+    c->pos = c->len;
+    return 0;
+}
+
+void telem_capture_close(telem_capture_t * c)
+{
+    if (c->buf != NULL)
+    {
+        munmap((void *)c->buf,c->len);
+    }
+    if (c->fd >= 0)
+    {
+        close(c->fd);
+    }
+    memset(c,0,sizeof(*c));
+    c->fd = -1;
+}
+
+// Appends a sample to a column, returns 0, or -1 if memory ran out
+int telem_column_push(telem_column_t * c, int64_t time_ms, double value)
+{
+    int64_t * t;
+    double *  v;
+    size_t    cap;
+
+    if (c->n >= c->cap)
+    {
+        cap = (c->cap > 0) ? 2 * c->cap : 1024;
+        t   = realloc(c->time,cap * sizeof(*t));
+        if (t == NULL)
+        {
+            return -1;
+        }
+        c->time = t;
+        v = realloc(c->value,cap * sizeof(*v));
+        if (v == NULL)
+        {
+            return -1;
+        }
+        c->value = v;
+        c->cap   = cap;
+    }
+    c->time[c->n]  = time_ms;
+    c->value[c->n] = value;
+    c->n++;
+    return 0;
+}
+
+// Appends column src to dst, returns 0, or -1 if memory ran out
+int telem_column_append(telem_column_t * dst, const telem_column_t * src)
+{
+    int64_t * t;
+    double *  v;
+    size_t    cap = dst->cap;
+
+    if (dst->n + src->n > cap)
+    {
+        while (dst->n + src->n > cap)
+        {
+            cap = (cap > 0) ? 2 * cap : 1024;
+        }
+        t = realloc(dst->time,cap * sizeof(*t));
+        if (t == NULL)
+        {
+            return -1;
+        }
+        dst->time = t;
+        v = realloc(dst->value,cap * sizeof(*v));
+        if (v == NULL)
+        {
+            return -1;
+        }
+        dst->value = v;
+        dst->cap   = cap;
+    }
+    memcpy(dst->time + dst->n,src->time,src->n * sizeof(*dst->time));
+    memcpy(dst->value + dst->n,src->value,src->n * sizeof(*dst->value));
+    dst->n += src->n;
+    return 0;
+}
+
+static void on_sample(int signal, int64_t time_ms, double value, void * ctx)
+{
+    decoder_t * d = (decoder_t *)ctx;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS) || (telem_column_push(&d->columns[signal],time_ms,value) != 0))
+    {
+        d->failed = 1;
+        return;
+    }
+    d->n_samples++;
+}
+
+static void * decode_thread(void * arg)
+{
+    decoder_t * d = (decoder_t *)arg;
+    int         i;
+
+    for (i = 0 ; i < d->n ; i++)
+    {
+        telem_decode_frame(&d->pages[i].page,d->pages[i].source_ms,on_sample,d);
+    }
+    return NULL;
+}
+
+// Stage 3, decodes a batch of pages and appends the samples in stream order.
+// The decoders' columns are kept from batch to batch so their memory is only
+// faulted in once.
+static int decode_pages(telem_bulk_t * b, decoder_t * dec, const page_t * pages, int n, int n_threads)
+{
+    pthread_t   threads[MAX_THREADS];
+    int         started[MAX_THREADS];
+    int         per = (n + n_threads - 1) / n_threads;
+    int         i;
+    int         j;
+    int         rc = 0;
+
+    for (i = 0 ; i < n_threads ; i++)
+    {
+        for (j = 0 ; j < TELEM_MAX_SIGNALS ; j++)
+        {
+            dec[i].columns[j].n = 0;
+        }
+        dec[i].n_samples = 0;
+        dec[i].pages = pages + i * per;
+        dec[i].n     = (n - i * per < per) ? n - i * per : per;
+        if (dec[i].n < 0)
+        {
+            dec[i].n = 0;
+        }
+        started[i] = (pthread_create(&threads[i],NULL,decode_thread,&dec[i]) == 0);
+        if (!started[i])
+        {
+            decode_thread(&dec[i]);
+        }
+    }
+    for (i = 0 ; i < n_threads ; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i],NULL);
+        }
+        for (j = 0 ; j < TELEM_MAX_SIGNALS ; j++)
+        {
+            if (dec[i].failed || (telem_column_append(&b->columns[j],&dec[i].columns[j]) != 0))
+            {
+                rc = -1;
+            }
+        }
+        b->n_samples += dec[i].n_samples;
+    }
+    return rc;
+}
+
+void telem_bulk_init(telem_bulk_t * b)
+{
+    memset(b,0,sizeof(*b));
+}
+
+void telem_bulk_free(telem_bulk_t * b)
+{
+    int i;
+
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        free(b->columns[i].time);
+        free(b->columns[i].value);
+    }
+    memset(b,0,sizeof(*b));
+}
+
+// Decodes a capture into b->columns, appending to what is already there
+// Returns 0, or -1 if memory ran out
+int telem_bulk_decode(telem_bulk_t * b, const uint8_t * buf, size_t len, int n_threads)
+{
+    chunk_t       frames;
+    page_t *      pages;
+    decoder_t *   dec;
+    telem_frame_t f;
+    telem_frame_t plain;
+    telem_lz_t    lz;
+    telem_delta_t delta;
+    telem_clock_t clock;
+    size_t        i = 0;
+    int           n;
+    int           rc;
+    double        t0;
+
+    if (n_threads < 1)
+    {
+        n_threads = 1;
+    }
+    if (n_threads > MAX_THREADS)
+    {
+        n_threads = MAX_THREADS;
+    }
+    telem_schema_init();
+    telem_crc8(0,buf,0);                    // Builds the CRC tables before the threads use them
+    b->n_bytes += len;
+
+    t0 = now_s();
+    rc = find_frames(b,buf,len,n_threads,&frames);
+    b->n_frames += frames.n;
+    b->t_frame  += now_s() - t0;
+
+    pages = malloc(TELEM_BULK_BATCH * sizeof(*pages));
+    dec   = calloc(n_threads,sizeof(*dec));
+    if ((pages == NULL) || (dec == NULL))
+    {
+        free(pages);
+        free(dec);
+        free(frames.off);
+        return -1;
+    }
+    telem_lz_init(&lz);
+    telem_delta_init(&delta);
+    telem_clock_init(&clock);
+    while ((i < frames.n) && (rc == 0))
+    {
+        // Stage 2, in stream order
+        t0 = now_s();
+        for (n = 0 ; (i < frames.n) && (n < TELEM_BULK_BATCH) ; i++)
+        {
+            read_frame(buf + frames.off[i],&f);
+            if (telem_lz_apply(&lz,&f,&plain) && telem_delta_apply(&delta,&plain,&pages[n].page))
+            {
+                pages[n].source_ms = telem_frame_source_ms(&clock,&pages[n].page);
+                n++;
+            }
+        }
+        b->t_unpack += now_s() - t0;
+
+        t0 = now_s();
+        rc = decode_pages(b,dec,pages,n,n_threads);
+        b->n_pages  += n;
+        b->t_decode += now_s() - t0;
+    }
+    b->n_rejected += lz.n_rejected + delta.n_rejected;
+    for (i = 0 ; i < (size_t)n_threads ; i++)
+    {
+        for (n = 0 ; n < TELEM_MAX_SIGNALS ; n++)
+        {
+            free(dec[i].columns[n].time);
+            free(dec[i].columns[n].value);
+        }
+    }
+    free(dec);
+    free(pages);
+    free(frames.off);
+    return rc;
+}
@@ -0,0 +1,82 @@
+#ifndef TELEM_BULK_H
+#define TELEM_BULK_H
+
+// Spitfire telemetry receiver, bulk capture decoder
+// Re-decodes a whole recorded radio capture (transparent mode, as written by
+// the radio) into one column of samples per signal. The result is the same as
+// feeding the capture through telem_parser_t and the live decoder, but the
+// work is split into three stages:
+//
+//   1. Framing, in parallel. The capture is cut into one chunk per thread and
+//      each thread finds the frames starting in its chunk with a vectorized
+//      sync byte search and the slice-by-8 CRC. A chunk may start inside a
+//      frame, so the chunk lists are stitched in order, rescanning from the
+//      end of the previous chunk's last frame until the two agree.
+//   2. LZ and delta decoding and clock unwrapping, in stream order since
+//      every frame depends on the ones before it. This is a copy per frame.
+//   3. Page decoding, in parallel over batches of pages into per-thread
+//      columns that are appended to the result in stream order.
+//
+// Captures are read through telem_capture_t, which maps the file instead of
+// reading it into memory. It can hand the mapping to telem_bulk_decode() or
+// be iterated one decoded page at a time, which keeps memory flat however long
+// the capture is: the pages of the file behind the iterator are released from
+// the mapping as it goes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "telem_rx.h"
+
+#define TELEM_BULK_BATCH      65536     // Pages decoded per parallel batch
+#define TELEM_CAPTURE_RELEASE (16 << 20) // Bytes behind the iterator kept mapped
+
+typedef struct
+{
+    int64_t * time;                         // Source time in ms
+    double *  value;
+    size_t    n;
+    size_t    cap;
+} telem_column_t;
+
+typedef struct
+{
+    telem_column_t columns[TELEM_MAX_SIGNALS];
+    uint64_t       n_bytes;                 // Capture size
+    uint64_t       n_frames;                // Frames with a valid CRC
+    uint64_t       n_false_syncs;           // Sync bytes that did not start a frame, a
+                                            // chunk edge may add a few
+    uint64_t       n_pages;                 // Frames decoded into samples
+    uint64_t       n_rejected;              // Frames LZ or delta decoding had to drop
+    uint64_t       n_samples;
+    double         t_frame;                 // Seconds spent in each stage
+    double         t_unpack;
+    double         t_decode;
+} telem_bulk_t;
+
+// A capture file mapped read only
+typedef struct
+{
+    const uint8_t * buf;
+    size_t          len;
+    int             fd;
+    size_t          pos;                    // Where the iterator resumes the search
+    size_t          released;               // Bytes before this are released
+    telem_lz_t      lz;
+    telem_delta_t   delta;
+    telem_clock_t   clock;
+    uint64_t        n_frames;
+    uint64_t        n_false_syncs;
+} telem_capture_t;
+
+int  telem_capture_open(telem_capture_t * c, const char * path);
+int  telem_capture_next(telem_capture_t * c, telem_frame_t * page, int64_t * source_ms);
+void telem_capture_close(telem_capture_t * c);
+
+int  telem_column_push(telem_column_t * c, int64_t time_ms, double value);
+int  telem_column_append(telem_column_t * dst, const telem_column_t * src);
+
+void telem_bulk_init(telem_bulk_t * b);
+void telem_bulk_free(telem_bulk_t * b);
+int  telem_bulk_decode(telem_bulk_t * b, const uint8_t * buf, size_t len, int n_threads);
+
+#endif
@@ -0,0 +1,78 @@
+// Spitfire telemetry receiver, ground station commands
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Builds command frames for the transmitter and reads back its acknowledges,
+// see transmitter/telem_frame.h for the command table
+
+#include <string.h>
+#include "telem_rx.h"
+
+// Builds a command frame into out, which must hold TELEM_CMD_MAX_FRAME bytes
+// Returns the frame length, or -1 if there are too many arguments
+int telem_cmd_build(uint8_t cmd, const uint8_t * args, int len, uint8_t * out)
+{
+    int n = 0;
+
+    if ((len < 0) || (len > TELEM_CMD_MAX_ARGS))
+    {
+        return -1;
+    }
+    out[n++] = TELEM_CMD_SYNC;
+    out[n++] = cmd;
+    out[n++] = (uint8_t)len;
+    if (len > 0)
+    {
+        memcpy(&out[n],args,len);
+        n += len;
+    }
+    out[n] = telem_crc8(0,&out[1],n - 1);
+    return n + 1;
+}
+
+int telem_cmd_set_send_period(uint16_t ms, uint8_t * out)
+{
+    uint8_t args[2] = {(uint8_t)ms, (uint8_t)(ms >> 8)};
+    return telem_cmd_build(CMD_SET_SEND_PERIOD,args,sizeof(args),out);
+}
+
+int telem_cmd_set_poll_period(uint16_t ms, uint8_t * out)
+{
+    uint8_t args[2] = {(uint8_t)ms, (uint8_t)(ms >> 8)};
+    return telem_cmd_build(CMD_SET_POLL_PERIOD,args,sizeof(args),out);
+}
+
+int telem_cmd_page_enable(uint8_t id, int enable, uint8_t * out)
+{
+    uint8_t args[2] = {id, (uint8_t)(enable != 0)};
+    return telem_cmd_build(CMD_PAGE_ENABLE,args,sizeof(args),out);
+}
+
+int telem_cmd_snapshot(uint8_t * out)
+{
+    return telem_cmd_build(CMD_SNAPSHOT,NULL,0,out);
+}
+
+int telem_cmd_poll_enable(uint8_t index, int enable, uint8_t * out)
+{
+    uint8_t args[2] = {index, (uint8_t)(enable != 0)};
+    return telem_cmd_build(CMD_POLL_ENABLE,args,sizeof(args),out);
+}
+
+// rssi is the ground station radio RSSI in dBm, 0 if unknown
+int telem_cmd_link_report(uint8_t loss, int rssi, uint8_t * out)
+{
+    uint8_t args[2] = {loss, (uint8_t)((rssi < -255) ? 255 : ((rssi > 0) ? 0 : -rssi))};
+    return telem_cmd_build(CMD_LINK_REPORT,args,sizeof(args),out);
+}
+
+// Reads an acknowledge frame, returns 1 and fills cmd and status if f is one
+int telem_cmd_parse_ack(const telem_frame_t * f, uint8_t * cmd, uint8_t * status)
+{
+    if ((f->id != TELEM_ACK_ID) || (f->len != 2))
+    {
+        return 0;
+    }
+    *cmd    = f->payload[0];
+    *status = f->payload[1];
+    return 1;
+}
@@ -0,0 +1,121 @@
+// Spitfire telemetry receiver, delta page reconstruction
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Rebuilds full pages from the keyframe and delta frames the transmitter sends
+// for slowly changing pages (TELEM_FLAG_KEYFRAME / TELEM_FLAG_DELTA)
+
+#include <string.h>
+#include "telem_rx.h"
+
+void telem_delta_init(telem_delta_t * d)
+{
+    memset(d,0,sizeof(*d));
+}
+
+// Reads a nibble from a buffer, MSB first
+static int get_nibble(const uint8_t * buf, int nibble)
+{
+    return (nibble & 1) ? (buf[nibble >> 1] & 0x0F) : (buf[nibble >> 1] >> 4);
+}
+
+// Turns keyframe and delta frames back into raw page frames
+// Frames that are not delta coded are copied unchanged. Returns 1 when out
+// holds a frame ready for telem_decode_frame(), 0 when the frame cannot be
+// rebuilt yet (no keyframe, or the delta refers to a keyframe that was lost)
+int telem_delta_apply(telem_delta_t * d, const telem_frame_t * in, telem_frame_t * out)
+{
+    int      page;
+    int      len;
+    int      nbitmap;
+    int      nibble;
+    int      i;
+    int      zz;
+    int      diff;
+    uint8_t * base;
+    uint8_t   page_buf[TELEM_MAX_PAYLOAD];
+
+    if (!(in->flags & (TELEM_FLAG_KEYFRAME | TELEM_FLAG_DELTA)))
+    {
+        if (out != in)
+        {
+            *out = *in;
+        }
+        return 1;
+    }
+
+    page = telem_page_index(in->id);
+    if ((page < 0) || (in->len < 1))
+    {
+        d->n_rejected++;
+        return 0;
+    }
+    base = d->base[page];
+
+    if (in->flags & TELEM_FLAG_KEYFRAME)
+    {
+        len = in->len - 1;
+        memcpy(page_buf,&in->payload[1],len);
+        
+        // A retransmitted keyframe only becomes the base if it is the one
+        // following the current base, otherwise it would roll it back
+        if (!(in->flags & TELEM_FLAG_RETX) || !d->valid[page]
+            || (in->payload[0] == (uint8_t)(d->tag[page] + 1)))
+        {
+            memcpy(base,page_buf,len);
+            d->len[page]   = (uint8_t)len;
+            d->tag[page]   = in->payload[0];
+            d->valid[page] = 1;
+        }
+    }
+    else
+    {
+        if (!d->valid[page] || (d->tag[page] != in->payload[0]))
+        {
+            d->n_rejected++;
+            return 0;
+        }
+        len     = d->len[page];
+        nbitmap = (len + 7) / 8;
+        nibble  = (1 + nbitmap) * 2;
+        if (in->len < 1 + nbitmap)
+        {
+            d->n_rejected++;
+            return 0;
+        }
+        memcpy(page_buf,base,len);
+        for (i = 0 ; i < len ; i++)
+        {
+            if (!(in->payload[1 + i/8] & (0x80 >> (i & 7))))
+            {
+                continue;
+            }
+            if (nibble >= in->len * 2)
+            {
+                d->n_rejected++;
+                return 0;
+            }
+            zz = get_nibble(in->payload,nibble++);
+            if (zz == TELEM_DELTA_ESCAPE)
+            {
+                if (nibble + 2 > in->len * 2)
+                {
+                    d->n_rejected++;
+                    return 0;
+                }
+                zz = (get_nibble(in->payload,nibble) << 4) | get_nibble(in->payload,nibble+1);
+                nibble += 2;
+            }
+            diff = (zz & 1) ? -((zz + 1) >> 1) : (zz >> 1);
+            page_buf[i] = (uint8_t)(base[i] + diff);
+        }
+    }
+
+    out->id    = in->id;
+    out->flags = (uint8_t)(in->flags & ~(TELEM_FLAG_KEYFRAME | TELEM_FLAG_DELTA));
+    out->seq   = in->seq;
+    out->len   = (uint8_t)len;
+    out->time  = in->time;
+    out->age   = in->age;
+    memcpy(out->payload,page_buf,len);
+    return 1;
+}
@@ -0,0 +1,242 @@
+// Spitfire telemetry receiver, derived signals
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Computes the signals of TELEM_DERIVE_TABLE from the decoded samples as they
+// arrive, see telem_derive.h
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "telem_rx.h"
+
+static const char * g_derive_name[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_NAME_ARRAY)
+};
+static const int g_derive_op[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_OP_ARRAY)
+};
+static const char * g_derive_trigger[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_TRIGGER_ARRAY)
+};
+static const char * g_derive_other[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_OTHER_ARRAY)
+};
+static const int g_derive_count[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_COUNT_ARRAY)
+};
+static const double g_derive_k[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_K_ARRAY)
+};
+static const double g_derive_p[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_P_ARRAY)
+};
+
+// Looks up element n of a name repeated count times, or the name itself
+static int lookup(const char * name, int count, int n)
+{
+    char buf[64];
+
+    if (count > 1)
+    {
+        snprintf(buf,sizeof(buf),"%s[%d]",name,n);
+        return telem_signal_lookup(buf);
+    }
+    return telem_signal_lookup(name);
+}
+
+// Appends an output to the list of outputs its trigger input drives, keeping
+// table order so an output is always computed before the ones that use it. A
+// total is triggered by its last element.
+static void link_trigger(telem_derive_t * d, int o)
+{
+    int * next = &d->first[d->out[o].a + d->out[o].n - 1];
+
+    while (*next >= 0)
+    {
+        next = &d->out[*next].next;
+    }
+    *next = o;
+}
+
+// Resolves the table against the signal names
+// Returns the number of derived signals, or -1 if an entry names a signal that
+// does not exist or is defined below it
+int telem_derive_init(telem_derive_t * d)
+{
+    telem_derive_out_t * o;
+    int                  i;
+    int                  n;
+    int                  count;
+
+    memset(d,0,sizeof(*d));
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        d->first[i] = -1;
+        d->time[i]  = INT64_MIN;            // No sample yet
+    }
+    for (i = 0 ; i < N_TELEM_DERIVE ; i++)
+    {
+        count = (g_derive_op[i] == DERIVE_TOTAL) ? 1 : g_derive_count[i];
+        for (n = 0 ; n < count ; n++)
+        {
+            if (d->n_out >= TELEM_MAX_DERIVED)
+            {
+                return -1;
+            }
+            o = &d->out[d->n_out];
+            o->op     = g_derive_op[i];
+            o->signal = lookup(g_derive_name[i],count,n);
+            o->a      = lookup(g_derive_trigger[i],g_derive_count[i],n);
+            o->b      = (g_derive_other[i][0] != '\0') ? lookup(g_derive_other[i],g_derive_count[i],n) : -1;
+            o->n      = 1;
+            o->k      = g_derive_k[i];
+            o->p      = g_derive_p[i];
+            o->next   = -1;
+            if (o->op == DERIVE_TOTAL)
+            {
+                // Elements of a repeated signal are numbered consecutively
+                o->n = g_derive_count[i];
+                if ((o->a >= 0) && (lookup(g_derive_trigger[i],o->n,o->n - 1) != o->a + o->n - 1))
+                {
+                    return -1;
+                }
+            }
+            if ((o->signal < 0) || (o->a < 0) || (o->a + o->n > o->signal) || (o->b >= o->signal)
+                || (((o->op == DERIVE_PRODUCT) || (o->op == DERIVE_SUM)) && (o->b < 0)))
+            {
+                return -1;
+            }
+            link_trigger(d,d->n_out++);
+        }
+    }
+    return d->n_out;
+}
+
+// Sets p of every output of the named derived signal, before the first sample
+// Returns 0, or -1 if no derived signal has that name
+int telem_derive_set_param(telem_derive_t * d, const char * name, double p)
+{
+    int signal = telem_signal_lookup(name);
+    int found = -1;
+    int i;
+
+    for (i = 0 ; i < d->n_out ; i++)
+    {
+        if ((signal >= 0) && (d->out[i].signal == signal))
+        {
+            d->out[i].p = p;
+            found = 0;
+        }
+    }
+    return found;
+}
+
+// Computes a derived output from a sample of its trigger
+// Returns 1 and sets *out, or 0 if the output has no value yet
+static int compute(telem_derive_t * d, telem_derive_out_t * o, int64_t time_ms, double value, double * out)
+{
+    double dt;
+    int    i;
+
+    switch (o->op)
+    {
+        case DERIVE_PRODUCT:
+            *out = o->k * value * d->value[o->b];
+            return d->time[o->b] != INT64_MIN;
+        case DERIVE_SUM:
+            *out = value + o->k * d->value[o->b];
+            return d->time[o->b] != INT64_MIN;
+        case DERIVE_LINEAR:
+            *out = o->k * value + o->p;
+            return 1;
+        case DERIVE_TOTAL:
+            *out = 0;
+            for (i = 0 ; i < o->n ; i++)
+            {
+                if (d->time[o->a + i] == INT64_MIN)
+                {
+                    return 0;
+                }
+                *out += d->value[o->a + i];
+            }
+            *out *= o->k;
+            return 1;
+        case DERIVE_INTEGRAL:
+            if (o->primed)
+            {
+                o->acc += o->k * (time_ms - o->t_prev) * 1e-3 * (o->v_prev + value) * 0.5;
+            }
+            *out = o->acc;
+            return 1;
+        case DERIVE_EMA:
+            if (o->primed)
+            {
+                dt      = (double)(time_ms - o->t_prev);
+                o->acc += (1.0 - exp(-dt / o->p)) * (value - o->acc);
+            }
+            else
+            {
+                o->acc = value;
+            }
+            *out = o->k * o->acc;
+            return 1;
+        case DERIVE_PERCENT:
+            *out = o->k * value + o->p;
+            if (*out < 0)
+            {
+                *out = 0;
+            }
+            else if (*out > 100)
+            {
+                *out = 100;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Takes a decoded sample and calls cb for every derived sample it produces,
+// the sample itself is not passed to cb. Samples older than the newest of
+// their signal (retransmissions) and values that are not numbers do not update
+// derived signals, so one corrupt float cannot poison an integral.
+void telem_derive_sample(telem_derive_t * d, int signal, int64_t time_ms, double value, telem_sample_cb_t cb, void * ctx)
+{
+    telem_derive_out_t * o;
+    double               out;
+    int                  i;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return;
+    }
+    if ((time_ms < d->time[signal]) || !isfinite(value))
+    {
+        d->n_skipped++;
+        return;
+    }
+    d->value[signal] = value;
+    d->time[signal]  = time_ms;
+
+    for (i = d->first[signal] ; i >= 0 ; i = o->next)
+    {
+        o = &d->out[i];
+        if (compute(d,o,time_ms,value,&out))
+        {
+            d->n_samples++;
+            cb(o->signal,time_ms,out,ctx);
+            telem_derive_sample(d,o->signal,time_ms,out,cb,ctx);
+        }
+        o->t_prev = time_ms;
+        o->v_prev = value;
+        o->primed = 1;
+    }
+}
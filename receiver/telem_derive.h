@@ -0,0 +1,68 @@
+#ifndef TELEM_DERIVE_H
+#define TELEM_DERIVE_H
+
+// Spitfire telemetry receiver, derived signals
+// NOTE: The table below is an x-macro, see transmitter/can_telem.h
+//
+// Derived signals are computed on the ground station as samples are decoded
+// and are handled like any other signal from then on. They are numbered after
+// the decoded signals, in table order, and a count above 1 repeats an entry
+// for elements [0] to [count - 1] of its inputs. Each entry is computed when
+// its trigger input gets a sample, using the newest value of the other input,
+// so the trigger should be the input decoded last. An entry may use the
+// derived signals above it. Every operation costs O(1) per sample.
+//
+//   DERIVE_PRODUCT   k * a * b
+//   DERIVE_SUM       a + k * b
+//   DERIVE_LINEAR    k * a + p
+//   DERIVE_TOTAL     k * (a[0] + ... + a[count - 1]), one output, triggered by
+//                    the last element
+//   DERIVE_INTEGRAL  k * trapezoid integral of a over time in seconds
+//   DERIVE_EMA       Exponential moving average of a, time constant p ms
+//   DERIVE_PERCENT   k * a + p, limited to 0 to 100
+//
+// telem_derive_set_param changes p of an entry at startup, such as the state
+// of charge the pack starts from.
+
+#define DERIVE_PRODUCT  0
+#define DERIVE_SUM      1
+#define DERIVE_LINEAR   2
+#define DERIVE_TOTAL    3
+#define DERIVE_INTEGRAL 4
+#define DERIVE_EMA      5
+#define DERIVE_PERCENT  6
+
+// Drivetek MPPT input measurement steps
+#define MPPT_VOLTAGE_IN_V  0.15049
+#define MPPT_CURRENT_IN_A  0.00872
+
+// Usable pack energy for the state of charge estimate, set to the pack in the
+// car. Pack energy is counted from zero when the ground station starts, and
+// the state of charge from the p of PACK_SOC, a full pack unless telemd is
+// given the starting charge with -s.
+#define PACK_CAPACITY_WH   5000.0
+
+#define EXPAND_AS_DERIVE_NAME_ARRAY(a,b,c,d,e,f,g)    #a,
+#define EXPAND_AS_DERIVE_OP_ARRAY(a,b,c,d,e,f,g)      b,
+#define EXPAND_AS_DERIVE_TRIGGER_ARRAY(a,b,c,d,e,f,g) #c,
+#define EXPAND_AS_DERIVE_OTHER_ARRAY(a,b,c,d,e,f,g)   #d,
+#define EXPAND_AS_DERIVE_COUNT_ARRAY(a,b,c,d,e,f,g)   e,
+#define EXPAND_AS_DERIVE_K_ARRAY(a,b,c,d,e,f,g)       f,
+#define EXPAND_AS_DERIVE_P_ARRAY(a,b,c,d,e,f,g)       g,
+
+// X macro table of derived signals, powers in W and energies in Wh. Pack
+// power is the motor's draw less the array's input, positive when the pack is
+// discharging.
+//        Signal name   , Operation      , Trigger (a)      , Other (b)        , Count, k                                    , p
+#define TELEM_DERIVE_TABLE(ENTRY)                                                                                                     \
+    ENTRY(MPPT_POWER_IN , DERIVE_PRODUCT , MPPT_CURRENT_IN  , MPPT_VOLTAGE_IN  ,     4, MPPT_VOLTAGE_IN_V * MPPT_CURRENT_IN_A,     0) \
+    ENTRY(ARRAY_POWER   , DERIVE_TOTAL   , MPPT_POWER_IN    ,                  ,     4, 1                                    ,     0) \
+    ENTRY(MOTOR_POWER   , DERIVE_PRODUCT , MOTOR_BUS_CURRENT, MOTOR_BUS_VOLTAGE,     1, 1                                    ,     0) \
+    ENTRY(PACK_POWER    , DERIVE_SUM     , MOTOR_POWER      , ARRAY_POWER      ,     1, -1                                   ,     0) \
+    ENTRY(PACK_POWER_AVG, DERIVE_EMA     , PACK_POWER       ,                  ,     1, 1                                    , 10000) \
+    ENTRY(ARRAY_ENERGY  , DERIVE_INTEGRAL, ARRAY_POWER      ,                  ,     1, 1.0 / 3600                           ,     0) \
+    ENTRY(PACK_ENERGY   , DERIVE_INTEGRAL, PACK_POWER       ,                  ,     1, 1.0 / 3600                           ,     0) \
+    ENTRY(PACK_SOC      , DERIVE_PERCENT , PACK_ENERGY      ,                  ,     1, -100.0 / PACK_CAPACITY_WH            ,   100)
+#define N_TELEM_DERIVE 8
+
+#endif
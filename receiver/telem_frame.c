@@ -0,0 +1,199 @@
+// Spitfire telemetry receiver, radio frame parser
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Finds frame boundaries in the radio byte stream, checks the CRC and
+// recovers the source timestamp of each page
+
+#include <string.h>
+#include "telem_rx.h"
+
+// Parser states
+enum
+{
+    PARSE_SYNC,
+    PARSE_HEADER,
+    PARSE_PAYLOAD,
+    PARSE_CRC
+};
+
+// Slicing tables, g_crc8_table[k][x] is the CRC of byte x followed by k zero
+// bytes. The CRC is linear, so 8 bytes can be folded in with 8 independent
+// lookups instead of a chain of 8 dependent ones.
+static uint8_t g_crc8_table[8][256];
+static int     gb_crc8_ready = 0;
+
+static void crc8_init(void)
+{
+    int i;
+    int j;
+    for (i = 0 ; i < 256 ; i++)
+    {
+        uint8_t c = (uint8_t)i;
+        for (j = 0 ; j < 8 ; j++)
+        {
+            c = (c & 0x80) ? (uint8_t)((c << 1) ^ TELEM_CRC_POLY) : (uint8_t)(c << 1);
+        }
+        g_crc8_table[0][i] = c;
+    }
+    for (j = 1 ; j < 8 ; j++)
+    {
+        for (i = 0 ; i < 256 ; i++)
+        {
+            g_crc8_table[j][i] = g_crc8_table[0][g_crc8_table[j - 1][i]];
+        }
+    }
+    gb_crc8_ready = 1;
+}
+
+uint8_t telem_crc8(uint8_t crc, const uint8_t * data, int len)
+{
+    int i = 0;
+    if (!gb_crc8_ready)
+    {
+        crc8_init();
+    }
+    for ( ; i + 8 <= len ; i += 8)
+    {
+        crc = g_crc8_table[7][crc ^ data[i]]     ^ g_crc8_table[6][data[i + 1]]
+            ^ g_crc8_table[5][data[i + 2]]       ^ g_crc8_table[4][data[i + 3]]
+            ^ g_crc8_table[3][data[i + 4]]       ^ g_crc8_table[2][data[i + 5]]
+            ^ g_crc8_table[1][data[i + 6]]       ^ g_crc8_table[0][data[i + 7]];
+    }
+    for ( ; i < len ; i++)
+    {
+        crc = g_crc8_table[0][crc ^ data[i]];
+    }
+    return crc;
+}
+
+void telem_parser_init(telem_parser_t * p)
+{
+    memset(p,0,sizeof(*p));
+    p->state = PARSE_SYNC;
+}
+
+// Consumes one byte, returns 1 and fills out when a valid frame completes
+static int parser_step(telem_parser_t * p, uint8_t c, telem_frame_t * out)
+{
+    switch (p->state)
+    {
+        case PARSE_SYNC:
+            if (c == TELEM_SYNC)
+            {
+                p->count = 0;
+                p->state = PARSE_HEADER;
+            }
+            else
+            {
+                p->n_skipped++;
+            }
+            return 0;
+        case PARSE_HEADER:
+            p->raw[p->count++] = c;
+            if (p->count == TELEM_HEADER_SIZE)
+            {
+                p->state = (p->raw[TELEM_HEADER_LEN] > 0) ? PARSE_PAYLOAD : PARSE_CRC;
+            }
+            return 0;
+        case PARSE_PAYLOAD:
+            p->raw[p->count++] = c;
+            if (p->count == TELEM_HEADER_SIZE + p->raw[TELEM_HEADER_LEN])
+            {
+                p->state = PARSE_CRC;
+            }
+            return 0;
+        case PARSE_CRC:
+        default:
+            p->state = PARSE_SYNC;
+            if (telem_crc8(0,p->raw,p->count) != c)
+            {
+                p->n_crc_errors++;
+                return -1;
+            }
+            out->id    = p->raw[TELEM_HEADER_ID];
+            out->flags = p->raw[TELEM_HEADER_FLAGS];
+            out->seq   = p->raw[TELEM_HEADER_SEQ];
+            out->len   = p->raw[TELEM_HEADER_LEN];
+            out->time  = (uint16_t)(p->raw[TELEM_HEADER_TIME] | (p->raw[TELEM_HEADER_TIME+1] << 8));
+            out->age   = (uint16_t)(p->raw[TELEM_HEADER_AGE]  | (p->raw[TELEM_HEADER_AGE+1]  << 8));
+            memcpy(out->payload,&p->raw[TELEM_HEADER_SIZE],out->len);
+            p->n_frames++;
+            return 1;
+    }
+}
+
+// Feeds one byte of the radio stream into the parser, cb is called for every
+// complete frame with a valid CRC
+// A CRC failure means the sync byte was a false match, the bytes consumed since
+// that sync are replayed so a real frame starting inside them is not lost
+void telem_parser_feed(telem_parser_t * p, uint8_t c, telem_frame_cb_t cb, void * ctx)
+{
+    uint8_t replay[sizeof(p->raw) + 1];
+    int     n;
+    int     i;
+    int     rc;
+
+    n = p->count;
+    if (p->state == PARSE_CRC)
+    {
+        memcpy(replay,p->raw,n);
+        replay[n++] = c;
+    }
+    rc = parser_step(p,c,&p->frame);
+    if (rc > 0)
+    {
+        cb(&p->frame,ctx);
+    }
+    else if (rc < 0)
+    {
+        for (i = 0 ; i < n ; i++)
+        {
+            telem_parser_feed(p,replay[i],cb,ctx);
+        }
+    }
+}
+
+// Feeds a buffer of the radio stream into the parser
+void telem_parser_feed_buf(telem_parser_t * p, const uint8_t * buf, int len, telem_frame_cb_t cb, void * ctx)
+{
+    int i;
+    for (i = 0 ; i < len ; i++)
+    {
+        telem_parser_feed(p,buf[i],cb,ctx);
+    }
+}
+
+void telem_clock_init(telem_clock_t * c)
+{
+    memset(c,0,sizeof(*c));
+}
+
+// Frames arrive far more often than the 65 s wrap period of the 16 bit clock,
+// so the clock is unwrapped by the signed difference to the newest frame.
+// Older frames (retransmissions) are placed before it without moving it back.
+int64_t telem_clock_unwrap(telem_clock_t * c, uint16_t time)
+{
+    int16_t d;
+    int64_t t;
+
+    if (!c->valid)
+    {
+        c->last  = time;
+        c->valid = 1;
+        return c->last;
+    }
+    d = (int16_t)(uint16_t)(time - (uint16_t)c->last);
+    t = c->last + d;
+    if (d > 0)
+    {
+        c->last = t;
+    }
+    return t;
+}
+
+// Returns the time the page carried by a frame was last updated on CAN, in
+// the transmitter's unwrapped clock domain
+int64_t telem_frame_source_ms(telem_clock_t * c, const telem_frame_t * f)
+{
+    return telem_clock_unwrap(c,f->time) - f->age;
+}
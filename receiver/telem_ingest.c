@@ -0,0 +1,797 @@
+// Spitfire telemetry receiver, historical log ingest
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Loads every radio capture and candump log in the given directories (or
+// files) into one time series store, decoding on every core, and reports the
+// throughput. Queries from -q are answered on the result, see telem_store.h.
+//
+// Files are told apart by their first bytes: candump logs start with '(',
+// TelemAux ASCII archives with '#', radio captures have frames in their first
+// SNIFF_LEN bytes and anything else is taken as a legacy raw page archive, see
+// telem_legacy.h.
+//
+// Work is split into tasks: one per capture or legacy archive, since LZ and
+// delta coding or the page schedule make each one stream, and one per
+// CANDUMP_CHUNK of a candump log, since every log line stands alone. Each
+// worker has its own deque of tasks, biggest first. It takes work from the
+// back of its own deque and, once that is empty, steals from the front of the
+// others, so a worker stuck with one long capture does not hold up the rest.
+//
+// Samples are stored in Unix time (ms). Candump logs carry it already, other
+// files only have the transmitter clock or the send schedule so they are
+// placed to end at the file's modification time.
+//
+// Usage: telem_ingest [-j threads] [-q query]... <directory or file>...
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "telem_bulk.h"
+#include "telem_store.h"
+
+#define MAX_FILES       4096
+#define MAX_WORKERS     64
+#define MAX_QUERIES     16
+#define CANDUMP_CHUNK   (4 << 20)   // Bytes of candump log per task
+#define CANDUMP_MAX_LINE 256
+#define SNIFF_LEN       65536       // Bytes searched for frames to spot a capture
+
+#define KIND_CAPTURE 0
+#define KIND_CANDUMP 1
+#define KIND_LEGACY  2
+#define KIND_AUX     3
+
+typedef struct
+{
+    char    path[512];
+    int     kind;
+    size_t  size;
+    int64_t mtime_ms;
+} file_t;
+
+typedef struct
+{
+    int            file;
+    size_t         start;                   // Byte range of the file
+    size_t         end;
+    telem_bulk_t * out;
+    int64_t        t_first;                 // First sample time, for merging in order
+    int            failed;
+} task_t;
+
+// Tasks of one worker, the owner works from the back and thieves from the front
+typedef struct
+{
+    pthread_mutex_t lock;
+    int *           tasks;
+    int             head;
+    int             tail;
+    uint32_t        n_run;
+    uint32_t        n_stolen;
+} deque_t;
+
+typedef struct
+{
+    file_t *  files;
+    int       n_files;
+    task_t *  tasks;
+    int       n_tasks;
+    deque_t   deques[MAX_WORKERS];
+    int       n_workers;
+} ingest_t;
+
+typedef struct
+{
+    ingest_t * in;
+    int        id;
+} worker_arg_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int read_range(const char * path, size_t start, size_t len, uint8_t * buf)
+{
+    int     fd = open(path,O_RDONLY);
+    size_t  got = 0;
+    ssize_t n;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    while (got < len)
+    {
+        n = pread(fd,buf + got,len - got,(off_t)(start + got));
+        if (n <= 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(fd);
+    return (got == len) ? 0 : -1;
+}
+
+static void count_frame(const telem_frame_t * f, void * ctx)
+{
+    (void)f;
+    (*(int *)ctx)++;
+}
+
+// Tells the kind of a file from its first bytes
+static int sniff(const char * path, size_t size)
+{
+    static uint8_t buf[SNIFF_LEN];          // Only called before the workers start
+    telem_parser_t p;
+    size_t         len = (size < SNIFF_LEN) ? size : SNIFF_LEN;
+    int            n_frames = 0;
+
+    if (read_range(path,0,len,buf) != 0)
+    {
+        return -1;
+    }
+    if (buf[0] == '(')
+    {
+        return KIND_CANDUMP;
+    }
+    if (buf[0] == '#')
+    {
+        return KIND_AUX;
+    }
+    telem_parser_init(&p);
+    telem_parser_feed_buf(&p,buf,(int)len,count_frame,&n_frames);
+    return (n_frames > 0) ? KIND_CAPTURE : KIND_LEGACY;
+}
+
+static int add_file(ingest_t * in, const char * path)
+{
+    struct stat st;
+    file_t *    f;
+    int         kind;
+
+    if ((stat(path,&st) != 0) || !S_ISREG(st.st_mode) || (st.st_size == 0) || (in->n_files >= MAX_FILES))
+    {
+        return -1;
+    }
+    kind = sniff(path,(size_t)st.st_size);
+    if (kind < 0)
+    {
+        return -1;
+    }
+
+    f = &in->files[in->n_files++];
+    snprintf(f->path,sizeof(f->path),"%s",path);
+    f->kind     = kind;
+    f->size     = (size_t)st.st_size;
+    f->mtime_ms = (int64_t)st.st_mtime * 1000;
+    return 0;
+}
+
+static void add_path(ingest_t * in, const char * path)
+{
+    DIR *           dir = opendir(path);
+    struct dirent * e;
+    char            buf[512];
+
+    if (dir == NULL)
+    {
+        add_file(in,path);
+        return;
+    }
+    while ((e = readdir(dir)) != NULL)
+    {
+        if (e->d_name[0] != '.')
+        {
+            snprintf(buf,sizeof(buf),"%s/%s",path,e->d_name);
+            add_path(in,buf);
+        }
+    }
+    closedir(dir);
+}
+
+static void push_sample(int signal, int64_t time_ms, double value, void * ctx)
+{
+    task_t * t = (task_t *)ctx;
+
+    if (telem_column_push(&t->out->columns[signal],time_ms,value) != 0)
+    {
+        t->failed = 1;
+        return;
+    }
+    t->out->n_samples++;
+}
+
+// Moves the samples of a file with no wall clock time to end at the file's
+// modification time
+static void place_at_mtime(const file_t * f, task_t * t)
+{
+    int64_t t_last = INT64_MIN;
+    int64_t shift;
+    size_t  j;
+    int     i;
+
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        for (j = 0 ; j < t->out->columns[i].n ; j++)
+        {
+            if (t->out->columns[i].time[j] > t_last)
+            {
+                t_last = t->out->columns[i].time[j];
+            }
+        }
+    }
+    shift = f->mtime_ms - t_last;
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        for (j = 0 ; j < t->out->columns[i].n ; j++)
+        {
+            t->out->columns[i].time[j] += shift;
+        }
+    }
+}
+
+// Decodes a whole radio capture or legacy archive straight from its mapping
+static void run_stream(const file_t * f, task_t * t)
+{
+    telem_capture_t cap;
+    telem_legacy_t  legacy;
+    telem_aux_t     aux;
+
+    if (telem_capture_open(&cap,f->path) != 0)
+    {
+        t->failed = 1;
+        return;
+    }
+    if (f->kind == KIND_CAPTURE)
+    {
+        t->failed = (telem_bulk_decode(t->out,cap.buf,cap.len,1) != 0);
+    }
+    else if (f->kind == KIND_LEGACY)
+    {
+        telem_legacy_init(&legacy);
+        telem_legacy_decode(&legacy,cap.buf,cap.len,push_sample,t);
+        t->out->n_bytes  += cap.len;
+        t->out->n_frames += legacy.n_pages;
+    }
+    else
+    {
+        telem_aux_init(&aux);
+        telem_aux_decode(&aux,(const char *)cap.buf,cap.len,push_sample,t);
+        t->out->n_bytes  += cap.len;
+        t->out->n_frames += aux.n_lines;
+    }
+    telem_capture_close(&cap);
+    place_at_mtime(f,t);
+}
+
+// Parses one candump line, "(1436509052.249713) can0 401#0011223344556677"
+static void candump_line(task_t * t, const char * line)
+{
+    long long sec;
+    long      usec;
+    unsigned  id;
+    char      hex[CANDUMP_MAX_LINE];
+    uint8_t   data[8];
+    int       len = 0;
+    unsigned  byte;
+
+    if (sscanf(line,"(%lld.%ld) %*s %x#%255s",&sec,&usec,&id,hex) != 4)
+    {
+        return;
+    }
+    if (id > 0x7FF)
+    {
+        return;                             // Extended (29 bit) IDs are not ours
+    }
+    while ((len < 8) && (hex[2 * len] != '\0') && (sscanf(&hex[2 * len],"%2x",&byte) == 1))
+    {
+        data[len++] = (uint8_t)byte;
+    }
+    telem_decode_can((uint16_t)id,data,len,sec * 1000 + usec / 1000,push_sample,t);
+}
+
+// Decodes the lines of a candump log that start in [start, end)
+static void run_candump(const file_t * f, task_t * t)
+{
+    size_t  from = (t->start > 0) ? t->start - 1 : 0;
+    size_t  to   = (t->end + CANDUMP_MAX_LINE < f->size) ? t->end + CANDUMP_MAX_LINE : f->size;
+    char *  buf  = malloc(to - from + 1);
+    char *  p;
+    char *  nl;
+    char *  end;
+
+    if ((buf == NULL) || (read_range(f->path,from,to - from,(uint8_t *)buf) != 0))
+    {
+        t->failed = 1;
+        free(buf);
+        return;
+    }
+    buf[to - from] = '\0';
+    end = buf + (t->end - from);
+    p   = buf;
+    if (t->start > 0)
+    {
+        // The line in progress at the start belongs to the previous task
+        p = strchr(buf,'\n');
+        p = (p != NULL) ? p + 1 : end;
+    }
+    while (p < end)
+    {
+        nl = strchr(p,'\n');
+        if (nl != NULL)
+        {
+            *nl = '\0';
+        }
+        t->out->n_frames++;
+        candump_line(t,p);
+        if (nl == NULL)
+        {
+            break;
+        }
+        p = nl + 1;
+    }
+    t->out->n_bytes += t->end - t->start;
+    free(buf);
+}
+
+static void run_task(ingest_t * in, task_t * t)
+{
+    const file_t * f = &in->files[t->file];
+    int            i;
+
+    t->out = calloc(1,sizeof(*t->out));
+    if (t->out == NULL)
+    {
+        t->failed = 1;
+        return;
+    }
+    if (f->kind == KIND_CANDUMP)
+    {
+        run_candump(f,t);
+    }
+    else
+    {
+        run_stream(f,t);
+    }
+
+    t->t_first = INT64_MAX;
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        if ((t->out->columns[i].n > 0) && (t->out->columns[i].time[0] < t->t_first))
+        {
+            t->t_first = t->out->columns[i].time[0];
+        }
+    }
+}
+
+// Takes a task from the back of a worker's own deque
+static int pop_task(deque_t * d)
+{
+    int t = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head)
+    {
+        t = d->tasks[--d->tail];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+// Takes a task from the front of another worker's deque
+static int steal_task(deque_t * d)
+{
+    int t = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head)
+    {
+        t = d->tasks[d->head++];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+static void * worker_thread(void * arg)
+{
+    worker_arg_t * w  = (worker_arg_t *)arg;
+    ingest_t *     in = w->in;
+    deque_t *      own = &in->deques[w->id];
+    int            t;
+    int            i;
+
+    for (;;)
+    {
+        t = pop_task(own);
+        for (i = 1 ; (t < 0) && (i < in->n_workers) ; i++)
+        {
+            t = steal_task(&in->deques[(w->id + i) % in->n_workers]);
+            if (t >= 0)
+            {
+                own->n_stolen++;
+            }
+        }
+        if (t < 0)
+        {
+            return NULL;                    // Tasks are never added, so nothing is left anywhere
+        }
+        run_task(in,&in->tasks[t]);
+        own->n_run++;
+    }
+}
+
+static int make_tasks(ingest_t * in)
+{
+    file_t * f;
+    size_t   pos;
+    int      i;
+    int      n = 0;
+
+    for (i = 0 ; i < in->n_files ; i++)
+    {
+        n += (in->files[i].kind != KIND_CANDUMP) ? 1 : (int)((in->files[i].size + CANDUMP_CHUNK - 1) / CANDUMP_CHUNK);
+    }
+    in->tasks = calloc(n > 0 ? n : 1,sizeof(*in->tasks));
+    if (in->tasks == NULL)
+    {
+        return -1;
+    }
+    for (i = 0 ; i < in->n_files ; i++)
+    {
+        f = &in->files[i];
+        for (pos = 0 ; pos < f->size ; pos += CANDUMP_CHUNK)
+        {
+            in->tasks[in->n_tasks].file  = i;
+            in->tasks[in->n_tasks].start = pos;
+            in->tasks[in->n_tasks].end   = f->size;
+            if ((f->kind == KIND_CANDUMP) && (pos + CANDUMP_CHUNK < f->size))
+            {
+                in->tasks[in->n_tasks].end = pos + CANDUMP_CHUNK;
+            }
+            if (f->kind != KIND_CANDUMP)
+            {
+                pos = f->size;
+            }
+            in->n_tasks++;
+        }
+    }
+    return 0;
+}
+
+typedef struct
+{
+    size_t size;
+    int    task;
+} order_t;
+
+static int by_size(const void * a, const void * b)
+{
+    size_t sa = ((const order_t *)a)->size;
+    size_t sb = ((const order_t *)b)->size;
+    return (sa < sb) ? 1 : (sa > sb) ? -1 : 0;
+}
+
+// Deals the tasks out biggest first so every worker starts with a fair share.
+// A worker runs its own deque from the back, so each deque holds its tasks
+// smallest first.
+static int deal_tasks(ingest_t * in)
+{
+    order_t * order = malloc((in->n_tasks > 0 ? in->n_tasks : 1) * sizeof(*order));
+    int       i;
+    int       w;
+
+    if (order == NULL)
+    {
+        return -1;
+    }
+    for (i = 0 ; i < in->n_tasks ; i++)
+    {
+        order[i].size = in->tasks[i].end - in->tasks[i].start;
+        order[i].task = i;
+    }
+    qsort(order,in->n_tasks,sizeof(*order),by_size);
+    for (w = 0 ; w < in->n_workers ; w++)
+    {
+        pthread_mutex_init(&in->deques[w].lock,NULL);
+        in->deques[w].tasks = malloc((in->n_tasks / in->n_workers + 1) * sizeof(int));
+        if (in->deques[w].tasks == NULL)
+        {
+            free(order);
+            return -1;
+        }
+    }
+    for (i = in->n_tasks - 1 ; i >= 0 ; i--)
+    {
+        deque_t * d = &in->deques[i % in->n_workers];
+        d->tasks[d->tail++] = order[i].task;
+    }
+    free(order);
+    return 0;
+}
+
+static int by_time(const void * a, const void * b)
+{
+    const task_t * ta = (const task_t *)a;
+    const task_t * tb = (const task_t *)b;
+
+    if (ta->t_first != tb->t_first)
+    {
+        return (ta->t_first < tb->t_first) ? -1 : 1;
+    }
+    return (ta->file != tb->file) ? ta->file - tb->file : (ta->start < tb->start) ? -1 : (ta->start > tb->start);
+}
+
+// Whether task a's next sample of a signal goes before task b's, ties go to
+// the task first in by_time order
+static int merge_before(const ingest_t * in, int signal, const size_t * pos, int a, int b)
+{
+    int64_t ta = in->tasks[a].out->columns[signal].time[pos[a]];
+    int64_t tb = in->tasks[b].out->columns[signal].time[pos[b]];
+
+    return (ta < tb) || ((ta == tb) && (a < b));
+}
+
+static void merge_sift(const ingest_t * in, int signal, const size_t * pos, int * heap, int n, int i)
+{
+    int top = heap[i];
+    int child;
+
+    for (;;)
+    {
+        child = 2 * i + 1;
+        if (child >= n)
+        {
+            break;
+        }
+        if ((child + 1 < n) && merge_before(in,signal,pos,heap[child + 1],heap[child]))
+        {
+            child++;
+        }
+        if (!merge_before(in,signal,pos,heap[child],top))
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i       = child;
+    }
+    heap[i] = top;
+}
+
+// Merges the columns of one signal from every task by time, with a heap of the
+// tasks keyed on their next sample, and stores the result. Logs that overlap
+// in time (two loggers on the same bus, a capture and a candump of one run)
+// interleave instead of the later task's samples being dropped as out of
+// order.
+// Returns 0, or -1 if out of memory
+static int merge_signal(const ingest_t * in, telem_store_t * store, int signal, uint64_t * n_stored)
+{
+    const telem_column_t * col;
+    int64_t *              time;
+    double *               value;
+    int *                  heap;
+    size_t *               pos;
+    size_t                 total = 0;
+    size_t                 k = 0;
+    int                    n = 0;
+    int                    i;
+
+    for (i = 0 ; i < in->n_tasks ; i++)
+    {
+        if (in->tasks[i].out != NULL)
+        {
+            total += in->tasks[i].out->columns[signal].n;
+        }
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    time  = malloc(total * sizeof(*time));
+    value = malloc(total * sizeof(*value));
+    heap  = malloc(in->n_tasks * sizeof(*heap));
+    pos   = calloc(in->n_tasks,sizeof(*pos));
+    if ((time == NULL) || (value == NULL) || (heap == NULL) || (pos == NULL))
+    {
+        free(time);
+        free(value);
+        free(heap);
+        free(pos);
+        return -1;
+    }
+
+    for (i = 0 ; i < in->n_tasks ; i++)
+    {
+        if ((in->tasks[i].out != NULL) && (in->tasks[i].out->columns[signal].n > 0))
+        {
+            heap[n++] = i;
+        }
+    }
+    for (i = n / 2 - 1 ; i >= 0 ; i--)
+    {
+        merge_sift(in,signal,pos,heap,n,i);
+    }
+    while (n > 0)
+    {
+        i          = heap[0];
+        col        = &in->tasks[i].out->columns[signal];
+        time[k]    = col->time[pos[i]];
+        value[k++] = col->value[pos[i]];
+        if (++pos[i] == col->n)
+        {
+            heap[0] = heap[--n];
+        }
+        if (n > 0)
+        {
+            merge_sift(in,signal,pos,heap,n,0);
+        }
+    }
+    *n_stored += telem_store_add_column(store,signal,time,value,total);
+
+    free(time);
+    free(value);
+    free(heap);
+    free(pos);
+    return 0;
+}
+
+static void write_stdout(const char * text, int len, void * ctx)
+{
+    (void)ctx;
+    fwrite(text,1,len,stdout);
+}
+
+int main(int argc, char ** argv)
+{
+    static ingest_t      in;
+    static file_t        files[MAX_FILES];
+    static telem_store_t store;
+    pthread_t    threads[MAX_WORKERS];
+    worker_arg_t args[MAX_WORKERS];
+    const char * queries[MAX_QUERIES];
+    int          n_queries = 0;
+    uint64_t     n_bytes = 0;
+    uint64_t     n_samples = 0;
+    uint64_t     n_stored = 0;
+    uint64_t     n_late = 0;
+    int          n_failed = 0;
+    int          n_started;
+    int          c;
+    int          i;
+    int          j;
+    double       t0;
+    double       t_decode;
+    double       t_merge;
+
+    in.files     = files;
+    in.n_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((c = getopt(argc,argv,"j:q:")) != -1)
+    {
+        switch (c)
+        {
+            case 'j':
+                in.n_workers = atoi(optarg);
+                break;
+            case 'q':
+                if (n_queries < MAX_QUERIES)
+                {
+                    queries[n_queries++] = optarg;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr,"usage: %s [-j threads] [-q query]... <directory or file>...\n",argv[0]);
+        return 1;
+    }
+    if (in.n_workers < 1)
+    {
+        in.n_workers = 1;
+    }
+    if (in.n_workers > MAX_WORKERS)
+    {
+        in.n_workers = MAX_WORKERS;
+    }
+    for (i = optind ; i < argc ; i++)
+    {
+        add_path(&in,argv[i]);
+    }
+    telem_schema_init();
+    telem_crc8(0,NULL,0);                   // Builds the CRC tables before the workers use them
+    if ((make_tasks(&in) != 0) || (deal_tasks(&in) != 0) || (telem_store_init(&store) != 0))
+    {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+
+    // n_workers stays as dealt while workers run. If a thread cannot be
+    // started the main thread takes its deque, and it and the workers already
+    // running steal the tasks of the deques left without a thread.
+    t0 = now_s();
+    for (n_started = 0 ; n_started < in.n_workers ; n_started++)
+    {
+        args[n_started].in = &in;
+        args[n_started].id = n_started;
+        if (pthread_create(&threads[n_started],NULL,worker_thread,&args[n_started]) != 0)
+        {
+            break;
+        }
+    }
+    if (n_started < in.n_workers)
+    {
+        worker_thread(&args[n_started]);
+    }
+    for (i = 0 ; i < n_started ; i++)
+    {
+        pthread_join(threads[i],NULL);
+    }
+    t_decode = now_s() - t0;
+
+    // Merge every signal across the tasks by time so the series stay in order
+    t0 = now_s();
+    qsort(in.tasks,in.n_tasks,sizeof(*in.tasks),by_time);
+    for (i = 0 ; i < in.n_tasks ; i++)
+    {
+        task_t * t = &in.tasks[i];
+        if (t->failed || (t->out == NULL))
+        {
+            n_failed++;
+        }
+        if (t->out != NULL)
+        {
+            n_bytes   += t->out->n_bytes;
+            n_samples += t->out->n_samples;
+        }
+    }
+    for (j = 0 ; j < TELEM_MAX_SIGNALS ; j++)
+    {
+        if (merge_signal(&in,&store,j,&n_stored) != 0)
+        {
+            fprintf(stderr,"out of memory\n");
+            return 1;
+        }
+    }
+    for (i = 0 ; i < in.n_tasks ; i++)
+    {
+        if (in.tasks[i].out != NULL)
+        {
+            telem_bulk_free(in.tasks[i].out);
+            free(in.tasks[i].out);
+        }
+    }
+    t_merge = now_s() - t0;
+    for (j = 0 ; j < TELEM_MAX_SIGNALS ; j++)
+    {
+        n_late += store.series[j].n_late;
+    }
+
+    fprintf(stderr,"ingest:   %d files, %d tasks, %d failed, %llu bytes\n",
+            in.n_files,in.n_tasks,n_failed,(unsigned long long)n_bytes);
+    fprintf(stderr,"decode:   %8.1f ms, %.1f MB/s, %llu samples on %d workers\n",
+            t_decode * 1e3,n_bytes / 1e6 / (t_decode > 0 ? t_decode : 1e-9),(unsigned long long)n_samples,in.n_workers);
+    for (i = 0 ; i < in.n_workers ; i++)
+    {
+        fprintf(stderr,"  worker %-3d %u tasks, %u stolen\n",i,in.deques[i].n_run,in.deques[i].n_stolen);
+    }
+    fprintf(stderr,"merge:    %8.1f ms, %llu stored, %llu out of order dropped\n",
+            t_merge * 1e3,(unsigned long long)n_stored,(unsigned long long)n_late);
+
+    for (i = 0 ; i < n_queries ; i++)
+    {
+        telem_store_query(&store,queries[i],write_stdout,NULL);
+    }
+    telem_store_free(&store);
+    return n_failed ? 1 : 0;
+}
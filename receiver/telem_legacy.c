@@ -0,0 +1,430 @@
+// Spitfire telemetry receiver, legacy archive decoders
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Recovers samples from raw page and TelemAux ASCII archives, which have no
+// framing of their own, see telem_legacy.h
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telem_rx.h"
+#include "../transmitter/can_telem.h"
+
+// Model of the raw page stream the scores are worked out from. In step, the
+// next page is the one after the last in send order with probability
+// P_IN_ORDER, some other page when pages were lost, or not a page at all with
+// probability P_CORRUPT. Out of step, every byte is equally likely. A float
+// field in range is taken as 5 times likelier in step than out, and one out of
+// range as 50 times less likely.
+#define P_IN_ORDER   0.9
+#define P_CORRUPT    0.02
+#define LLR_FIELD_OK  1.6
+#define LLR_FIELD_BAD (-3.9)
+
+static const char * g_aux_name[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_NAME_ARRAY)
+};
+static const int g_aux_code[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_CODE_ARRAY)
+};
+static const int g_aux_column[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_COLUMN_ARRAY)
+};
+static const int g_aux_count[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_COUNT_ARRAY)
+};
+static const int g_aux_stride[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_STRIDE_ARRAY)
+};
+static const int g_aux_base[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_BASE_ARRAY)
+};
+static const double g_aux_min[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_MIN_ARRAY)
+};
+static const double g_aux_max[N_TELEM_AUX] =
+{
+    TELEM_AUX_TABLE(EXPAND_AS_AUX_MAX_ARRAY)
+};
+static const int g_aux_columns[N_TELEM_AUX_CODE] =
+{
+    TELEM_AUX_CODE_TABLE(EXPAND_AS_AUX_COLUMNS_ARRAY)
+};
+
+static int8_t g_page_of[256];                       // Page index of each ID byte, -1 if none
+static int    g_cycle_len;                          // Bytes in one round of every page
+static double g_llr_in_order;
+static double g_llr_other;
+static double g_llr_any;
+static double g_llr_none;
+
+// Column layout of each line code, the signal stored from each column or -1
+static int    g_aux_signal[N_TELEM_AUX_CODE][AUX_MAX_COLUMNS];
+static int    g_aux_entry[N_TELEM_AUX_CODE][AUX_MAX_COLUMNS];
+
+static pthread_once_t g_legacy_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void)
+{
+    char buf[64];
+    int  i;
+    int  n;
+    int  c;
+    int  col;
+
+    g_cycle_len = 0;
+    for (i = 0 ; i < 256 ; i++)
+    {
+        g_page_of[i] = (int8_t)telem_page_index((uint8_t)i);
+        if (g_page_of[i] >= LEGACY_N_PAGES)
+        {
+            g_page_of[i] = -1;
+        }
+    }
+    for (i = 0 ; i < LEGACY_N_PAGES ; i++)
+    {
+        g_cycle_len += 1 + telem_page_len(i);
+    }
+    g_llr_in_order = log(P_IN_ORDER * 256);
+    g_llr_other    = log((1 - P_IN_ORDER - P_CORRUPT) / (LEGACY_N_PAGES - 1) * 256);
+    g_llr_any      = log(256.0 / LEGACY_N_PAGES);
+    g_llr_none     = log(P_CORRUPT * 256 / (256 - LEGACY_N_PAGES));
+
+    memset(g_aux_entry,-1,sizeof(g_aux_entry));
+    for (i = 0 ; i < N_TELEM_AUX ; i++)
+    {
+        c = g_aux_code[i];
+        for (n = 0 ; n < g_aux_count[i] ; n++)
+        {
+            col = g_aux_column[i] + n * g_aux_stride[i];
+            if (g_aux_count[i] > 1)
+            {
+                snprintf(buf,sizeof(buf),"%s[%d]",g_aux_name[i],n);
+            }
+            else
+            {
+                snprintf(buf,sizeof(buf),"%s",g_aux_name[i]);
+            }
+            if (col < g_aux_columns[c])
+            {
+                g_aux_entry[c][col]  = i;
+                g_aux_signal[c][col] = telem_signal_lookup(buf);
+            }
+        }
+    }
+}
+
+// Builds the tables once, telem_ingest decodes archives on several threads
+static void legacy_tables_init(void)
+{
+    pthread_once(&g_legacy_once,build_tables);
+}
+
+void telem_legacy_init(telem_legacy_t * l)
+{
+    legacy_tables_init();
+    memset(l,0,sizeof(*l));
+    l->prev    = -1;
+    l->time_ms = -LEGACY_SEND_PERIOD_MS;            // The first page is at 0
+}
+
+// Score of page index page following prev (-1 if unknown), or of a byte that
+// is not a page ID if page is -1
+static double id_llr(int prev, int page)
+{
+    if (page < 0)
+    {
+        return g_llr_none;
+    }
+    if (prev < 0)
+    {
+        return g_llr_any;
+    }
+    return (page == (prev + 1) % LEGACY_N_PAGES) ? g_llr_in_order : g_llr_other;
+}
+
+// Score of a page starting at p, or -INFINITY if there is none
+static double page_llr(const uint8_t * buf, size_t len, size_t p, int prev, int * page)
+{
+    int n_fields;
+    int ok;
+
+    *page = g_page_of[buf[p]];
+    if ((*page < 0) || (p + 1 + telem_page_len(*page) > len))
+    {
+        return -INFINITY;
+    }
+    ok = telem_page_plausible(*page,buf + p + 1,&n_fields);
+    return id_llr(prev,*page) + ok * LLR_FIELD_OK + (n_fields - ok) * LLR_FIELD_BAD;
+}
+
+// Finds the first position from p where LEGACY_SYNC_PAGES pages in a row (or
+// as many as fit before the end) score enough to be back in step
+static int find_step(const uint8_t * buf, size_t len, size_t p, size_t * at)
+{
+    size_t q;
+    size_t r;
+    double score;
+    int    prev;
+    int    page;
+    int    k;
+
+    for (q = p ; q < len ; q++)
+    {
+        if (g_page_of[buf[q]] < 0)
+        {
+            continue;
+        }
+        score = 0;
+        prev  = -1;
+        for (k = 0, r = q ; (k < LEGACY_SYNC_PAGES) && (r < len) ; k++)
+        {
+            score += page_llr(buf,len,r,prev,&page);
+            if (score == -INFINITY)
+            {
+                break;
+            }
+            prev = page;
+            r   += 1 + telem_page_len(page);
+        }
+        if ((score >= LEGACY_SYNC_LLR) || ((r == len) && (score > 0)))
+        {
+            *at = q;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Moves the clock on to a page, by its distance from the last page in send
+// order plus the whole rounds of pages closest to what the skipped bytes held
+static void step_time(telem_legacy_t * l, int page, size_t skipped)
+{
+    int64_t slots;
+    int64_t between = 0;
+    int     i;
+
+    if (l->prev < 0)
+    {
+        l->time_ms += LEGACY_SEND_PERIOD_MS;
+        return;
+    }
+    slots = (page - l->prev + LEGACY_N_PAGES - 1) % LEGACY_N_PAGES + 1;
+    for (i = (l->prev + 1) % LEGACY_N_PAGES ; i != page ; i = (i + 1) % LEGACY_N_PAGES)
+    {
+        between += 1 + telem_page_len(i);
+    }
+    if ((int64_t)skipped > between)
+    {
+        slots += llround((double)((int64_t)skipped - between) / g_cycle_len) * LEGACY_N_PAGES;
+    }
+    l->time_ms += slots * LEGACY_SEND_PERIOD_MS;
+}
+
+static void emit_page(telem_legacy_t * l, const uint8_t * buf, int page, telem_sample_cb_t cb, void * ctx)
+{
+    telem_frame_t f;
+
+    memset(&f,0,sizeof(f));
+    f.id  = buf[0];
+    f.len = (uint8_t)telem_page_len(page);
+    memcpy(f.payload,buf + 1,f.len);
+    telem_decode_frame(&f,l->time_ms,cb,ctx);
+    l->prev = page;
+    l->n_pages++;
+}
+
+// Decodes a buffer of raw pages, calling cb for every sample
+// Returns the number of pages decoded
+size_t telem_legacy_decode(telem_legacy_t * l, const uint8_t * buf, size_t len, telem_sample_cb_t cb, void * ctx)
+{
+    size_t   p = 0;
+    size_t   q;
+    size_t   next = 0;
+    double   score;
+    int      page;
+    uint64_t n_pages = l->n_pages;
+
+    legacy_tables_init();
+    while (p < len)
+    {
+        if (l->synced)
+        {
+            score = page_llr(buf,len,p,l->prev,&page);
+            if (score != -INFINITY)
+            {
+                next   = p + 1 + telem_page_len(page);
+                score += (next < len) ? id_llr(page,g_page_of[buf[next]]) : 0;
+            }
+            if (score >= LEGACY_KEEP_LLR)
+            {
+                step_time(l,page,0);
+                emit_page(l,buf + p,page,cb,ctx);
+                p = next;
+                continue;
+            }
+            l->synced = 0;
+            l->n_resyncs++;
+        }
+        if (!find_step(buf,len,p,&q))
+        {
+            l->n_skipped += len - p;
+            break;
+        }
+        l->n_skipped += q - p;
+        page = g_page_of[buf[q]];
+        step_time(l,page,q - p);
+        emit_page(l,buf + q,page,cb,ctx);
+        l->synced = 1;
+        p = q + 1 + telem_page_len(page);
+    }
+    return (size_t)(l->n_pages - n_pages);
+}
+
+void telem_aux_init(telem_aux_t * a)
+{
+    legacy_tables_init();
+    memset(a,0,sizeof(*a));
+    a->last_code = -1;
+}
+
+// Times a line by the TelemAux schedule: each TX period has a misc line
+// AUX_MISC_PERIOD_MS in, then the next rotating line at its end. A second misc
+// line in a period is the rotating one if misc is next in turn, otherwise the
+// rotating line was lost and this is the misc line of the period after.
+static int64_t aux_time(telem_aux_t * a, int code)
+{
+    int next = (a->last_code < 0) ? -1 : (a->last_code + 1) % N_TELEM_AUX_CODE;
+
+    if ((code == AUX_MISC) && a->seen_misc && (next != AUX_MISC))
+    {
+        a->period++;
+        a->last_code = next;
+        a->seen_misc = 0;
+    }
+    if ((code == AUX_MISC) && !a->seen_misc)
+    {
+        a->seen_misc = 1;
+        return a->period * AUX_TX_PERIOD_MS + AUX_MISC_PERIOD_MS;
+    }
+    a->period   += (a->last_code < 0) ? 1 : (code - a->last_code + N_TELEM_AUX_CODE - 1) % N_TELEM_AUX_CODE + 1;
+    a->last_code = code;
+    a->seen_misc = 0;
+    return a->period * AUX_TX_PERIOD_MS;
+}
+
+// Decodes one line, from just after the '#' to the end of the line
+static void aux_line(telem_aux_t * a, char * line, telem_sample_cb_t cb, void * ctx)
+{
+    double  value[AUX_MAX_COLUMNS];
+    int     ok[AUX_MAX_COLUMNS];
+    char *  field;
+    char *  end;
+    int     code;
+    int     n = 0;
+    int     bad = 0;
+    int     e;
+    int     i;
+    int64_t t;
+
+    code = (int)strtol(line,&end,10);
+    if ((end == line) || (code < 0) || (code >= N_TELEM_AUX_CODE))
+    {
+        a->n_rejected++;
+        return;
+    }
+    for (field = end ; (*field == ',') && (n < AUX_MAX_COLUMNS) ; field = end, n++)
+    {
+        field++;
+        e = g_aux_entry[code][n];
+        if ((e >= 0) && (g_aux_base[e] == 16))
+        {
+            value[n] = (double)strtol(field,&end,16);
+        }
+        else
+        {
+            value[n] = strtod(field,&end);
+        }
+        ok[n] = (end != field) && ((*end == ',') || (*end == '\0'));
+        if (ok[n] && (e >= 0))
+        {
+            ok[n] = (value[n] >= g_aux_min[e]) && (value[n] <= g_aux_max[e]);
+        }
+        if (!ok[n])
+        {
+            bad++;
+            end = strchr(field,',');
+            if (end == NULL)
+            {
+                end = field + strlen(field);
+            }
+        }
+    }
+    if ((*field != '\0') || (n != g_aux_columns[code]) || (4 * bad > n))
+    {
+        a->n_rejected++;
+        return;
+    }
+
+    t = aux_time(a,code);
+    for (i = 0 ; i < n ; i++)
+    {
+        if (!ok[i])
+        {
+            a->n_dropped++;
+        }
+        else if (g_aux_signal[code][i] >= 0)
+        {
+            cb(g_aux_signal[code][i],t,value[i],ctx);
+        }
+    }
+    a->n_lines++;
+}
+
+// Decodes a buffer of TelemAux lines, calling cb for every sample. A line cut
+// off at the end of the buffer is dropped.
+// Returns the number of lines decoded
+size_t telem_aux_decode(telem_aux_t * a, const char * buf, size_t len, telem_sample_cb_t cb, void * ctx)
+{
+    char     line[256];
+    size_t   p = 0;
+    size_t   n;
+    uint64_t n_lines = a->n_lines;
+
+    legacy_tables_init();
+    while (p < len)
+    {
+        if (buf[p++] != '#')
+        {
+            continue;
+        }
+        for (n = 0 ; (p + n < len) && (buf[p + n] != '#') && (buf[p + n] != '\r') && (buf[p + n] != '\n') ; n++)
+        {
+        }
+        if (p + n == len)
+        {
+            break;
+        }
+        if (n < sizeof(line))
+        {
+            memcpy(line,buf + p,n);
+            line[n] = '\0';
+            aux_line(a,line,cb,ctx);
+        }
+        else
+        {
+            a->n_rejected++;
+        }
+        p += n;
+    }
+    return (size_t)(a->n_lines - n_lines);
+}
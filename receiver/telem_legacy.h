@@ -0,0 +1,92 @@
+#ifndef TELEM_LEGACY_H
+#define TELEM_LEGACY_H
+
+// Spitfire telemetry receiver, legacy archive formats
+// NOTE: The tables below are x-macros, see transmitter/can_telem.h
+//
+// Archives recorded before the framed radio protocol come in two formats:
+//
+//   Raw pages, from the original send_data(): the page ID followed by the raw
+//   page, one page every LEGACY_SEND_PERIOD_MS in TELEM_ID_TABLE order (the
+//   first LEGACY_N_PAGES pages, later ones did not exist yet), with
+//   no sync byte, length or CRC. One lost or extra byte used to put the rest of
+//   a LabVIEW session out of step. The decoder scores each candidate boundary
+//   as a log likelihood ratio of "a page starts here" against "random bytes":
+//   a known ID is weak evidence, an ID that follows the previous page in send
+//   order is strong evidence, and every float field inside the range its
+//   encoding in TELEM_FIELD_TABLE can represent adds some more. In step, a
+//   page is kept while its own score plus that of the ID after it reach
+//   LEGACY_KEEP_LLR. Out of step, the first position where LEGACY_SYNC_PAGES
+//   pages in a row score LEGACY_SYNC_LLR is taken and the time is moved on by
+//   the pages missed.
+//
+//   TelemAux_v7 ASCII lines, "#code,value,value,...\r\n": misc (code 2) every
+//   AUX_MISC_PERIOD_MS and codes 0 to 3 in turn every AUX_TX_PERIOD_MS. Lines
+//   are split at '#', CR and LF so one lost line end costs one line. A line is
+//   kept if it has the right number of columns and no more than a quarter of
+//   them are out of the range in TELEM_AUX_TABLE, and then only the columns in
+//   range are stored.
+//
+// Neither format carries a time, so times count from 0 at the first page or
+// line, by the send schedule. Bytes the radio lost outright leave no trace, so
+// a gap is only counted to within one round of the schedule.
+
+#define LEGACY_SEND_PERIOD_MS  50       // One page per period
+#define LEGACY_N_PAGES         (TELEM_MPPT_INDEX + 1)
+#define LEGACY_KEEP_LLR        3.0      // Score needed to stay in step
+#define LEGACY_SYNC_PAGES      3        // Pages scored to regain step
+#define LEGACY_SYNC_LLR        12.0     // Score needed to regain step
+
+// TelemAux_v7 archives were written with a 1.024 ms timer 2 tick, so its 50
+// and 250 tick intervals are 51.2 and 256 ms
+#define AUX_MISC_PERIOD_MS     51       // Misc line offset into each TX period
+#define AUX_TX_PERIOD_MS       256
+#define AUX_MAX_COLUMNS        32
+
+#define EXPAND_AS_AUX_CODE_ENUM(a,b,c)         a = b,
+#define EXPAND_AS_AUX_COLUMNS_ARRAY(a,b,c)     c,
+
+// X macro table of TelemAux line codes and their number of columns
+//        Line        , Code, Columns
+#define TELEM_AUX_CODE_TABLE(ENTRY) \
+    ENTRY(AUX_BTEM    ,    0,      26) \
+    ENTRY(AUX_BVOL    ,    1,      26) \
+    ENTRY(AUX_MISC    ,    2,      13) \
+    ENTRY(AUX_MPPT    ,    3,      16)
+#define N_TELEM_AUX_CODE 4
+
+enum {TELEM_AUX_CODE_TABLE(EXPAND_AS_AUX_CODE_ENUM)};
+
+#define EXPAND_AS_AUX_NAME_ARRAY(a,b,c,d,e,f,g,h)    #a,
+#define EXPAND_AS_AUX_CODE_ARRAY(a,b,c,d,e,f,g,h)    b,
+#define EXPAND_AS_AUX_COLUMN_ARRAY(a,b,c,d,e,f,g,h)  c,
+#define EXPAND_AS_AUX_COUNT_ARRAY(a,b,c,d,e,f,g,h)   d,
+#define EXPAND_AS_AUX_STRIDE_ARRAY(a,b,c,d,e,f,g,h)  e,
+#define EXPAND_AS_AUX_BASE_ARRAY(a,b,c,d,e,f,g,h)    f,
+#define EXPAND_AS_AUX_MIN_ARRAY(a,b,c,d,e,f,g,h)     g,
+#define EXPAND_AS_AUX_MAX_ARRAY(a,b,c,d,e,f,g,h)     h,
+
+// X macro table of the columns of each TelemAux line. Count repeats a column
+// for elements [0] to [count - 1] of the signal, stride columns apart. Columns
+// named after a signal that does not exist are range checked but not stored.
+//        Signal name      , Code    , Column, Count, Stride, Base, Min    , Max
+#define TELEM_AUX_TABLE(ENTRY)                                                       \
+    ENTRY(BPS_CELL_TEMP    , AUX_BTEM,      0,    26,      1,   10,    -40,    125) \
+    ENTRY(BPS_CELL_VOLTAGE , AUX_BVOL,      0,    26,      1,   16,      0,    255) \
+    ENTRY(BPS_CURRENT      , AUX_MISC,      0,     1,      1,   10,      0,  65535) \
+    ENTRY(ARRAY_CURRENT_ADC, AUX_MISC,      1,     1,      1,   10,      0,   4095) \
+    ENTRY(AUX_CELL_ADC     , AUX_MISC,      2,     4,      1,   10,      0,   1023) \
+    ENTRY(MOTOR_BUS_VOLTAGE, AUX_MISC,      6,     1,      1,   10,      0,  409.5) \
+    ENTRY(MOTOR_BUS_CURRENT, AUX_MISC,      7,     1,      1,   10, -204.8,  204.7) \
+    ENTRY(MOTOR_RPM        , AUX_MISC,      8,     1,      1,   10,  -4096,   4095) \
+    ENTRY(HEATSINK_TEMP    , AUX_MISC,      9,     1,      1,   10,    -40,    215) \
+    ENTRY(DSP_TEMP         , AUX_MISC,     10,     1,      1,   10,    -40,    215) \
+    ENTRY(DRIVE_CURRENT    , AUX_MISC,     11,     1,      1,   10,      0,      1) \
+    ENTRY(DRIVE_VELOCITY   , AUX_MISC,     12,     1,      1,   10, -32768,  32767) \
+    ENTRY(MPPT_VOLTAGE_IN  , AUX_MPPT,      0,     4,      4,   10,      0,   1023) \
+    ENTRY(MPPT_CURRENT_IN  , AUX_MPPT,      1,     4,      4,   10,      0,   1023) \
+    ENTRY(MPPT_VOLTAGE_OUT , AUX_MPPT,      2,     4,      4,   10,      0,   1023) \
+    ENTRY(MPPT_TEMP        , AUX_MPPT,      3,     4,      4,   10,      0,    255)
+#define N_TELEM_AUX 16
+
+#endif
@@ -0,0 +1,127 @@
+// Spitfire telemetry receiver, link quality
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Measures frame loss from the sequence numbers and reports it to the
+// transmitter's rate controller with CMD_LINK_REPORT, and reads the link
+// and scheduler statistics frames the transmitter sends back
+
+#include <string.h>
+#include "telem_rx.h"
+
+static const char * g_task_name[N_TELEM_TASK] =
+{
+    TELEM_TASK_TABLE(EXPAND_AS_TASK_NAME_ARRAY)
+};
+
+void telem_link_init(telem_link_t * l, int period_ms)
+{
+    memset(l,0,sizeof(*l));
+    l->period_ms = period_ms;
+}
+
+// Counts a received frame and keeps the newest transmitter statistics
+void telem_link_on_frame(telem_link_t * l, const telem_frame_t * f)
+{
+    if (!(f->flags & TELEM_FLAG_RETX))
+    {
+        l->n_frames++;
+    }
+    if (telem_link_parse_stats(f,&l->remote))
+    {
+        l->remote_valid = 1;
+    }
+    if (telem_link_parse_sched(f,&l->sched))
+    {
+        l->sched_valid = 1;
+    }
+}
+
+// Reads a link statistics frame, returns 1 and fills s if f is one
+int telem_link_parse_stats(const telem_frame_t * f, telem_link_stats_t * s)
+{
+    const uint8_t * p = f->payload;
+
+    if ((f->id != TELEM_LINK_ID) || (f->len != TELEM_LINK_LEN))
+    {
+        return 0;
+    }
+    s->rssi      = -(int)p[0];
+    s->tx_ok     = (uint16_t)(p[1] | (p[2] << 8));
+    s->tx_fail   = (uint16_t)(p[3] | (p[4] << 8));
+    s->retries   = (uint16_t)(p[5] | (p[6] << 8));
+    s->nacks     = (uint16_t)(p[7] | (p[8] << 8));
+    s->loss      = p[9];
+    s->period_ms = (uint16_t)(p[10] | (p[11] << 8));
+    s->mode      = p[12];
+    return 1;
+}
+
+// Reads a scheduler statistics frame, returns 1 and fills s if f is one
+// Tasks the transmitter has beyond this build's table are ignored
+int telem_link_parse_sched(const telem_frame_t * f, telem_sched_stats_t * s)
+{
+    const uint8_t * p = f->payload;
+    int n;
+    int i;
+
+    if ((f->id != TELEM_SCHED_ID) || (f->len < 1) ||
+        (f->len != 1 + p[0]*TELEM_SCHED_TASK_LEN + 2))
+    {
+        return 0;
+    }
+    n = (p[0] < N_TELEM_TASK) ? p[0] : N_TELEM_TASK;
+    p++;
+    for (i = 0 ; i < n ; i++, p += TELEM_SCHED_TASK_LEN)
+    {
+        s->task[i].runs    = (uint16_t)(p[0] | (p[1] << 8));
+        s->task[i].busy    = (uint16_t)(p[2] | (p[3] << 8));
+        s->task[i].max_us  = (uint16_t)(p[4] | (p[5] << 8));
+        s->task[i].late    = p[6];
+        s->task[i].skipped = p[7];
+    }
+    p = f->payload + 1 + f->payload[0]*TELEM_SCHED_TASK_LEN;
+    s->duty    = (uint16_t)(p[0] | (p[1] << 8));
+    s->n_tasks = n;
+    return 1;
+}
+
+// Name of a scheduler task, from TELEM_TASK_TABLE
+const char * telem_task_name(int task)
+{
+    if ((task < 0) || (task >= N_TELEM_TASK))
+    {
+        return "?";
+    }
+    return g_task_name[task];
+}
+
+// Builds a link report when one is due, using the sequence gaps counted by a
+// since the last report. rssi is the ground station radio RSSI in dBm, 0 if
+// unknown. Returns the frame length to send, or 0 if no report is due
+int telem_link_poll(telem_link_t * l, const telem_arq_t * a, int rssi, int64_t now_ms, uint8_t * out)
+{
+    uint32_t received;
+    uint32_t lost;
+    uint32_t loss = 0;
+
+    if (now_ms < l->next_ms)
+    {
+        return 0;
+    }
+    l->next_ms = now_ms + l->period_ms;
+
+    received = l->n_frames - l->last_frames;
+    lost     = a->n_lost - l->last_lost;
+    l->last_frames = l->n_frames;
+    l->last_lost   = a->n_lost;
+    if (received + lost > 0)
+    {
+        loss = (lost << 8) / (received + lost);
+    }
+    else if (l->n_frames > 0)
+    {
+        loss = 255;     // Nothing heard for a whole period
+    }
+    l->loss = (uint8_t)((loss > 255) ? 255 : loss);
+    return telem_cmd_link_report(l->loss,rssi,out);
+}
@@ -0,0 +1,209 @@
+// Spitfire telemetry receiver, stream decompression
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Undoes the LZ compression of frame payloads (TELEM_FLAG_LZ). The compressor
+// mirrors transmitter/telem_lz.c bit for bit so captures recorded without
+// compression can be used to measure it.
+
+#include <string.h>
+#include "telem_rx.h"
+
+void telem_lz_init(telem_lz_t * z)
+{
+    memset(z,0,sizeof(*z));
+}
+
+void telem_lz_reset(telem_lz_t * z)
+{
+    memset(z->ring,0,sizeof(z->ring));
+    memset(z->hash,0,sizeof(z->hash));
+    z->pos   = 0;
+    z->valid = 1;
+}
+
+// Adds uncompressed bytes to the history
+static void lz_push(telem_lz_t * z, const uint8_t * data, int len)
+{
+    int i;
+    for (i = 0 ; i < len ; i++)
+    {
+        z->ring[z->pos++] = data[i];
+    }
+}
+
+// Compresses a payload into out and adds it to the history, returns the
+// compressed length or 0 if that would not be shorter than the input
+int telem_lz_compress(telem_lz_t * z, const uint8_t * data, int len, uint8_t * out)
+{
+    int     i = 0;
+    int     n;
+    int     o = 0;
+    int     flag = 0;
+    int     bit = 0;
+    int     h;
+    uint8_t cand;
+    uint8_t dist;
+
+    if (len <= TELEM_LZ_MIN_MATCH)
+    {
+        lz_push(z,data,len);
+        return 0;
+    }
+
+    out[o++] = z->pos;
+    while (i < len)
+    {
+        if (bit == 0)
+        {
+            flag = o++;
+            out[flag] = 0;
+            bit = 0x80;
+        }
+
+        n = 0;
+        if (i + TELEM_LZ_MIN_MATCH <= len)
+        {
+            h = TELEM_LZ_HASH(data[i],data[i+1],data[i+2]);
+            cand = z->hash[h];
+            dist = (uint8_t)(z->pos - cand);
+            z->hash[h] = z->pos;
+            while ((dist != 0) && (n < dist) && (i + n < len) && (z->ring[(uint8_t)(cand+n)] == data[i+n]))
+            {
+                n++;
+            }
+        }
+
+        if (n >= TELEM_LZ_MIN_MATCH)
+        {
+            if (o + 2 >= len)
+            {
+                break;
+            }
+            out[flag] |= (uint8_t)bit;
+            out[o++] = dist;
+            out[o++] = (uint8_t)n;
+        }
+        else
+        {
+            n = 1;
+            if (o + 1 >= len)
+            {
+                break;
+            }
+            out[o++] = data[i];
+        }
+        lz_push(z,&data[i],n);
+        i += n;
+        bit >>= 1;
+    }
+
+    if (i < len)
+    {
+        lz_push(z,&data[i],len - i);
+        return 0;
+    }
+    return o;
+}
+
+// Decompresses a payload into out, adding it to the history
+// Returns the decompressed length, or -1 if the payload is malformed
+int telem_lz_decompress(telem_lz_t * z, const uint8_t * in, int len, uint8_t * out, int max)
+{
+    int     i = 1;
+    int     o = 0;
+    int     k;
+    int     bit = 0;
+    uint8_t flag = 0;
+    uint8_t src;
+    uint8_t n;
+
+    while (i < len)
+    {
+        if (bit == 0)
+        {
+            flag = in[i++];
+            bit = 0x80;
+            if (i >= len)
+            {
+                break;
+            }
+        }
+        if (flag & bit)
+        {
+            if ((i + 2 > len) || (in[i] == 0) || (o + in[i+1] > max))
+            {
+                return -1;
+            }
+            src = (uint8_t)(z->pos - in[i]);
+            n   = in[i+1];
+            for (k = 0 ; k < n ; k++)
+            {
+                out[o] = z->ring[src++];
+                z->ring[z->pos++] = out[o++];
+            }
+            i += 2;
+        }
+        else
+        {
+            if (o >= max)
+            {
+                return -1;
+            }
+            out[o] = in[i++];
+            z->ring[z->pos++] = out[o++];
+        }
+        bit >>= 1;
+    }
+    return o;
+}
+
+// Undoes stream compression on a frame, tracking the history of every frame
+// Returns 1 when out holds the uncompressed frame, 0 when the frame had to be
+// dropped because the history is out of step with the transmitter
+int telem_lz_apply(telem_lz_t * z, const telem_frame_t * in, telem_frame_t * out)
+{
+    uint8_t buf[TELEM_MAX_PAYLOAD];
+    int     n;
+
+    if (in->flags & TELEM_FLAG_LZ_RESET)
+    {
+        telem_lz_reset(z);
+    }
+
+    if (!(in->flags & TELEM_FLAG_LZ))
+    {
+        if (z->valid && (in->id < TELEM_CONTROL_ID_BASE) && !(in->flags & TELEM_FLAG_RETX))
+        {
+            lz_push(z,in->payload,in->len);
+        }
+        if (out != in)
+        {
+            *out = *in;
+        }
+        out->flags &= (uint8_t)~TELEM_FLAG_LZ_RESET;
+        return 1;
+    }
+
+    if (!z->valid || (in->len < 1) || (in->payload[0] != z->pos))
+    {
+        z->valid = 0;
+        z->n_rejected++;
+        return 0;
+    }
+    n = telem_lz_decompress(z,in->payload,in->len,buf,sizeof(buf));
+    if (n < 0)
+    {
+        z->valid = 0;
+        z->n_rejected++;
+        return 0;
+    }
+
+    if (out != in)
+    {
+        *out = *in;
+    }
+    memcpy(out->payload,buf,n);
+    out->len   = (uint8_t)n;
+    out->flags &= (uint8_t)~(TELEM_FLAG_LZ | TELEM_FLAG_LZ_RESET);
+    return 1;
+}
@@ -0,0 +1,306 @@
+// Spitfire telemetry receiver, threaded ground station pipeline
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Reader, decoder and sink stages connected by telem_queue_t rings, see
+// telem_pipeline.h
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "telem_pipeline.h"
+
+#define IDLE_SLEEP_NS 1000000   // Wait when a queue runs dry
+
+static int64_t host_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void idle_sleep(void)
+{
+    struct timespec ts = {0, IDLE_SLEEP_NS};
+    nanosleep(&ts,NULL);
+}
+
+static int is_running(telem_pipeline_t * p)
+{
+    return __atomic_load_n(&p->running,__ATOMIC_ACQUIRE);
+}
+
+int telem_pipeline_init(telem_pipeline_t * p, int fd, int xbee_api)
+{
+    memset(p,0,sizeof(*p));
+    p->fd       = fd;
+    p->xbee_api = xbee_api;
+    telem_parser_init(&p->parser);
+    telem_xbee_init(&p->xbee);
+    telem_lz_init(&p->lz);
+    telem_delta_init(&p->delta);
+    telem_clock_init(&p->clock);
+    telem_arq_init(&p->arq,TELEM_ARQ_TIMEOUT_MS);
+    telem_link_init(&p->link,TELEM_LINK_PERIOD_MS);
+    telem_schema_init();
+    if (telem_derive_init(&p->derive) < 0)
+    {
+        return -1;
+    }
+    return telem_queue_init(&p->raw,sizeof(telem_chunk_t),TELEM_RAW_QUEUE_LEN);
+}
+
+// Sinks must be added before the pipeline is started
+int telem_pipeline_add_sink(telem_pipeline_t * p, const char * name, telem_sink_cb_t cb, void * ctx)
+{
+    telem_sink_t * s;
+
+    if (p->n_sinks >= TELEM_MAX_SINKS)
+    {
+        return -1;
+    }
+    s = &p->sinks[p->n_sinks];
+    memset(s,0,sizeof(*s));
+    s->name = name;
+    s->cb   = cb;
+    s->ctx  = ctx;
+    if (telem_queue_init(&s->queue,sizeof(telem_sample_t),TELEM_SINK_QUEUE_LEN) != 0)
+    {
+        return -1;
+    }
+    p->n_sinks++;
+    return 0;
+}
+
+// Reader stage, never waits on anything but the serial port. A full queue
+// drops the chunk rather than letting the uart buffer overflow.
+static void * reader_thread(void * arg)
+{
+    telem_pipeline_t * p = (telem_pipeline_t *)arg;
+    struct pollfd      pfd;
+    telem_chunk_t      chunk;
+    ssize_t            n;
+
+    pfd.fd     = p->fd;
+    pfd.events = POLLIN;
+    while (is_running(p))
+    {
+        if (poll(&pfd,1,100) <= 0)
+        {
+            continue;
+        }
+        n = read(p->fd,chunk.data,TELEM_CHUNK_LEN);
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+            {
+                p->n_read_errors++;
+                idle_sleep();
+            }
+            continue;
+        }
+        chunk.len = (int)n;
+        p->n_bytes += (uint64_t)n;
+        telem_queue_push(&p->raw,&chunk);
+    }
+    return NULL;
+}
+
+static void push_sample(int signal, int64_t time_ms, double value, void * ctx)
+{
+    telem_pipeline_t * p = (telem_pipeline_t *)ctx;
+    telem_sample_t     s;
+    int                i;
+
+    s.time_ms = time_ms;
+    s.signal  = signal;
+    s.value   = value;
+    for (i = 0 ; i < p->n_sinks ; i++)
+    {
+        telem_queue_push(&p->sinks[i].queue,&s);
+    }
+}
+
+// Passes a decoded sample and the derived samples computed from it on to the
+// sinks
+static void on_sample(int signal, int64_t time_ms, double value, void * ctx)
+{
+    telem_pipeline_t * p = (telem_pipeline_t *)ctx;
+
+    push_sample(signal,time_ms,value,p);
+    telem_derive_sample(&p->derive,signal,time_ms,value,push_sample,p);
+}
+
+static void on_frame(const telem_frame_t * f, void * ctx)
+{
+    telem_pipeline_t * p = (telem_pipeline_t *)ctx;
+    telem_frame_t      plain;
+    telem_frame_t      page;
+
+    telem_arq_on_frame(&p->arq,f);
+    telem_link_on_frame(&p->link,f);
+    if (!telem_lz_apply(&p->lz,f,&plain) || !telem_delta_apply(&p->delta,&plain,&page))
+    {
+        return;
+    }
+    telem_decode_frame(&page,telem_frame_source_ms(&p->clock,&page),on_sample,p);
+}
+
+// Sends a command frame to the transmitter, wrapped for the radio if needed
+// and unicast to its radio once a packet from it has given the address
+static void send_command(telem_pipeline_t * p, const uint8_t * cmd, int len)
+{
+    uint8_t out[TELEM_XBEE_MAX_FRAME];
+
+    if (len <= 0)
+    {
+        return;
+    }
+    if (p->xbee_api)
+    {
+        if (++p->xbee_frame_id == 0)
+        {
+            p->xbee_frame_id = 1;
+        }
+        len = telem_xbee_tx_request(p->xbee_frame_id,p->xbee.src_valid ? p->xbee.src64 : NULL,
+                                    cmd,len,out);
+        cmd = out;
+    }
+    if (write(p->fd,cmd,len) != len)
+    {
+        p->n_write_errors++;
+    }
+}
+
+// Decoder stage, runs the frame pipeline, computes the derived signals and
+// answers with NACKs and link reports. Samples are copied into every sink's
+// queue, a sink that falls behind only loses its own samples.
+static void * decoder_thread(void * arg)
+{
+    telem_pipeline_t * p = (telem_pipeline_t *)arg;
+    telem_chunk_t      chunk;
+    uint8_t            cmd[TELEM_CMD_MAX_FRAME];
+    int64_t            now;
+
+    while (is_running(p))
+    {
+        if (telem_queue_pop(&p->raw,&chunk))
+        {
+            if (p->xbee_api)
+            {
+                telem_xbee_feed_buf(&p->xbee,&p->parser,chunk.data,chunk.len,on_frame,p);
+            }
+            else
+            {
+                telem_parser_feed_buf(&p->parser,chunk.data,chunk.len,on_frame,p);
+            }
+        }
+        else
+        {
+            idle_sleep();
+        }
+
+        now = host_ms();
+        send_command(p,cmd,telem_arq_poll(&p->arq,now,cmd));
+        send_command(p,cmd,telem_link_poll(&p->link,&p->arq,p->xbee.rssi,now,cmd));
+    }
+    return NULL;
+}
+
+// Sink stage, hands batches of samples to the sink callback. Whatever is
+// left in the queue when the pipeline stops is drained before returning.
+static void * sink_thread(void * arg)
+{
+    telem_sink_t * s = (telem_sink_t *)arg;
+    telem_sample_t batch[TELEM_SINK_BATCH];
+    int            n;
+    int            running;
+    int            b_dirty = 0;
+
+    do
+    {
+        running = __atomic_load_n(&s->running,__ATOMIC_ACQUIRE);
+        n = 0;
+        while ((n < TELEM_SINK_BATCH) && telem_queue_pop(&s->queue,&batch[n]))
+        {
+            n++;
+        }
+        if (n > 0)
+        {
+            s->cb(batch,n,s->ctx);
+            s->n_samples += n;
+            b_dirty = 1;
+        }
+        else
+        {
+            if (b_dirty)
+            {
+                s->cb(batch,0,s->ctx);
+                b_dirty = 0;
+            }
+            idle_sleep();
+        }
+    } while (running || (n > 0));
+    return NULL;
+}
+
+int telem_pipeline_start(telem_pipeline_t * p)
+{
+    int i;
+
+    __atomic_store_n(&p->running,1,__ATOMIC_RELEASE);
+    for (i = 0 ; i < p->n_sinks ; i++)
+    {
+        __atomic_store_n(&p->sinks[i].running,1,__ATOMIC_RELEASE);
+        if (pthread_create(&p->sinks[i].thread,NULL,sink_thread,&p->sinks[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    if ((pthread_create(&p->decoder,NULL,decoder_thread,p) != 0)
+        || (pthread_create(&p->reader,NULL,reader_thread,p) != 0))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Stops the stages front to back so the sinks see every decoded sample
+void telem_pipeline_stop(telem_pipeline_t * p)
+{
+    int i;
+
+    __atomic_store_n(&p->running,0,__ATOMIC_RELEASE);
+    pthread_join(p->reader,NULL);
+    pthread_join(p->decoder,NULL);
+    for (i = 0 ; i < p->n_sinks ; i++)
+    {
+        __atomic_store_n(&p->sinks[i].running,0,__ATOMIC_RELEASE);
+        pthread_join(p->sinks[i].thread,NULL);
+        telem_queue_free(&p->sinks[i].queue);
+    }
+    telem_queue_free(&p->raw);
+}
+
+static void print_queue(FILE * fp, const char * name, const telem_queue_t * q)
+{
+    fprintf(fp,"  %-10s depth %5u/%-5u high %5u pushed %10u dropped %u\n",
+            name,telem_queue_depth(q),q->mask + 1,q->high_water,q->n_pushed,q->n_dropped);
+}
+
+// Prints the backpressure statistics of every stage
+void telem_pipeline_print_stats(telem_pipeline_t * p, FILE * fp)
+{
+    int i;
+
+    fprintf(fp,"reader:   %llu bytes, %u read errors\n",(unsigned long long)p->n_bytes,p->n_read_errors);
+    print_queue(fp,"raw",&p->raw);
+    fprintf(fp,"decoder:  %u frames, %u CRC errors, %u lost, %u recovered, loss %.1f%%, %u derived\n",
+            p->parser.n_frames,p->parser.n_crc_errors,p->arq.n_lost,p->arq.n_recovered,
+            100.0 * p->link.loss / 256,p->derive.n_samples);
+    for (i = 0 ; i < p->n_sinks ; i++)
+    {
+        print_queue(fp,p->sinks[i].name,&p->sinks[i].queue);
+    }
+}
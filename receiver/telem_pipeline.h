@@ -0,0 +1,162 @@
+#ifndef TELEM_PIPELINE_H
+#define TELEM_PIPELINE_H
+
+// Spitfire telemetry receiver, threaded ground station pipeline
+// A reader thread moves bytes from the radio into a queue, a decoder thread
+// turns them into samples, adds the derived signals (telem_derive.h) and fans
+// them out to one queue per sink, and each sink drains its own queue on its
+// own thread. Every queue is a bounded single producer, single consumer ring
+// that drops instead of blocking, so a slow sink can never hold up the serial
+// port.
+
+#include <stdio.h>
+#include <pthread.h>
+#include "telem_rx.h"
+
+#define TELEM_CHUNK_LEN       256   // Bytes per read from the radio
+#define TELEM_RAW_QUEUE_LEN   256   // Chunks between reader and decoder
+#define TELEM_SINK_QUEUE_LEN  8192  // Samples between decoder and each sink
+#define TELEM_SINK_BATCH      64    // Samples handed to a sink per call
+#define TELEM_MAX_SINKS       4
+#define TELEM_LINK_PERIOD_MS  500   // Time between link reports
+#define TELEM_ARQ_TIMEOUT_MS  200   // Time before a NACK is repeated
+
+// A decoded signal value
+typedef struct
+{
+    int64_t time_ms;                        // Source time, transmitter clock
+    int32_t signal;                         // telem_signal_name() index
+    double  value;
+} telem_sample_t;
+
+// Bounded lock-free queue of fixed size items, one producer and one consumer
+typedef struct
+{
+    uint8_t *         buf;
+    size_t            item_size;
+    uint32_t          mask;                 // Capacity - 1, capacity is a power of 2
+    char              pad0[64];
+    volatile uint32_t head;                 // Written by the producer only
+    char              pad1[64];
+    volatile uint32_t tail;                 // Written by the consumer only
+    char              pad2[64];
+    uint32_t          n_pushed;             // Producer side statistics
+    uint32_t          n_dropped;            // Items dropped on a full queue
+    uint32_t          high_water;           // Deepest the queue has been
+} telem_queue_t;
+
+int      telem_queue_init(telem_queue_t * q, size_t item_size, uint32_t capacity);
+void     telem_queue_free(telem_queue_t * q);
+int      telem_queue_push(telem_queue_t * q, const void * item);
+int      telem_queue_pop(telem_queue_t * q, void * item);
+uint32_t telem_queue_depth(const telem_queue_t * q);
+
+// Called on a sink thread with up to TELEM_SINK_BATCH samples, and with n = 0
+// when the queue has run dry so buffered output can be flushed
+typedef void (*telem_sink_cb_t)(const telem_sample_t * s, int n, void * ctx);
+
+typedef struct
+{
+    const char *    name;
+    telem_sink_cb_t cb;
+    void *          ctx;
+    telem_queue_t   queue;
+    pthread_t       thread;
+    volatile int    running;                // Cleared after the decoder stops
+    uint32_t        n_samples;              // Samples handed to cb
+} telem_sink_t;
+
+// Raw bytes read from the radio
+typedef struct
+{
+    int     len;
+    uint8_t data[TELEM_CHUNK_LEN];
+} telem_chunk_t;
+
+typedef struct
+{
+    int            fd;                      // Radio serial port
+    int            xbee_api;                // Radio is in XBee API mode
+    volatile int   running;
+    pthread_t      reader;
+    pthread_t      decoder;
+    telem_queue_t  raw;
+    telem_sink_t   sinks[TELEM_MAX_SINKS];
+    int            n_sinks;
+
+    // Decoder state, only touched by the decoder thread
+    telem_parser_t parser;
+    telem_xbee_t   xbee;
+    telem_lz_t     lz;
+    telem_delta_t  delta;
+    telem_clock_t  clock;
+    telem_arq_t    arq;
+    telem_link_t   link;
+    telem_derive_t derive;
+    uint8_t        xbee_frame_id;
+    uint64_t       n_bytes;                 // Bytes read from the radio
+    uint32_t       n_read_errors;
+    uint32_t       n_write_errors;          // Commands that could not be sent
+} telem_pipeline_t;
+
+// Live telemetry server, publishes samples to TCP subscribers. Subscribers
+// send text lines:
+//
+//   SUB <signal> [N]     receive every Nth sample of a signal (default 1), a
+//                        name ending in '*' matches every signal it prefixes
+//   UNSUB <signal>       stop receiving a signal, '*' works the same way
+//   LIST                 list the signal names
+//
+// and receive one "time_ms,signal,value" line per sample. A subscriber that
+// does not keep up loses samples, it never slows down the others. When the
+// server is given a store, the queries of telem_store.h can be sent as well.
+// A query runs on the server thread outside the lock and its reply is written
+// straight to the socket at the pace the subscriber reads it, the samples
+// that come in meanwhile are dropped for that subscriber. Queries are
+// answered in order, up to TELEM_PUBSUB_MAX_QUERIES can wait and any more get
+// "# busy".
+#define TELEM_PUBSUB_MAX_SUBS  32
+#define TELEM_PUBSUB_OUT_LEN   65536         // Output buffer per subscriber
+#define TELEM_PUBSUB_LINE_LEN  128
+#define TELEM_PUBSUB_MAX_QUERIES 4          // Queries waiting per subscriber
+
+typedef struct
+{
+    int      fd;                            // -1 if the slot is free
+    uint16_t decim[TELEM_MAX_SIGNALS];      // Decimation per signal, 0 if not subscribed
+    uint16_t count[TELEM_MAX_SIGNALS];
+    char     in[TELEM_PUBSUB_LINE_LEN];
+    int      in_len;
+    char *   out;
+    int      out_len;
+    uint32_t n_sent;                        // Samples queued for the subscriber
+    uint32_t n_dropped;                     // Samples lost to a full output buffer or a query
+    char     query[TELEM_PUBSUB_MAX_QUERIES][TELEM_PUBSUB_LINE_LEN];  // Waiting for the server thread
+    int      n_query;
+    int      b_querying;                    // Reply being written, out is the server thread's
+} telem_sub_t;
+
+typedef struct
+{
+    int             listen_fd;
+    volatile int    running;
+    pthread_t       thread;
+    pthread_mutex_t lock;                   // Guards subs between the server and sink threads
+    telem_sub_t     subs[TELEM_PUBSUB_MAX_SUBS];
+    uint32_t        n_accepted;
+    uint32_t        n_refused;              // Connections refused, server full
+    struct telem_store_s * store;           // Answers queries if not NULL
+} telem_pubsub_t;
+
+int  telem_pubsub_start(telem_pubsub_t * ps, int port);
+void telem_pubsub_stop(telem_pubsub_t * ps);
+void telem_pubsub_sink(const telem_sample_t * s, int n, void * ctx);
+void telem_pubsub_print_stats(telem_pubsub_t * ps, FILE * fp);
+
+int  telem_pipeline_init(telem_pipeline_t * p, int fd, int xbee_api);
+int  telem_pipeline_add_sink(telem_pipeline_t * p, const char * name, telem_sink_cb_t cb, void * ctx);
+int  telem_pipeline_start(telem_pipeline_t * p);
+void telem_pipeline_stop(telem_pipeline_t * p);
+void telem_pipeline_print_stats(telem_pipeline_t * p, FILE * fp);
+
+#endif
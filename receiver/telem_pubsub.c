@@ -0,0 +1,528 @@
+// Spitfire telemetry receiver, live telemetry server
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Publishes decoded samples to TCP subscribers with per-subscriber signal
+// selection and decimation, see telem_pipeline.h for the protocol. Runs as a
+// pipeline sink, so serving subscribers never adds to the decoder's latency.
+// Sockets are non-blocking, the server thread accepts connections and reads
+// subscriptions with poll(), and the sink thread formats each sample once and
+// appends it to the output buffer of every interested subscriber. Store
+// queries are answered by the server thread with the lock released, so a long
+// reply never holds up the sink.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "telem_pipeline.h"
+#include "telem_store.h"
+
+#define PUBSUB_POLL_MS     20       // Longest a pending output buffer waits
+#define PUBSUB_REPLY_MS    5000     // Longest a query reply waits for the subscriber to read
+#define PUBSUB_REPLY_LEN   4096     // Query reply bytes written per send
+
+// Query reply being written to a subscriber's socket
+typedef struct
+{
+    telem_pubsub_t * ps;
+    int              fd;
+    char             buf[PUBSUB_REPLY_LEN];
+    int              len;
+    int              failed;        // Subscriber gone or stopped reading
+} pubsub_reply_t;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd,F_GETFL,0);
+    return (flags < 0) ? -1 : fcntl(fd,F_SETFL,flags | O_NONBLOCK);
+}
+
+static void sub_close(telem_sub_t * sub)
+{
+    close(sub->fd);
+    free(sub->out);
+    sub->fd  = -1;
+    sub->out = NULL;
+}
+
+// Writes as much of the output buffer as the socket takes, returns -1 if the
+// subscriber has gone away
+static int sub_flush(telem_sub_t * sub)
+{
+    ssize_t n;
+
+    while (sub->out_len > 0)
+    {
+        n = send(sub->fd,sub->out,sub->out_len,MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+        }
+        memmove(sub->out,sub->out + n,sub->out_len - n);
+        sub->out_len -= (int)n;
+    }
+    return 0;
+}
+
+// Queues a line for a subscriber, returns 0 and counts a drop if it is full
+static int sub_write(telem_sub_t * sub, const char * line, int len)
+{
+    if (sub->out_len + len > TELEM_PUBSUB_OUT_LEN)
+    {
+        sub->n_dropped++;
+        return 0;
+    }
+    memcpy(sub->out + sub->out_len,line,len);
+    sub->out_len += len;
+    return 1;
+}
+
+// Applies a subscription to every signal matching name, decim 0 unsubscribes
+static int sub_select(telem_sub_t * sub, const char * name, int decim)
+{
+    int    i;
+    int    n = 0;
+    size_t len = strlen(name);
+    int    b_prefix = (len > 0) && (name[len - 1] == '*');
+
+    for (i = 0 ; i < telem_signal_count() ; i++)
+    {
+        if (b_prefix ? (strncmp(telem_signal_name(i),name,len - 1) == 0)
+                     : (strcmp(telem_signal_name(i),name) == 0))
+        {
+            sub->decim[i] = (uint16_t)decim;
+            sub->count[i] = 0;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Writes all of buf to a non-blocking socket, waiting up to PUBSUB_REPLY_MS
+// at a time for the subscriber to read. Returns -1 if it does not
+static int send_all(telem_pubsub_t * ps, int fd, const char * buf, int len)
+{
+    struct pollfd pfd;
+    ssize_t       n;
+
+    while (len > 0)
+    {
+        n = send(fd,buf,len,MSG_NOSIGNAL);
+        if (n >= 0)
+        {
+            buf += n;
+            len -= (int)n;
+            continue;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+            return -1;
+        }
+        pfd.fd     = fd;
+        pfd.events = POLLOUT;
+        if ((poll(&pfd,1,PUBSUB_REPLY_MS) <= 0) || !__atomic_load_n(&ps->running,__ATOMIC_ACQUIRE))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void query_write(const char * text, int len, void * ctx)
+{
+    pubsub_reply_t * r = (pubsub_reply_t *)ctx;
+
+    if (r->failed)
+    {
+        return;
+    }
+    if (r->len + len > PUBSUB_REPLY_LEN)
+    {
+        r->failed = (send_all(r->ps,r->fd,r->buf,r->len) != 0);
+        r->len = 0;
+    }
+    if (len > PUBSUB_REPLY_LEN)
+    {
+        r->failed = r->failed || (send_all(r->ps,r->fd,text,len) != 0);
+        return;
+    }
+    memcpy(r->buf + r->len,text,len);
+    r->len += len;
+}
+
+// Answers a subscriber's waiting queries, called with the lock released while
+// the sink leaves the subscriber alone. Whatever was queued before the
+// queries goes first. Returns -1 if the subscriber has gone away or stopped
+// reading
+static int sub_query(telem_pubsub_t * ps, telem_sub_t * sub)
+{
+    int              i;
+    pubsub_reply_t * r = malloc(sizeof(*r));
+    int              result;
+
+    if ((r == NULL) || (send_all(ps,sub->fd,sub->out,sub->out_len) != 0))
+    {
+        free(r);
+        return -1;
+    }
+    sub->out_len = 0;
+    r->ps     = ps;
+    r->fd     = sub->fd;
+    r->len    = 0;
+    r->failed = 0;
+    for (i = 0 ; (i < sub->n_query) && !r->failed ; i++)
+    {
+        telem_store_query(ps->store,sub->query[i],query_write,r);
+    }
+    if (!r->failed)
+    {
+        r->failed = (send_all(ps,r->fd,r->buf,r->len) != 0);
+    }
+    result = r->failed ? -1 : 0;
+    free(r);
+    return result;
+}
+
+// Handles one command line from a subscriber, anything that is not a
+// subscription command is tried as a store query
+static void sub_command(telem_pubsub_t * ps, telem_sub_t * sub, char * line)
+{
+    char   query[TELEM_PUBSUB_LINE_LEN];
+    char   reply[TELEM_PUBSUB_LINE_LEN];
+    char * cmd;
+    char * name;
+    char * arg;
+    int    decim;
+    int    i;
+
+    snprintf(query,sizeof(query),"%s",line);
+    cmd = strtok(line," \t\r");
+    if (cmd == NULL)
+    {
+        return;
+    }
+    name = strtok(NULL," \t\r");
+    arg  = strtok(NULL," \t\r");
+    if ((strcmp(cmd,"SUB") == 0) && (name != NULL))
+    {
+        decim = (arg != NULL) ? atoi(arg) : 1;
+        if ((decim < 1) || (decim > 65535))
+        {
+            decim = 1;
+        }
+        i = snprintf(reply,sizeof(reply),"# %d signals\n",sub_select(sub,name,decim));
+        sub_write(sub,reply,i);
+    }
+    else if ((strcmp(cmd,"UNSUB") == 0) && (name != NULL))
+    {
+        i = snprintf(reply,sizeof(reply),"# %d signals\n",sub_select(sub,name,0));
+        sub_write(sub,reply,i);
+    }
+    else if (strcmp(cmd,"LIST") == 0)
+    {
+        for (i = 0 ; i < telem_signal_count() ; i++)
+        {
+            int n = snprintf(reply,sizeof(reply),"# %s\n",telem_signal_name(i));
+            sub_write(sub,reply,n);
+        }
+    }
+    else if ((ps->store != NULL) && (sub->n_query >= TELEM_PUBSUB_MAX_QUERIES))
+    {
+        sub_write(sub,"# busy\n",7);
+    }
+    else if (ps->store != NULL)
+    {
+        // Answered by the server thread once the lock is released
+        memcpy(sub->query[sub->n_query++],query,TELEM_PUBSUB_LINE_LEN);
+    }
+    else
+    {
+        sub_write(sub,"# ?\n",4);
+    }
+}
+
+// Reads command lines from a subscriber, returns -1 if it has gone away
+static int sub_read(telem_pubsub_t * ps, telem_sub_t * sub)
+{
+    char    buf[256];
+    ssize_t n;
+    ssize_t i;
+
+    n = recv(sub->fd,buf,sizeof(buf),0);
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n < 0)
+    {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+    for (i = 0 ; i < n ; i++)
+    {
+        if (buf[i] == '\n')
+        {
+            sub->in[sub->in_len] = '\0';
+            sub_command(ps,sub,sub->in);
+            sub->in_len = 0;
+        }
+        else if (sub->in_len < TELEM_PUBSUB_LINE_LEN - 1)
+        {
+            sub->in[sub->in_len++] = buf[i];
+        }
+    }
+    return 0;
+}
+
+static void accept_sub(telem_pubsub_t * ps)
+{
+    int i;
+    int fd = accept(ps->listen_fd,NULL,NULL);
+
+    if (fd < 0)
+    {
+        return;
+    }
+    for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+    {
+        telem_sub_t * sub = &ps->subs[i];
+        if (sub->fd < 0)
+        {
+            memset(sub,0,sizeof(*sub));
+            sub->out = malloc(TELEM_PUBSUB_OUT_LEN);
+            if ((sub->out == NULL) || (set_nonblocking(fd) != 0))
+            {
+                break;
+            }
+            sub->fd = fd;
+            ps->n_accepted++;
+            return;
+        }
+    }
+    if (i < TELEM_PUBSUB_MAX_SUBS)
+    {
+        free(ps->subs[i].out);
+        ps->subs[i].out = NULL;
+        ps->subs[i].fd  = -1;
+    }
+    ps->n_refused++;
+    close(fd);
+}
+
+// Answers the queries subscribers have sent, one at a time with the lock
+// released. The sink skips a subscriber while its reply is written
+static void run_queries(telem_pubsub_t * ps)
+{
+    int i;
+    int result;
+
+    for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+    {
+        telem_sub_t * sub = &ps->subs[i];
+
+        pthread_mutex_lock(&ps->lock);
+        if ((sub->fd < 0) || (sub->n_query == 0))
+        {
+            pthread_mutex_unlock(&ps->lock);
+            continue;
+        }
+        sub->b_querying = 1;
+        pthread_mutex_unlock(&ps->lock);
+
+        result = sub_query(ps,sub);
+
+        pthread_mutex_lock(&ps->lock);
+        sub->n_query    = 0;
+        sub->b_querying = 0;
+        if (result != 0)
+        {
+            sub_close(sub);
+        }
+        pthread_mutex_unlock(&ps->lock);
+    }
+}
+
+// Server thread, accepts subscribers, reads their commands, answers their
+// queries and flushes output the sink could not write straight away
+static void * server_thread(void * arg)
+{
+    telem_pubsub_t * ps = (telem_pubsub_t *)arg;
+    struct pollfd    pfd[TELEM_PUBSUB_MAX_SUBS + 1];
+    int              slot[TELEM_PUBSUB_MAX_SUBS + 1];
+    int              n;
+    int              i;
+
+    while (__atomic_load_n(&ps->running,__ATOMIC_ACQUIRE))
+    {
+        pfd[0].fd     = ps->listen_fd;
+        pfd[0].events = POLLIN;
+        n = 1;
+        pthread_mutex_lock(&ps->lock);
+        for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+        {
+            if (ps->subs[i].fd >= 0)
+            {
+                pfd[n].fd     = ps->subs[i].fd;
+                pfd[n].events = POLLIN | ((ps->subs[i].out_len > 0) ? POLLOUT : 0);
+                slot[n++]     = i;
+            }
+        }
+        pthread_mutex_unlock(&ps->lock);
+
+        if (poll(pfd,n,PUBSUB_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&ps->lock);
+        for (i = 1 ; i < n ; i++)
+        {
+            telem_sub_t * sub = &ps->subs[slot[i]];
+            if ((pfd[i].revents & (POLLERR | POLLHUP))
+                || ((pfd[i].revents & POLLIN) && (sub_read(ps,sub) != 0))
+                || (sub_flush(sub) != 0))
+            {
+                sub_close(sub);
+            }
+        }
+        if (pfd[0].revents & POLLIN)
+        {
+            accept_sub(ps);
+        }
+        pthread_mutex_unlock(&ps->lock);
+        run_queries(ps);
+    }
+    return NULL;
+}
+
+// Listens on port on every interface and starts the server thread
+int telem_pubsub_start(telem_pubsub_t * ps, int port)
+{
+    struct sockaddr_in addr;
+    int                one = 1;
+    int                i;
+
+    memset(ps,0,sizeof(*ps));
+    for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+    {
+        ps->subs[i].fd = -1;
+    }
+    ps->listen_fd = socket(AF_INET,SOCK_STREAM,0);
+    if (ps->listen_fd < 0)
+    {
+        return -1;
+    }
+    setsockopt(ps->listen_fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+    if ((bind(ps->listen_fd,(struct sockaddr *)&addr,sizeof(addr)) != 0)
+        || (listen(ps->listen_fd,8) != 0)
+        || (set_nonblocking(ps->listen_fd) != 0))
+    {
+        close(ps->listen_fd);
+        return -1;
+    }
+    pthread_mutex_init(&ps->lock,NULL);
+    __atomic_store_n(&ps->running,1,__ATOMIC_RELEASE);
+    if (pthread_create(&ps->thread,NULL,server_thread,ps) != 0)
+    {
+        close(ps->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void telem_pubsub_stop(telem_pubsub_t * ps)
+{
+    int i;
+
+    __atomic_store_n(&ps->running,0,__ATOMIC_RELEASE);
+    pthread_join(ps->thread,NULL);
+    for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+    {
+        if (ps->subs[i].fd >= 0)
+        {
+            sub_flush(&ps->subs[i]);
+            sub_close(&ps->subs[i]);
+        }
+    }
+    close(ps->listen_fd);
+    pthread_mutex_destroy(&ps->lock);
+}
+
+// Pipeline sink, formats each sample once and queues it for every subscriber
+// whose decimation lets it through
+void telem_pubsub_sink(const telem_sample_t * s, int n, void * ctx)
+{
+    telem_pubsub_t * ps = (telem_pubsub_t *)ctx;
+    char             line[TELEM_PUBSUB_LINE_LEN];
+    int              len = 0;
+    int              i;
+    int              j;
+
+    pthread_mutex_lock(&ps->lock);
+    for (i = 0 ; i < n ; i++)
+    {
+        if ((s[i].signal < 0) || (s[i].signal >= TELEM_MAX_SIGNALS))
+        {
+            continue;
+        }
+        len = 0;
+        for (j = 0 ; j < TELEM_PUBSUB_MAX_SUBS ; j++)
+        {
+            telem_sub_t * sub = &ps->subs[j];
+            if ((sub->fd < 0) || (sub->decim[s[i].signal] == 0))
+            {
+                continue;
+            }
+            if (++sub->count[s[i].signal] < sub->decim[s[i].signal])
+            {
+                continue;
+            }
+            sub->count[s[i].signal] = 0;
+            if (sub->b_querying)
+            {
+                sub->n_dropped++;
+                continue;
+            }
+            if (len == 0)
+            {
+                len = snprintf(line,sizeof(line),"%lld,%s,%.6g\n",(long long)s[i].time_ms,
+                               telem_signal_name(s[i].signal),s[i].value);
+            }
+            sub->n_sent += sub_write(sub,line,len);
+        }
+    }
+
+    // Write what the sockets take now, the server thread does the rest
+    for (j = 0 ; j < TELEM_PUBSUB_MAX_SUBS ; j++)
+    {
+        if ((ps->subs[j].fd >= 0) && !ps->subs[j].b_querying && (ps->subs[j].out_len > 0)
+            && (sub_flush(&ps->subs[j]) != 0))
+        {
+            sub_close(&ps->subs[j]);
+        }
+    }
+    pthread_mutex_unlock(&ps->lock);
+}
+
+void telem_pubsub_print_stats(telem_pubsub_t * ps, FILE * fp)
+{
+    int i;
+
+    pthread_mutex_lock(&ps->lock);
+    fprintf(fp,"pubsub:   %u accepted, %u refused\n",ps->n_accepted,ps->n_refused);
+    for (i = 0 ; i < TELEM_PUBSUB_MAX_SUBS ; i++)
+    {
+        if (ps->subs[i].fd >= 0)
+        {
+            fprintf(fp,"  sub %-6d buffered %6d sent %10u dropped %u\n",
+                    i,ps->subs[i].out_len,ps->subs[i].n_sent,ps->subs[i].n_dropped);
+        }
+    }
+    pthread_mutex_unlock(&ps->lock);
+}
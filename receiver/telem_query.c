@@ -0,0 +1,62 @@
+// Spitfire telemetry receiver, query tool
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Loads a CSV recorded by telemd into the time series store and answers a
+// text query on it, see telem_store.h for the queries
+//
+// Usage: telem_query <csv> <query...>
+//   e.g. telem_query race.csv INTEG BPS_CURRENT -90000
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "telem_store.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void write_stdout(const char * text, int len, void * ctx)
+{
+    (void)ctx;
+    fwrite(text,1,len,stdout);
+}
+
+int main(int argc, char ** argv)
+{
+    static telem_store_t store;
+    char   query[160] = "";
+    int    i;
+    int    n;
+    double t0;
+
+    if (argc < 3)
+    {
+        fprintf(stderr,"usage: %s <csv> <query...>\n",argv[0]);
+        return 1;
+    }
+    for (i = 2 ; i < argc ; i++)
+    {
+        strncat(query,argv[i],sizeof(query) - strlen(query) - 2);
+        strcat(query," ");
+    }
+
+    telem_store_init(&store);
+    t0 = now_s();
+    n  = telem_store_load_csv(&store,argv[1]);
+    if (n < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    fprintf(stderr,"loaded %d samples in %.1f ms\n",n,(now_s() - t0) * 1e3);
+
+    t0 = now_s();
+    n  = telem_store_query(&store,query,write_stdout,NULL);
+    fprintf(stderr,"query took %.3f ms\n",(now_s() - t0) * 1e3);
+    telem_store_free(&store);
+    return (n == 0) ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+// Spitfire telemetry receiver, lock-free queue
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Bounded ring buffer passing fixed size items from one thread to another
+// without locks. The producer owns head and the consumer owns tail, each
+// publishes its index with a release store after touching the slot.
+
+#include <stdlib.h>
+#include <string.h>
+#include "telem_pipeline.h"
+
+// Capacity is rounded up to a power of 2, returns -1 if out of memory
+int telem_queue_init(telem_queue_t * q, size_t item_size, uint32_t capacity)
+{
+    uint32_t n = 1;
+
+    while (n < capacity)
+    {
+        n <<= 1;
+    }
+    memset(q,0,sizeof(*q));
+    q->buf = malloc(item_size * n);
+    if (q->buf == NULL)
+    {
+        return -1;
+    }
+    q->item_size = item_size;
+    q->mask      = n - 1;
+    return 0;
+}
+
+void telem_queue_free(telem_queue_t * q)
+{
+    free(q->buf);
+    q->buf = NULL;
+}
+
+// Producer side, returns 0 and counts a drop if the queue is full
+int telem_queue_push(telem_queue_t * q, const void * item)
+{
+    uint32_t head  = q->head;
+    uint32_t tail  = __atomic_load_n(&q->tail,__ATOMIC_ACQUIRE);
+    uint32_t depth = head - tail;
+
+    if (depth > q->mask)
+    {
+        q->n_dropped++;
+        return 0;
+    }
+    memcpy(q->buf + (size_t)(head & q->mask) * q->item_size,item,q->item_size);
+    __atomic_store_n(&q->head,head + 1,__ATOMIC_RELEASE);
+    q->n_pushed++;
+    if (depth + 1 > q->high_water)
+    {
+        q->high_water = depth + 1;
+    }
+    return 1;
+}
+
+// Consumer side, returns 0 if the queue is empty
+int telem_queue_pop(telem_queue_t * q, void * item)
+{
+    uint32_t tail = q->tail;
+    uint32_t head = __atomic_load_n(&q->head,__ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return 0;
+    }
+    memcpy(item,q->buf + (size_t)(tail & q->mask) * q->item_size,q->item_size);
+    __atomic_store_n(&q->tail,tail + 1,__ATOMIC_RELEASE);
+    return 1;
+}
+
+// Items waiting, may be stale by the time it returns
+uint32_t telem_queue_depth(const telem_queue_t * q)
+{
+    return __atomic_load_n(&q->head,__ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail,__ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,168 @@
+// Spitfire telemetry receiver, bulk re-decoding tool
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Re-decodes a recorded radio capture with the bulk decoder, reporting the
+// throughput of each stage and optionally writing the samples as a CSV in the
+// same format as telemd (grouped by signal rather than interleaved)
+//
+// With -s the capture is streamed through telem_capture_next() one page at a
+// time instead, on one thread and in flat memory, and the CSV comes out in
+// stream order like telemd's
+//
+// Usage: telem_redecode [-s] [-j threads] [-o output csv] <capture file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "telem_bulk.h"
+
+typedef struct
+{
+    FILE *   fp;
+    uint64_t n_samples;
+} stream_t;
+
+static int write_csv(const telem_bulk_t * b, const char * path)
+{
+    FILE *   fp = fopen(path,"w");
+    int      i;
+    size_t   j;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    fprintf(fp,"time_ms,signal,value\n");
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        for (j = 0 ; j < b->columns[i].n ; j++)
+        {
+            fprintf(fp,"%lld,%s,%.6g\n",(long long)b->columns[i].time[j],telem_signal_name(i),b->columns[i].value[j]);
+        }
+    }
+    return fclose(fp);
+}
+
+static void stream_sample(int signal, int64_t time_ms, double value, void * ctx)
+{
+    stream_t * s = (stream_t *)ctx;
+
+    s->n_samples++;
+    if (s->fp != NULL)
+    {
+        fprintf(s->fp,"%lld,%s,%.6g\n",(long long)time_ms,telem_signal_name(signal),value);
+    }
+}
+
+static int stream_capture(telem_capture_t * cap, const char * path)
+{
+    telem_frame_t   page;
+    int64_t         source_ms;
+    stream_t        s = {NULL, 0};
+    uint64_t        n_pages = 0;
+    struct timespec t0;
+    struct timespec t1;
+    double          total;
+
+    if (path != NULL)
+    {
+        s.fp = fopen(path,"w");
+        if (s.fp == NULL)
+        {
+            perror(path);
+            return 1;
+        }
+        fprintf(s.fp,"time_ms,signal,value\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    while (telem_capture_next(cap,&page,&source_ms))
+    {
+        telem_decode_frame(&page,source_ms,stream_sample,&s);
+        n_pages++;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    total = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("capture:  %llu bytes, %llu frames, %llu false syncs, %llu rejected\n",
+           (unsigned long long)cap->len,(unsigned long long)cap->n_frames,(unsigned long long)cap->n_false_syncs,
+           (unsigned long long)(cap->lz.n_rejected + cap->delta.n_rejected));
+    printf("stream:   %8.1f ms, %.1f MB/s, %llu pages, %llu samples\n",total * 1e3,
+           cap->len / 1e6 / (total > 0 ? total : 1e-9),(unsigned long long)n_pages,(unsigned long long)s.n_samples);
+    if ((s.fp != NULL) && (fclose(s.fp) != 0))
+    {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    static telem_bulk_t b;
+    telem_capture_t cap;
+    const char *    out = NULL;
+    int             threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int             stream = 0;
+    int             c;
+    int             rc;
+    double          total;
+
+    while ((c = getopt(argc,argv,"sj:o:")) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                stream = 1;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            default:
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr,"usage: %s [-s] [-j threads] [-o output csv] <capture file>\n",argv[0]);
+        return 1;
+    }
+
+    if (telem_capture_open(&cap,argv[optind]) != 0)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (stream)
+    {
+        rc = stream_capture(&cap,out);
+        telem_capture_close(&cap);
+        return rc;
+    }
+
+    telem_bulk_init(&b);
+    if (telem_bulk_decode(&b,cap.buf,cap.len,threads) != 0)
+    {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    total = b.t_frame + b.t_unpack + b.t_decode;
+    printf("capture:  %llu bytes, %llu frames, %llu false syncs, %llu rejected\n",
+           (unsigned long long)b.n_bytes,(unsigned long long)b.n_frames,
+           (unsigned long long)b.n_false_syncs,(unsigned long long)b.n_rejected);
+    printf("framing:  %8.1f ms, %.1f MB/s on %d threads\n",b.t_frame * 1e3,b.n_bytes / 1e6 / (b.t_frame > 0 ? b.t_frame : 1e-9),threads);
+    printf("unpack:   %8.1f ms, %llu pages\n",b.t_unpack * 1e3,(unsigned long long)b.n_pages);
+    printf("decode:   %8.1f ms, %llu samples\n",b.t_decode * 1e3,(unsigned long long)b.n_samples);
+    printf("total:    %8.1f ms, %.1f MB/s\n",total * 1e3,b.n_bytes / 1e6 / (total > 0 ? total : 1e-9));
+
+    if ((out != NULL) && (write_csv(&b,out) != 0))
+    {
+        perror(out);
+        return 1;
+    }
+    telem_bulk_free(&b);
+    telem_capture_close(&cap);
+    return 0;
+}
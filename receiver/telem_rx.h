@@ -0,0 +1,286 @@
+#ifndef TELEM_RX_H
+#define TELEM_RX_H
+
+// Spitfire telemetry receiver library
+// Decodes the radio frames produced by the transmitter firmware, see
+// transmitter/telem_frame.h for the frame layout
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../transmitter/telem_frame.h"
+#include "../transmitter/xbee_api.h"
+#include "../transmitter/telem_sched.h"
+#include "telem_derive.h"
+#include "telem_legacy.h"
+
+#define TELEM_MAX_PAYLOAD 255
+#define TELEM_MAX_SIGNALS 256
+#define TELEM_MAX_PAGES   32
+#define TELEM_CMD_MAX_FRAME (TELEM_CMD_MAX_ARGS + 4)
+
+// A single decoded radio frame
+typedef struct
+{
+    uint8_t  id;
+    uint8_t  flags;                         // TELEM_FLAG_* bits
+    uint8_t  seq;                           // Frame sequence number
+    uint8_t  len;
+    uint16_t time;                          // Transmitter time at send (ms)
+    uint16_t age;                           // Time since page update (ms)
+    uint8_t  payload[TELEM_MAX_PAYLOAD];
+} telem_frame_t;
+
+// Called by the parser for every valid frame
+typedef void (*telem_frame_cb_t)(const telem_frame_t * f, void * ctx);
+
+// Byte-at-a-time frame parser
+typedef struct
+{
+    int           state;
+    int           count;
+    uint8_t       crc;
+    uint8_t       raw[TELEM_HEADER_SIZE + TELEM_MAX_PAYLOAD + 1];
+    telem_frame_t frame;
+    uint32_t      n_frames;                 // Frames decoded
+    uint32_t      n_crc_errors;             // Frames dropped on CRC mismatch
+    uint32_t      n_skipped;                // Bytes discarded while hunting for sync
+} telem_parser_t;
+
+// Called by the page decoder for every decoded signal value
+typedef void (*telem_sample_cb_t)(int signal, int64_t time_ms, double value, void * ctx);
+
+// Keyframe state for rebuilding delta coded pages
+typedef struct
+{
+    uint8_t  base[TELEM_MAX_PAGES][TELEM_MAX_PAYLOAD];
+    uint8_t  len[TELEM_MAX_PAGES];
+    uint8_t  tag[TELEM_MAX_PAGES];
+    uint8_t  valid[TELEM_MAX_PAGES];
+    uint32_t n_rejected;                    // Delta frames that could not be rebuilt
+} telem_delta_t;
+
+// Stream history for undoing LZ compression
+typedef struct
+{
+    uint8_t  ring[TELEM_LZ_WINDOW];
+    uint8_t  hash[TELEM_LZ_HASH_SIZE];      // Only used by the compressor
+    uint8_t  pos;
+    int      valid;                         // History is in step with the transmitter
+    uint32_t n_rejected;                    // Compressed frames that had to be dropped
+} telem_lz_t;
+
+// Unwraps the 16 bit transmitter clock into a monotonic 64 bit clock
+typedef struct
+{
+    int64_t  last;                          // Unwrapped time of the newest frame
+    int      valid;
+} telem_clock_t;
+
+// Lost frame tracking for selective retransmission
+#define TELEM_ARQ_MAX_PENDING 16
+#define TELEM_ARQ_MAX_TRIES   3
+
+typedef struct
+{
+    uint8_t  seq;
+    int      tries;
+    int64_t  sent_ms;                       // Host time of the last NACK
+} telem_arq_pending_t;
+
+typedef struct
+{
+    int                 valid;
+    uint8_t             next_seq;           // Expected sequence number
+    int                 timeout_ms;         // Time to wait before repeating a NACK
+    telem_arq_pending_t pending[TELEM_ARQ_MAX_PENDING];
+    int                 n_pending;
+    uint32_t            n_lost;             // Frames missing from the sequence
+    uint32_t            n_recovered;        // Lost frames that were retransmitted
+    uint32_t            n_given_up;         // Lost frames never recovered
+} telem_arq_t;
+
+// Link statistics sent by the transmitter in TELEM_LINK_ID frames
+typedef struct
+{
+    int      rssi;                          // Transmitter radio RSSI in dBm, 0 if unknown
+    uint16_t tx_ok;
+    uint16_t tx_fail;
+    uint16_t retries;
+    uint16_t nacks;
+    uint8_t  loss;                          // Loss the rate controller acted on, 1/256ths
+    uint16_t period_ms;                     // Sending period in use
+    uint8_t  mode;                          // TELEM_LINK_MODE_* bits
+} telem_link_stats_t;
+
+// Scheduler statistics sent by the transmitter in TELEM_SCHED_ID frames, one
+// entry per task of TELEM_TASK_TABLE
+typedef struct
+{
+    uint16_t runs;
+    uint16_t busy;                          // Share of the time running, 1/1000ths
+    uint16_t max_us;                        // Longest run
+    uint8_t  late;                          // Runs past the deadline
+    uint8_t  skipped;                       // Releases lost while waiting to run
+} telem_task_stats_t;
+
+typedef struct
+{
+    int                n_tasks;
+    telem_task_stats_t task[N_TELEM_TASK];
+    uint16_t           duty;                // Share of the time not idle, 1/1000ths
+} telem_sched_stats_t;
+
+// Loss measurement for the link reports sent to the transmitter
+typedef struct
+{
+    int                period_ms;           // Time between reports
+    int64_t            next_ms;             // Host time the next report is due
+    uint32_t           n_frames;            // Frames received, retransmissions excluded
+    uint32_t           last_frames;
+    uint32_t           last_lost;
+    uint8_t            loss;                // Loss over the last report period, 1/256ths
+    telem_link_stats_t remote;              // Newest statistics from the transmitter
+    int                remote_valid;
+    telem_sched_stats_t sched;              // Newest scheduler statistics
+    int                sched_valid;
+} telem_link_t;
+
+// Derived signal state, see telem_derive.h
+#define TELEM_MAX_DERIVED 32
+
+typedef struct
+{
+    int      op;                            // DERIVE_* operation
+    int      signal;                        // Output signal
+    int      a;                             // Trigger input, first element for a total
+    int      b;                             // Other input, -1 if none
+    int      n;                             // Elements summed by a total
+    double   k;
+    double   p;
+    double   acc;                           // Integral or filter state
+    int64_t  t_prev;                        // Time of the previous trigger sample
+    double   v_prev;
+    int      primed;                        // A previous trigger sample exists
+    int      next;                          // Next output with the same trigger, -1 if none
+} telem_derive_out_t;
+
+typedef struct
+{
+    telem_derive_out_t out[TELEM_MAX_DERIVED];
+    int                n_out;
+    int                first[TELEM_MAX_SIGNALS];  // First output each signal triggers, -1 if none
+    double             value[TELEM_MAX_SIGNALS];  // Newest value of every signal
+    int64_t            time[TELEM_MAX_SIGNALS];
+    uint32_t           n_samples;                 // Derived samples produced
+    uint32_t           n_skipped;                 // Late or non-finite input samples ignored
+} telem_derive_t;
+
+// Legacy archive decoders, see telem_legacy.h
+typedef struct
+{
+    int      synced;                        // In step with the pages
+    int      prev;                          // Page index of the last page kept, -1 if none
+    int64_t  time_ms;                       // Time of the last page kept
+    uint64_t n_pages;                       // Pages decoded
+    uint64_t n_resyncs;                     // Times step was lost
+    uint64_t n_skipped;                     // Bytes between pages that were not kept
+} telem_legacy_t;
+
+typedef struct
+{
+    int64_t  period;                        // TX periods since the first line
+    int      last_code;                     // Code of the last rotating line, -1 if none
+    int      seen_misc;                     // The misc line of this period was seen
+    uint64_t n_lines;                       // Lines decoded
+    uint64_t n_rejected;                    // Lines dropped as misframed
+    uint64_t n_dropped;                     // Out of range columns of kept lines
+} telem_aux_t;
+
+// XBee API frame reader, the RF data of receive packets is fed to a
+// telem_parser_t. Sized for the largest API frame the 900HP produces.
+#define TELEM_XBEE_MAX_DATA   (XBEE_TX_HEADER_LEN + XBEE_MAX_PAYLOAD)
+#define TELEM_XBEE_MAX_FRAME  (2 * (TELEM_XBEE_MAX_DATA + 3) + 1)   // Escaped worst case
+
+typedef struct
+{
+    int      state;
+    int      escape;
+    int      len;
+    int      count;
+    uint8_t  sum;
+    uint8_t  data[TELEM_XBEE_MAX_DATA];
+    uint32_t n_packets;                     // Receive packets passed to the parser
+    uint32_t n_checksum_errors;             // API frames dropped on checksum mismatch
+    uint32_t n_tx_ok;                       // Transmit requests delivered
+    uint32_t n_tx_fail;                     // Transmit requests that failed
+    uint32_t n_retries;                     // MAC retries reported in TX status
+    int      rssi;                          // Last RSSI in dBm, 0 if unknown
+    uint8_t  src64[8];                      // Transmitter radio address, from its packets
+    int      src_valid;
+} telem_xbee_t;
+
+uint8_t telem_crc8(uint8_t crc, const uint8_t * data, int len);
+
+void telem_parser_init(telem_parser_t * p);
+void telem_parser_feed(telem_parser_t * p, uint8_t c, telem_frame_cb_t cb, void * ctx);
+void telem_parser_feed_buf(telem_parser_t * p, const uint8_t * buf, int len, telem_frame_cb_t cb, void * ctx);
+
+void    telem_clock_init(telem_clock_t * c);
+int64_t telem_clock_unwrap(telem_clock_t * c, uint16_t time);
+int64_t telem_frame_source_ms(telem_clock_t * c, const telem_frame_t * f);
+
+void telem_delta_init(telem_delta_t * d);
+int  telem_delta_apply(telem_delta_t * d, const telem_frame_t * in, telem_frame_t * out);
+
+void telem_lz_init(telem_lz_t * z);
+void telem_lz_reset(telem_lz_t * z);
+int  telem_lz_compress(telem_lz_t * z, const uint8_t * data, int len, uint8_t * out);
+int  telem_lz_decompress(telem_lz_t * z, const uint8_t * in, int len, uint8_t * out, int max);
+int  telem_lz_apply(telem_lz_t * z, const telem_frame_t * in, telem_frame_t * out);
+
+int telem_cmd_build(uint8_t cmd, const uint8_t * args, int len, uint8_t * out);
+int telem_cmd_set_send_period(uint16_t ms, uint8_t * out);
+int telem_cmd_set_poll_period(uint16_t ms, uint8_t * out);
+int telem_cmd_page_enable(uint8_t id, int enable, uint8_t * out);
+int telem_cmd_snapshot(uint8_t * out);
+int telem_cmd_poll_enable(uint8_t index, int enable, uint8_t * out);
+int telem_cmd_link_report(uint8_t loss, int rssi, uint8_t * out);
+int telem_cmd_parse_ack(const telem_frame_t * f, uint8_t * cmd, uint8_t * status);
+
+void telem_arq_init(telem_arq_t * a, int timeout_ms);
+void telem_arq_on_frame(telem_arq_t * a, const telem_frame_t * f);
+int  telem_arq_poll(telem_arq_t * a, int64_t now_ms, uint8_t * out);
+
+void telem_link_init(telem_link_t * l, int period_ms);
+void telem_link_on_frame(telem_link_t * l, const telem_frame_t * f);
+int  telem_link_parse_stats(const telem_frame_t * f, telem_link_stats_t * s);
+int  telem_link_parse_sched(const telem_frame_t * f, telem_sched_stats_t * s);
+const char * telem_task_name(int task);
+int  telem_link_poll(telem_link_t * l, const telem_arq_t * a, int rssi, int64_t now_ms, uint8_t * out);
+
+void telem_xbee_init(telem_xbee_t * x);
+void telem_xbee_feed(telem_xbee_t * x, telem_parser_t * p, uint8_t c, telem_frame_cb_t cb, void * ctx);
+void telem_xbee_feed_buf(telem_xbee_t * x, telem_parser_t * p, const uint8_t * buf, int len, telem_frame_cb_t cb, void * ctx);
+int  telem_xbee_tx_request(uint8_t frame_id, const uint8_t * dest64, const uint8_t * data, int len, uint8_t * out);
+int  telem_xbee_at_command(uint8_t frame_id, const char * cmd, uint8_t * out);
+
+int  telem_derive_init(telem_derive_t * d);
+int  telem_derive_set_param(telem_derive_t * d, const char * name, double p);
+void telem_derive_sample(telem_derive_t * d, int signal, int64_t time_ms, double value, telem_sample_cb_t cb, void * ctx);
+
+void   telem_legacy_init(telem_legacy_t * l);
+size_t telem_legacy_decode(telem_legacy_t * l, const uint8_t * buf, size_t len, telem_sample_cb_t cb, void * ctx);
+void   telem_aux_init(telem_aux_t * a);
+size_t telem_aux_decode(telem_aux_t * a, const char * buf, size_t len, telem_sample_cb_t cb, void * ctx);
+
+void         telem_schema_init(void);
+int          telem_signal_count(void);
+const char * telem_signal_name(int signal);
+int          telem_signal_lookup(const char * name);
+int          telem_page_index(uint8_t id);
+int          telem_page_len(int page);
+int          telem_page_plausible(int page, const uint8_t * payload, int * n_fields);
+int          telem_decode_frame(const telem_frame_t * f, int64_t source_ms, telem_sample_cb_t cb, void * ctx);
+int          telem_decode_can(uint16_t can_id, const uint8_t * data, int len, int64_t time_ms, telem_sample_cb_t cb, void * ctx);
+
+#endif
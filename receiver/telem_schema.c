@@ -0,0 +1,379 @@
+// Spitfire telemetry receiver, page decoding
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Turns the raw or encoded payload of a frame into signal samples using the
+// same TELEM_FIELD_TABLE the transmitter encodes with. The signals of
+// TELEM_DERIVE_TABLE are numbered after the decoded ones.
+
+#include <stdio.h>
+#include <string.h>
+#include "telem_rx.h"
+#include "telem_derive.h"
+#include "../transmitter/can_telem.h"
+
+#define TELEM_SIGNAL_NAME_LEN 32
+
+static const uint8_t g_telem_id[N_TELEM_ID] =
+{
+    TELEM_ID_TABLE(EXPAND_AS_TELEM_ID_ARRAY)
+};
+
+static const uint8_t g_telem_len[N_TELEM_ID] =
+{
+    TELEM_ID_TABLE(EXPAND_AS_TELEM_LEN_ARRAY)
+};
+
+static const char * g_field_name[N_TELEM_FIELD] =
+{
+#define EXPAND_AS_FIELD_NAME_ARRAY(a,b,c,d,e,f,g,h,i) #a,
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_NAME_ARRAY)
+};
+static const int g_field_page[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_PAGE_ARRAY)
+};
+static const int g_field_bitoff[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BITOFF_ARRAY)
+};
+static const int g_field_kind[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_KIND_ARRAY)
+};
+static const double g_field_scale[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_SCALE_ARRAY)
+};
+static const double g_field_bias[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BIAS_ARRAY)
+};
+static const int g_field_bits[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BITS_ARRAY)
+};
+static const int g_field_count[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_COUNT_ARRAY)
+};
+static const int g_field_stride[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_STRIDE_ARRAY)
+};
+
+static const uint16_t g_can_id[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_ID_ARRAY)
+};
+static const int g_can_len[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ARRAY)
+};
+static const int g_can_page[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_PAGE_ARRAY)
+};
+static const int g_can_offset[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_OFFSET_ARRAY)
+};
+
+static const char * g_derive_name[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_NAME_ARRAY)
+};
+static const int g_derive_op[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_OP_ARRAY)
+};
+static const int g_derive_count[N_TELEM_DERIVE] =
+{
+    TELEM_DERIVE_TABLE(EXPAND_AS_DERIVE_COUNT_ARRAY)
+};
+
+static int  g_field_signal[N_TELEM_FIELD];   // First signal index of each field
+static int  g_enc_len[N_TELEM_ID];           // Encoded length of each page
+static int  g_n_signals;
+static char g_signal_name[TELEM_MAX_SIGNALS][TELEM_SIGNAL_NAME_LEN];
+static int  gb_schema_ready = 0;
+
+// Names the next signal, elements of a repeated field get an [n] suffix
+static void add_signal(const char * name, int count, int n)
+{
+    if (count > 1)
+    {
+        snprintf(g_signal_name[g_n_signals],TELEM_SIGNAL_NAME_LEN,"%s[%d]",name,n);
+    }
+    else
+    {
+        snprintf(g_signal_name[g_n_signals],TELEM_SIGNAL_NAME_LEN,"%s",name);
+    }
+    g_n_signals++;
+}
+
+void telem_schema_init(void)
+{
+    int i;
+    int n;
+    int m;
+    int bits[N_TELEM_ID];
+
+    if (gb_schema_ready)
+    {
+        return;
+    }
+    memset(bits,0,sizeof(bits));
+    g_n_signals = 0;
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        g_field_signal[i] = g_n_signals;
+        bits[g_field_page[i]] += g_field_bits[i] * g_field_count[i];
+        for (n = 0 ; n < g_field_count[i] ; n++)
+        {
+            add_signal(g_field_name[i],g_field_count[i],n);
+        }
+    }
+    for (i = 0 ; i < N_TELEM_DERIVE ; i++)
+    {
+        // A total has one output however many inputs it sums
+        m = (g_derive_op[i] == DERIVE_TOTAL) ? 1 : g_derive_count[i];
+        for (n = 0 ; n < m ; n++)
+        {
+            add_signal(g_derive_name[i],m,n);
+        }
+    }
+    for (i = 0 ; i < N_TELEM_ID ; i++)
+    {
+        g_enc_len[i] = (bits[i] + 7) / 8;
+    }
+    gb_schema_ready = 1;
+}
+
+int telem_signal_count(void)
+{
+    telem_schema_init();
+    return g_n_signals;
+}
+
+const char * telem_signal_name(int signal)
+{
+    telem_schema_init();
+    if ((signal < 0) || (signal >= g_n_signals))
+    {
+        return NULL;
+    }
+    return g_signal_name[signal];
+}
+
+int telem_signal_lookup(const char * name)
+{
+    int i;
+    telem_schema_init();
+    for (i = 0 ; i < g_n_signals ; i++)
+    {
+        if (strcmp(g_signal_name[i],name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int telem_page_index(uint8_t id)
+{
+    int i;
+    for (i = 0 ; i < N_TELEM_ID ; i++)
+    {
+        if (g_telem_id[i] == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int telem_page_len(int page)
+{
+    return ((page >= 0) && (page < N_TELEM_ID)) ? g_telem_len[page] : -1;
+}
+
+// Reads an unsigned field of up to 32 bits, MSB first, a byte at a time
+static uint32_t get_bits(const uint8_t * buf, int bitoff, int bits)
+{
+    uint64_t acc = 0;
+    int      first = bitoff >> 3;
+    int      last  = (bitoff + bits - 1) >> 3;
+    int      i;
+
+    if (bits <= 0)
+    {
+        return 0;
+    }
+    for (i = first ; i <= last ; i++)
+    {
+        acc = (acc << 8) | buf[i];
+    }
+    acc >>= 7 - ((bitoff + bits - 1) & 7);
+    return (uint32_t)(acc & ((1ULL << bits) - 1));
+}
+
+// Reads a little endian IEEE float
+static double get_f32(const uint8_t * buf, int byteoff)
+{
+    uint32_t raw = (uint32_t)buf[byteoff]
+                 | ((uint32_t)buf[byteoff+1] << 8)
+                 | ((uint32_t)buf[byteoff+2] << 16)
+                 | ((uint32_t)buf[byteoff+3] << 24);
+    float f;
+    memcpy(&f,&raw,sizeof(f));
+    return f;
+}
+
+// Checks the float fields of a raw page against the range their encoding can
+// represent, for telling page boundaries apart from random bytes. Returns the
+// number of float fields in range and sets *n_fields to the number checked.
+int telem_page_plausible(int page, const uint8_t * payload, int * n_fields)
+{
+    int    i;
+    int    n;
+    int    ok = 0;
+    double value;
+    double lo;
+    double hi;
+
+    *n_fields = 0;
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        if ((g_field_page[i] != page) || (g_field_kind[i] != FIELD_F32))
+        {
+            continue;
+        }
+        lo = -g_field_bias[i] / g_field_scale[i];
+        hi = ((double)((1UL << g_field_bits[i]) - 1) - g_field_bias[i]) / g_field_scale[i];
+        for (n = 0 ; n < g_field_count[i] ; n++)
+        {
+            value = get_f32(payload,(g_field_bitoff[i] + n * g_field_stride[i]) >> 3);
+            (*n_fields)++;
+            ok += (value >= lo) && (value <= hi);
+        }
+    }
+    return ok;
+}
+
+// Decodes the payload of a frame, calling cb once per signal on the page
+// Returns the number of samples produced, or -1 if the frame is unknown or
+// its length does not match the schema. Stale frames produce no samples.
+int telem_decode_frame(const telem_frame_t * f, int64_t source_ms, telem_sample_cb_t cb, void * ctx)
+{
+    int page;
+    int i;
+    int n;
+    int bitoff;
+    int encpos = 0;
+    int samples = 0;
+    double value;
+
+    telem_schema_init();
+    page = telem_page_index(f->id);
+    if (page < 0)
+    {
+        return -1;
+    }
+    if (f->flags & TELEM_FLAG_STALE)
+    {
+        return 0;
+    }
+    if (f->len != ((f->flags & TELEM_FLAG_ENCODED) ? g_enc_len[page] : g_telem_len[page]))
+    {
+        return -1;
+    }
+
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        if (g_field_page[i] != page)
+        {
+            continue;
+        }
+        bitoff = g_field_bitoff[i];
+        for (n = 0 ; n < g_field_count[i] ; n++)
+        {
+            if (f->flags & TELEM_FLAG_ENCODED)
+            {
+                value = ((double)get_bits(f->payload,encpos,g_field_bits[i]) - g_field_bias[i]) / g_field_scale[i];
+                encpos += g_field_bits[i];
+            }
+            else if (g_field_kind[i] == FIELD_F32)
+            {
+                value = get_f32(f->payload,bitoff >> 3);
+            }
+            else
+            {
+                value = (double)get_bits(f->payload,bitoff,g_field_bits[i]);
+            }
+            cb(g_field_signal[i] + n,source_ms,value,ctx);
+            bitoff += g_field_stride[i];
+            samples++;
+        }
+    }
+    return samples;
+}
+
+// Decodes a CAN packet from a bus log (e.g. candump) into the signals it
+// carries, using the page layout the transmitter copies it into. Only the
+// fields that lie entirely inside the packet are produced. Returns the number
+// of samples, or -1 if the ID is not in CAN_ID_TABLE.
+int telem_decode_can(uint16_t can_id, const uint8_t * data, int len, int64_t time_ms, telem_sample_cb_t cb, void * ctx)
+{
+    int c;
+    int i;
+    int n;
+    int bit0;
+    int bit1;
+    int bitoff;
+    int bits;
+    int samples = 0;
+    double value;
+
+    telem_schema_init();
+    for (c = 0 ; (c < N_CAN_ID) && (g_can_id[c] != can_id) ; c++)
+    {
+    }
+    if (c == N_CAN_ID)
+    {
+        return -1;
+    }
+    if (len > g_can_len[c])
+    {
+        len = g_can_len[c];
+    }
+    bit0 = g_can_offset[c] * 8;
+    bit1 = bit0 + len * 8;
+
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        if (g_field_page[i] != g_can_page[c])
+        {
+            continue;
+        }
+        bits = (g_field_kind[i] == FIELD_F32) ? 32 : g_field_bits[i];
+        for (n = 0 ; n < g_field_count[i] ; n++)
+        {
+            bitoff = g_field_bitoff[i] + n * g_field_stride[i];
+            if ((bitoff < bit0) || (bitoff + bits > bit1))
+            {
+                continue;
+            }
+            if (g_field_kind[i] == FIELD_F32)
+            {
+                value = get_f32(data,(bitoff - bit0) >> 3);
+            }
+            else
+            {
+                value = (double)get_bits(data,bitoff - bit0,bits);
+            }
+            cb(g_field_signal[i] + n,time_ms,value,ctx);
+            samples++;
+        }
+    }
+    return samples;
+}
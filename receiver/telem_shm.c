@@ -0,0 +1,220 @@
+// Spitfire telemetry receiver, shared memory interface
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Publishes the newest value of every signal and a history ring in a POSIX
+// shared memory segment, see telem_shm.h for the layout and protocol
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "telem_shm.h"
+
+// Creates (or replaces) the segment for the given signal names, names[i] is
+// the name of signal index i. Returns 0, or -1 if the segment could not be
+// created
+int telem_shm_create(telem_shm_t * s, const char * name, const char * const * names, int n_signals)
+{
+    int fd;
+    int i;
+
+    memset(s,0,sizeof(*s));
+    snprintf(s->name,sizeof(s->name),"%s",name);
+    shm_unlink(name);
+    fd = shm_open(name,O_RDWR | O_CREAT | O_EXCL,0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (ftruncate(fd,sizeof(telem_shm_layout_t)) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    s->shm = mmap(NULL,sizeof(telem_shm_layout_t),PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (s->shm == MAP_FAILED)
+    {
+        s->shm = NULL;
+        shm_unlink(name);
+        return -1;
+    }
+    s->writable = 1;
+
+    s->shm->version   = TELEM_SHM_VERSION;
+    s->shm->ring_len  = TELEM_SHM_RING_LEN;
+    s->shm->n_signals = (uint32_t)((n_signals < TELEM_SHM_SIGNALS) ? n_signals : TELEM_SHM_SIGNALS);
+    for (i = 0 ; i < (int)s->shm->n_signals ; i++)
+    {
+        snprintf(s->shm->names[i],TELEM_SHM_NAME_LEN,"%s",names[i]);
+    }
+
+    // Readers check the magic last, the layout is complete once it is set
+    __atomic_store_n(&s->shm->magic,TELEM_SHM_MAGIC,__ATOMIC_RELEASE);
+    return 0;
+}
+
+// Maps an existing segment read-only
+// Returns 0, or -1 if there is no segment or it is not one this code knows
+int telem_shm_open(telem_shm_t * s, const char * name)
+{
+    int fd;
+
+    memset(s,0,sizeof(*s));
+    snprintf(s->name,sizeof(s->name),"%s",name);
+    fd = shm_open(name,O_RDONLY,0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    s->shm = mmap(NULL,sizeof(telem_shm_layout_t),PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (s->shm == MAP_FAILED)
+    {
+        s->shm = NULL;
+        return -1;
+    }
+    if ((__atomic_load_n(&s->shm->magic,__ATOMIC_ACQUIRE) != TELEM_SHM_MAGIC)
+        || (s->shm->version != TELEM_SHM_VERSION) || (s->shm->ring_len != TELEM_SHM_RING_LEN))
+    {
+        telem_shm_close(s);
+        return -1;
+    }
+    return 0;
+}
+
+// Unmaps the segment, the writer also removes it
+void telem_shm_close(telem_shm_t * s)
+{
+    if (s->shm != NULL)
+    {
+        munmap(s->shm,sizeof(telem_shm_layout_t));
+        s->shm = NULL;
+    }
+    if (s->writable)
+    {
+        shm_unlink(s->name);
+        s->writable = 0;
+    }
+}
+
+// Writer side, updates the newest value of a signal and appends the sample
+// to the history ring
+void telem_shm_write(telem_shm_t * s, int signal, int64_t time_ms, double value)
+{
+    telem_shm_layout_t * shm = s->shm;
+    telem_shm_latest_t * l;
+    telem_shm_slot_t *   slot;
+    uint64_t             head;
+
+    if ((signal < 0) || (signal >= TELEM_SHM_SIGNALS))
+    {
+        return;
+    }
+    l = &shm->latest[signal];
+    __atomic_store_n(&l->seq,l->seq + 1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    l->time_ms = time_ms;
+    l->value   = value;
+    __atomic_store_n(&l->seq,l->seq + 1,__ATOMIC_RELEASE);
+
+    head = shm->head;
+    slot = &shm->ring[head & (TELEM_SHM_RING_LEN - 1)];
+    __atomic_store_n(&slot->seq,2 * head + 1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->time_ms = time_ms;
+    slot->value   = value;
+    slot->signal  = signal;
+    __atomic_store_n(&slot->seq,2 * head + 2,__ATOMIC_RELEASE);
+    __atomic_store_n(&shm->head,head + 1,__ATOMIC_RELEASE);
+}
+
+// Returns the index of a signal name, or -1 if there is no such signal
+int telem_shm_lookup(const telem_shm_t * s, const char * name)
+{
+    int i;
+
+    for (i = 0 ; i < (int)s->shm->n_signals ; i++)
+    {
+        if (strncmp(s->shm->names[i],name,TELEM_SHM_NAME_LEN) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Reads the newest value of a signal
+// Returns 1, or 0 if the signal has never been written
+int telem_shm_latest(const telem_shm_t * s, int signal, int64_t * time_ms, double * value)
+{
+    const telem_shm_latest_t * l;
+    uint32_t                   seq;
+
+    if ((signal < 0) || (signal >= TELEM_SHM_SIGNALS))
+    {
+        return 0;
+    }
+    l = &s->shm->latest[signal];
+    do
+    {
+        do
+        {
+            seq = __atomic_load_n(&l->seq,__ATOMIC_ACQUIRE);
+        } while (seq & 1);
+        *time_ms = l->time_ms;
+        *value   = l->value;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&l->seq,__ATOMIC_RELAXED) != seq);
+    return seq != 0;
+}
+
+// Starts a cursor at the newest sample, only samples written from now on are
+// read
+void telem_shm_cursor_init(const telem_shm_t * s, telem_shm_cursor_t * c)
+{
+    c->next   = __atomic_load_n(&s->shm->head,__ATOMIC_ACQUIRE);
+    c->n_lost = 0;
+}
+
+// Reads the next sample of the history ring
+// Returns 1, or 0 if the reader has caught up with the writer. Samples the
+// writer overwrote before they could be read are skipped and counted.
+int telem_shm_next(const telem_shm_t * s, telem_shm_cursor_t * c, telem_shm_sample_t * out)
+{
+    const telem_shm_slot_t * slot;
+    uint64_t                 head;
+    uint64_t                 seq;
+
+    for (;;)
+    {
+        head = __atomic_load_n(&s->shm->head,__ATOMIC_ACQUIRE);
+        if (c->next >= head)
+        {
+            return 0;
+        }
+        if (head - c->next > TELEM_SHM_RING_LEN)
+        {
+            c->n_lost += head - c->next - TELEM_SHM_RING_LEN;
+            c->next    = head - TELEM_SHM_RING_LEN;
+        }
+
+        slot = &s->shm->ring[c->next & (TELEM_SHM_RING_LEN - 1)];
+        seq  = __atomic_load_n(&slot->seq,__ATOMIC_ACQUIRE);
+        out->time_ms = slot->time_ms;
+        out->value   = slot->value;
+        out->signal  = slot->signal;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq == 2 * c->next + 2) && (__atomic_load_n(&slot->seq,__ATOMIC_RELAXED) == seq))
+        {
+            c->next++;
+            return 1;
+        }
+
+        // Lapped while reading this slot
+        c->n_lost++;
+        c->next++;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef TELEM_SHM_H
+#define TELEM_SHM_H
+
+// Spitfire telemetry receiver, shared memory interface
+// The ground station daemon keeps the newest value of every signal and a
+// history ring of every sample in a POSIX shared memory segment. Local tools
+// map the segment read-only and read it without any syscalls or locks.
+//
+// There is a single writer. Every latest value and every ring slot is guarded
+// by its own sequence counter. The writer makes the counter odd, writes the
+// data, then makes it even again. A reader copies the data out between two
+// reads of the counter and retries or skips the entry if the counter was odd
+// or changed. A ring slot's counter also encodes which sample it holds, so a
+// reader that has been lapped by the writer can tell and count the samples it
+// lost.
+
+#include <stdint.h>
+
+#define TELEM_SHM_NAME        "/spitfire_telem"
+#define TELEM_SHM_MAGIC       0x54454C4D    // "TELM"
+#define TELEM_SHM_VERSION     1
+#define TELEM_SHM_RING_LEN    65536         // Samples of history, a power of 2
+#define TELEM_SHM_SIGNALS     256           // Same as TELEM_MAX_SIGNALS
+#define TELEM_SHM_NAME_LEN    32
+
+// Newest value of one signal
+typedef struct
+{
+    volatile uint32_t seq;                  // Odd while being written
+    uint32_t          pad;
+    int64_t           time_ms;
+    double            value;
+} telem_shm_latest_t;
+
+// One sample of the history ring
+typedef struct
+{
+    volatile uint64_t seq;                  // 2 * index + 2 once sample index is written
+    int64_t           time_ms;
+    double            value;
+    int32_t           signal;
+    int32_t           pad;
+} telem_shm_slot_t;
+
+// Segment layout
+typedef struct
+{
+    uint32_t           magic;
+    uint32_t           version;
+    uint32_t           n_signals;
+    uint32_t           ring_len;
+    char               names[TELEM_SHM_SIGNALS][TELEM_SHM_NAME_LEN];
+    volatile uint64_t  head;                // Samples written since the segment was created
+    telem_shm_latest_t latest[TELEM_SHM_SIGNALS];
+    telem_shm_slot_t   ring[TELEM_SHM_RING_LEN];
+} telem_shm_layout_t;
+
+typedef struct
+{
+    telem_shm_layout_t * shm;
+    int                  writable;
+    char                 name[64];
+} telem_shm_t;
+
+// A reader's position in the history ring
+typedef struct
+{
+    uint64_t next;                          // Index of the next sample to read
+    uint64_t n_lost;                        // Samples overwritten before they were read
+} telem_shm_cursor_t;
+
+typedef struct
+{
+    int64_t time_ms;
+    int32_t signal;
+    double  value;
+} telem_shm_sample_t;
+
+int  telem_shm_create(telem_shm_t * s, const char * name, const char * const * names, int n_signals);
+int  telem_shm_open(telem_shm_t * s, const char * name);
+void telem_shm_close(telem_shm_t * s);
+void telem_shm_write(telem_shm_t * s, int signal, int64_t time_ms, double value);
+
+int  telem_shm_lookup(const telem_shm_t * s, const char * name);
+int  telem_shm_latest(const telem_shm_t * s, int signal, int64_t * time_ms, double * value);
+void telem_shm_cursor_init(const telem_shm_t * s, telem_shm_cursor_t * c);
+int  telem_shm_next(const telem_shm_t * s, telem_shm_cursor_t * c, telem_shm_sample_t * out);
+
+#endif
@@ -0,0 +1,795 @@
+// Spitfire telemetry receiver, time series store
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Block indexed in-memory columns with rollup tiers, range scans, aggregates,
+// downsampling, integrals and as-of joins, see telem_store.h
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telem_store.h"
+
+// Bucket widths of the rollup tiers, finest first
+static const int64_t g_tier_ms[TELEM_ROLLUP_TIERS] = {1000, 10000, 60000};
+
+// Position of a sample in a series
+typedef struct
+{
+    const telem_series_t * s;
+    int                    blk;
+    int                    i;
+} cursor_t;
+
+int telem_store_init(telem_store_t * s)
+{
+    memset(s,0,sizeof(*s));
+    return (pthread_rwlock_init(&s->lock,NULL) == 0) ? 0 : -1;
+}
+
+void telem_store_free(telem_store_t * s)
+{
+    int i;
+    int j;
+
+    for (i = 0 ; i < TELEM_MAX_SIGNALS ; i++)
+    {
+        for (j = 0 ; j < s->series[i].n_blocks ; j++)
+        {
+            free(s->series[i].blocks[j]);
+        }
+        free(s->series[i].blocks);
+        for (j = 0 ; j < TELEM_ROLLUP_TIERS ; j++)
+        {
+            free(s->series[i].tiers[j].buckets);
+        }
+    }
+    pthread_rwlock_destroy(&s->lock);
+}
+
+static telem_block_t * new_block(telem_series_t * ser)
+{
+    telem_block_t ** blocks;
+    telem_block_t *  b;
+
+    if (ser->n_blocks >= ser->cap_blocks)
+    {
+        int cap = (ser->cap_blocks > 0) ? 2 * ser->cap_blocks : 16;
+        blocks = realloc(ser->blocks,cap * sizeof(*blocks));
+        if (blocks == NULL)
+        {
+            return NULL;
+        }
+        ser->blocks     = blocks;
+        ser->cap_blocks = cap;
+    }
+    b = malloc(sizeof(*b));
+    if (b != NULL)
+    {
+        b->count = 0;
+        b->sum   = 0;
+        b->area  = 0;
+        ser->blocks[ser->n_blocks++] = b;
+    }
+    return b;
+}
+
+static double trapezoid(int64_t t0, double v0, int64_t t1, double v1)
+{
+    return (t1 - t0) * 1e-3 * (v0 + v1) * 0.5;
+}
+
+// Recomputes the summary of a block after a sample was merged into it
+static void summarize_block(telem_block_t * b)
+{
+    int i;
+
+    b->t_min = b->time[0];
+    b->t_max = b->time[b->count - 1];
+    b->v_min = b->v_max = b->sum = b->value[0];
+    b->area  = 0;
+    for (i = 1 ; i < b->count ; i++)
+    {
+        b->v_min = fmin(b->v_min,b->value[i]);
+        b->v_max = fmax(b->v_max,b->value[i]);
+        b->sum  += b->value[i];
+        b->area += trapezoid(b->time[i - 1],b->value[i - 1],b->time[i],b->value[i]);
+    }
+}
+
+// Start of the bucket of width ms holding time t
+static int64_t bucket_start(int64_t t, int64_t ms)
+{
+    int64_t r = t % ms;
+    return (r < 0) ? t - r - ms : t - r;
+}
+
+// Adds a sample to a rollup tier. Samples nearly always land in the newest
+// bucket, a late one walks back to its bucket or inserts it.
+static void rollup_add(telem_tier_t * tier, int64_t ms, int64_t t, float v)
+{
+    int64_t          t0 = bucket_start(t,ms);
+    telem_rollup_t * r;
+    int              i;
+
+    for (i = tier->n ; (i > 0) && (tier->buckets[i - 1].t0 > t0) ; i--)
+    {
+    }
+    if ((i > 0) && (tier->buckets[i - 1].t0 == t0))
+    {
+        r = &tier->buckets[i - 1];
+        r->min  = fminf(r->min,v);
+        r->max  = fmaxf(r->max,v);
+        r->sum += v;
+        r->count++;
+        return;
+    }
+
+    if (tier->n >= tier->cap)
+    {
+        int cap = (tier->cap > 0) ? 2 * tier->cap : 64;
+        r = realloc(tier->buckets,cap * sizeof(*r));
+        if (r == NULL)
+        {
+            return;
+        }
+        tier->buckets = r;
+        tier->cap     = cap;
+    }
+    memmove(&tier->buckets[i + 1],&tier->buckets[i],(tier->n - i) * sizeof(*r));
+    tier->n++;
+    r = &tier->buckets[i];
+    r->t0    = t0;
+    r->min   = r->max = r->sum = v;
+    r->count = 1;
+}
+
+// Adds a sample with the write lock held, returns 1, or 0 if it was dropped
+static int store_add(telem_store_t * s, int signal, int64_t time_ms, double value)
+{
+    telem_series_t * ser;
+    telem_block_t *  b;
+    int              i;
+    int              ok = 1;
+
+    ser = &s->series[signal];
+    b   = (ser->n_blocks > 0) ? ser->blocks[ser->n_blocks - 1] : NULL;
+
+    if ((b != NULL) && (b->count > 0) && (time_ms < b->t_max))
+    {
+        // Late sample, merge it into the newest block if it still fits there
+        if ((time_ms < b->t_min) || (b->count >= TELEM_BLOCK_LEN))
+        {
+            ser->n_late++;
+            ok = 0;
+        }
+        else
+        {
+            for (i = b->count ; (i > 0) && (b->time[i - 1] > time_ms) ; i--)
+            {
+                b->time[i]  = b->time[i - 1];
+                b->value[i] = b->value[i - 1];
+            }
+            b->time[i]  = time_ms;
+            b->value[i] = (float)value;
+            b->count++;
+            summarize_block(b);
+        }
+    }
+    else
+    {
+        if ((b == NULL) || (b->count >= TELEM_BLOCK_LEN))
+        {
+            b = new_block(ser);
+        }
+        if (b == NULL)
+        {
+            ok = 0;
+        }
+        else if (b->count == 0)
+        {
+            b->t_min = b->t_max = time_ms;
+            b->v_min = b->v_max = b->sum = (float)value;
+            b->time[0]  = time_ms;
+            b->value[0] = (float)value;
+            b->count    = 1;
+        }
+        else
+        {
+            i = b->count++;
+            b->time[i]  = time_ms;
+            b->value[i] = (float)value;
+            b->t_max    = time_ms;
+            b->v_min    = fmin(b->v_min,b->value[i]);
+            b->v_max    = fmax(b->v_max,b->value[i]);
+            b->sum     += b->value[i];
+            b->area    += trapezoid(b->time[i - 1],b->value[i - 1],time_ms,b->value[i]);
+        }
+    }
+
+    if (ok)
+    {
+        for (i = 0 ; i < TELEM_ROLLUP_TIERS ; i++)
+        {
+            rollup_add(&ser->tiers[i],g_tier_ms[i],time_ms,(float)value);
+        }
+        s->n_samples++;
+        if (time_ms > s->t_latest)
+        {
+            s->t_latest = time_ms;
+        }
+    }
+    return ok;
+}
+
+// Adds a sample, returns 1, or 0 if it was dropped
+int telem_store_add(telem_store_t * s, int signal, int64_t time_ms, double value)
+{
+    int ok;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_wrlock(&s->lock);
+    ok = store_add(s,signal,time_ms,value);
+    pthread_rwlock_unlock(&s->lock);
+    return ok;
+}
+
+// Adds n time ordered samples of one signal under a single lock
+// Returns the number added
+size_t telem_store_add_column(telem_store_t * s, int signal, const int64_t * time_ms, const double * value, size_t n)
+{
+    size_t i;
+    size_t added = 0;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_wrlock(&s->lock);
+    for (i = 0 ; i < n ; i++)
+    {
+        added += store_add(s,signal,time_ms[i],value[i]);
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return added;
+}
+
+// Loads a "time_ms,signal,value" CSV as written by telemd
+// Returns the number of samples loaded, or -1 if the file cannot be read
+int telem_store_load_csv(telem_store_t * s, const char * path)
+{
+    FILE * fp = fopen(path,"r");
+    char   line[256];
+    char * name;
+    char * end;
+    int    n = 0;
+    int    signal;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    while (fgets(line,sizeof(line),fp) != NULL)
+    {
+        int64_t t = strtoll(line,&end,10);
+        if ((end == line) || (*end != ','))
+        {
+            continue;                       // Header or garbage
+        }
+        name = end + 1;
+        end  = strchr(name,',');
+        if (end == NULL)
+        {
+            continue;
+        }
+        *end = '\0';
+        signal = telem_signal_lookup(name);
+        if (signal >= 0)
+        {
+            n += telem_store_add(s,signal,t,strtod(end + 1,NULL));
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+int64_t telem_store_latest_time(telem_store_t * s)
+{
+    int64_t t;
+
+    pthread_rwlock_rdlock(&s->lock);
+    t = s->t_latest;
+    pthread_rwlock_unlock(&s->lock);
+    return t;
+}
+
+// Points c at the first sample at or after t
+static void cursor_seek(cursor_t * c, const telem_series_t * ser, int64_t t)
+{
+    int lo = 0;
+    int hi = ser->n_blocks;
+    const telem_block_t * b;
+
+    c->s = ser;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (ser->blocks[mid]->t_max < t)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    c->blk = lo;
+    c->i   = 0;
+    if (lo < ser->n_blocks)
+    {
+        b  = ser->blocks[lo];
+        hi = b->count;
+        while (c->i < hi)
+        {
+            int mid = (c->i + hi) / 2;
+            if (b->time[mid] < t)
+            {
+                c->i = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+    }
+}
+
+static int cursor_valid(const cursor_t * c)
+{
+    return c->blk < c->s->n_blocks;
+}
+
+static const telem_block_t * cursor_block(const cursor_t * c)
+{
+    return c->s->blocks[c->blk];
+}
+
+static int64_t cursor_time(const cursor_t * c)
+{
+    return cursor_block(c)->time[c->i];
+}
+
+static double cursor_value(const cursor_t * c)
+{
+    return cursor_block(c)->value[c->i];
+}
+
+static void cursor_next(cursor_t * c)
+{
+    if (++c->i >= cursor_block(c)->count)
+    {
+        c->blk++;
+        c->i = 0;
+    }
+}
+
+// True if the rest of the cursor's block lies inside the window and it can be
+// answered from the block summary
+static int cursor_whole_block(const cursor_t * c, int64_t t0, int64_t t1)
+{
+    const telem_block_t * b = cursor_block(c);
+    return (c->i == 0) && (b->t_min >= t0) && (b->t_max < t1);
+}
+
+static void agg_init(telem_agg_t * a, int64_t t0, int64_t t1)
+{
+    a->t0    = t0;
+    a->t1    = t1;
+    a->min   = INFINITY;
+    a->max   = -INFINITY;
+    a->sum   = 0;
+    a->count = 0;
+}
+
+static void agg_sample(telem_agg_t * a, double v)
+{
+    a->min = fmin(a->min,v);
+    a->max = fmax(a->max,v);
+    a->sum += v;
+    a->count++;
+}
+
+static void agg_block(telem_agg_t * a, const telem_block_t * b)
+{
+    a->min = fmin(a->min,b->v_min);
+    a->max = fmax(a->max,b->v_max);
+    a->sum += b->sum;
+    a->count += b->count;
+}
+
+static void agg_rollup(telem_agg_t * a, const telem_rollup_t * r)
+{
+    a->min = fmin(a->min,r->min);
+    a->max = fmax(a->max,r->max);
+    a->sum += r->sum;
+    a->count += r->count;
+}
+
+// Adds the raw samples in [from, to) to the buckets of width bucket_ms
+// starting at t0
+static void agg_samples(const telem_series_t * ser, int64_t from, int64_t to, int64_t t0, int64_t bucket_ms, telem_agg_t * out)
+{
+    cursor_t c;
+
+    for (cursor_seek(&c,ser,from) ; cursor_valid(&c) && (cursor_time(&c) < to) ; cursor_next(&c))
+    {
+        agg_sample(&out[(cursor_time(&c) - t0) / bucket_ms],cursor_value(&c));
+    }
+}
+
+// Downsamples [t0, end) from a rollup tier. A tier bucket that lies inside
+// one output bucket is merged whole, one that straddles an output bucket or
+// the window edge is filled in from the samples it covers.
+static void downsample_tier(const telem_series_t * ser, int tier, int64_t t0, int64_t end, int64_t bucket_ms, telem_agg_t * out)
+{
+    const telem_tier_t *   rt = &ser->tiers[tier];
+    const telem_rollup_t * r;
+    int64_t                ms = g_tier_ms[tier];
+    int64_t                r1;
+    int                    lo = 0;
+    int                    hi = rt->n;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (rt->buckets[mid].t0 + ms <= t0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    for ( ; (lo < rt->n) && (rt->buckets[lo].t0 < end) ; lo++)
+    {
+        r  = &rt->buckets[lo];
+        r1 = r->t0 + ms;
+        if ((r->t0 >= t0) && (r1 <= end) && ((r->t0 - t0) / bucket_ms == (r1 - 1 - t0) / bucket_ms))
+        {
+            agg_rollup(&out[(r->t0 - t0) / bucket_ms],r);
+        }
+        else
+        {
+            agg_samples(ser,(r->t0 > t0) ? r->t0 : t0,(r1 < end) ? r1 : end,t0,bucket_ms,out);
+        }
+    }
+}
+
+// Calls cb for every sample in [t0, t1), returns the number of samples
+int telem_store_scan(telem_store_t * s, int signal, int64_t t0, int64_t t1, telem_scan_cb_t cb, void * ctx)
+{
+    cursor_t c;
+    int      n = 0;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&s->lock);
+    for (cursor_seek(&c,&s->series[signal],t0) ; cursor_valid(&c) && (cursor_time(&c) < t1) ; cursor_next(&c))
+    {
+        cb(cursor_time(&c),cursor_value(&c),ctx);
+        n++;
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return n;
+}
+
+// Summarizes the samples in [t0, t1), returns 1, or 0 if there are none
+int telem_store_aggregate(telem_store_t * s, int signal, int64_t t0, int64_t t1, telem_agg_t * out)
+{
+    cursor_t c;
+
+    agg_init(out,t0,t1);
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&s->lock);
+    cursor_seek(&c,&s->series[signal],t0);
+    while (cursor_valid(&c) && (cursor_time(&c) < t1))
+    {
+        if (cursor_whole_block(&c,t0,t1))
+        {
+            agg_block(out,cursor_block(&c));
+            c.blk++;
+        }
+        else
+        {
+            agg_sample(out,cursor_value(&c));
+            cursor_next(&c);
+        }
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return out->count > 0;
+}
+
+// Summarizes [t0, t1) in buckets of bucket_ms, out[k] covers
+// t0 + k * bucket_ms and the last bucket stops at t1. Returns the number of
+// buckets filled in, at most max, empty buckets have a count of 0. Buckets of
+// a second or more are built from the coarsest rollup tier no wider than the
+// bucket.
+int telem_store_downsample(telem_store_t * s, int signal, int64_t t0, int64_t t1, int64_t bucket_ms, telem_agg_t * out, int max)
+{
+    cursor_t              c;
+    const telem_block_t * b;
+    int64_t               n;
+    int64_t               k;
+    int64_t               end;
+    int                   tier = -1;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS) || (bucket_ms <= 0) || (t1 <= t0))
+    {
+        return 0;
+    }
+    n = (t1 - t0 + bucket_ms - 1) / bucket_ms;
+    if (n > max)
+    {
+        n = max;
+    }
+    for (k = 0 ; k < n ; k++)
+    {
+        agg_init(&out[k],t0 + k * bucket_ms,t0 + (k + 1) * bucket_ms);
+    }
+    // The last bucket stops at t1 when the window is not a whole number of
+    // buckets
+    end = t0 + n * bucket_ms;
+    if (end > t1)
+    {
+        end = t1;
+        out[n - 1].t1 = t1;
+    }
+    for (k = 0 ; k < TELEM_ROLLUP_TIERS ; k++)
+    {
+        if (g_tier_ms[k] <= bucket_ms)
+        {
+            tier = (int)k;
+        }
+    }
+
+    pthread_rwlock_rdlock(&s->lock);
+    if (tier >= 0)
+    {
+        downsample_tier(&s->series[signal],tier,t0,end,bucket_ms,out);
+        pthread_rwlock_unlock(&s->lock);
+        return (int)n;
+    }
+    cursor_seek(&c,&s->series[signal],t0);
+    while (cursor_valid(&c) && (cursor_time(&c) < end))
+    {
+        b = cursor_block(&c);
+        k = (cursor_time(&c) - t0) / bucket_ms;
+        if (cursor_whole_block(&c,t0,end) && ((b->t_max - t0) / bucket_ms == k))
+        {
+            agg_block(&out[k],b);
+            c.blk++;
+        }
+        else
+        {
+            agg_sample(&out[k],cursor_value(&c));
+            cursor_next(&c);
+        }
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return (int)n;
+}
+
+// Trapezoid integral of the samples in [t0, t1), in value-seconds
+double telem_store_integrate(telem_store_t * s, int signal, int64_t t0, int64_t t1)
+{
+    cursor_t              c;
+    const telem_block_t * b;
+    double                area = 0;
+    int64_t               t_prev = 0;
+    double                v_prev = 0;
+    int                   b_prev = 0;
+
+    if ((signal < 0) || (signal >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&s->lock);
+    cursor_seek(&c,&s->series[signal],t0);
+    while (cursor_valid(&c) && (cursor_time(&c) < t1))
+    {
+        if (b_prev)
+        {
+            area += trapezoid(t_prev,v_prev,cursor_time(&c),cursor_value(&c));
+        }
+        if (cursor_whole_block(&c,t0,t1))
+        {
+            b = cursor_block(&c);
+            area  += b->area;
+            t_prev = b->time[b->count - 1];
+            v_prev = b->value[b->count - 1];
+            c.blk++;
+        }
+        else
+        {
+            t_prev = cursor_time(&c);
+            v_prev = cursor_value(&c);
+            cursor_next(&c);
+        }
+        b_prev = 1;
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return area;
+}
+
+// As-of join, calls cb for every sample of a in [t0, t1) with the newest
+// sample of b at or before it, if that is no more than tolerance_ms older.
+// Returns the number of pairs.
+int telem_store_join(telem_store_t * s, int a, int b, int64_t t0, int64_t t1, int64_t tolerance_ms, telem_join_cb_t cb, void * ctx)
+{
+    cursor_t ca;
+    cursor_t cb_cur;
+    int64_t  tb = 0;
+    double   vb = 0;
+    int      b_have = 0;
+    int      n = 0;
+
+    if ((a < 0) || (a >= TELEM_MAX_SIGNALS) || (b < 0) || (b >= TELEM_MAX_SIGNALS))
+    {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&s->lock);
+    cursor_seek(&ca,&s->series[a],t0);
+    cursor_seek(&cb_cur,&s->series[b],t0 - tolerance_ms);
+    for ( ; cursor_valid(&ca) && (cursor_time(&ca) < t1) ; cursor_next(&ca))
+    {
+        while (cursor_valid(&cb_cur) && (cursor_time(&cb_cur) <= cursor_time(&ca)))
+        {
+            tb     = cursor_time(&cb_cur);
+            vb     = cursor_value(&cb_cur);
+            b_have = 1;
+            cursor_next(&cb_cur);
+        }
+        if (b_have && (cursor_time(&ca) - tb <= tolerance_ms))
+        {
+            cb(cursor_time(&ca),cursor_value(&ca),vb,ctx);
+            n++;
+        }
+    }
+    pthread_rwlock_unlock(&s->lock);
+    return n;
+}
+
+// Text query output
+typedef struct
+{
+    telem_write_cb_t write;
+    void *           ctx;
+} query_out_t;
+
+static void query_printf(query_out_t * q, const char * fmt, ...)
+{
+    char    line[160];
+    int     n;
+    va_list ap;
+
+    va_start(ap,fmt);
+    n = vsnprintf(line,sizeof(line),fmt,ap);
+    va_end(ap);
+    if (n >= (int)sizeof(line))
+    {
+        n = sizeof(line) - 1;
+    }
+    q->write(line,n,q->ctx);
+}
+
+static void query_scan_cb(int64_t time_ms, double value, void * ctx)
+{
+    query_printf((query_out_t *)ctx,"# %lld %.6g\n",(long long)time_ms,value);
+}
+
+static void query_join_cb(int64_t time_ms, double a, double b, void * ctx)
+{
+    query_printf((query_out_t *)ctx,"# %lld %.6g %.6g\n",(long long)time_ms,a,b);
+}
+
+// Runs a text query, see telem_store.h. Returns 0, or -1 if the query was not
+// understood, in which case a "# ?" line is written.
+int telem_store_query(telem_store_t * s, const char * query, telem_write_cb_t write, void * ctx)
+{
+    char        buf[160];
+    char *      arg[8];
+    int         n = 0;
+    int         i;
+    int         sig;
+    int         sig_b = -1;
+    int         first = 2;
+    int64_t     latest = telem_store_latest_time(s);
+    int64_t     t0;
+    int64_t     t1;
+    telem_agg_t agg;
+    telem_agg_t * buckets;
+    int64_t     bucket_ms;
+    query_out_t q;
+
+    q.write = write;
+    q.ctx   = ctx;
+    snprintf(buf,sizeof(buf),"%s",query);
+    for (arg[n] = strtok(buf," \t\r\n") ; (arg[n] != NULL) && (n < 7) ; arg[n] = strtok(NULL," \t\r\n"))
+    {
+        n++;
+    }
+    if ((n >= 3) && (strcmp(arg[0],"JOIN") == 0))
+    {
+        sig_b = telem_signal_lookup(arg[2]);
+        first = 3;
+    }
+    if ((n < first + 1) || ((sig = telem_signal_lookup(arg[1])) < 0) || ((first == 3) && (sig_b < 0)))
+    {
+        query_printf(&q,"# ?\n");
+        return -1;
+    }
+    t0 = strtoll(arg[first],NULL,10);
+    if (t0 < 0)
+    {
+        t0 += latest;
+    }
+    t1 = (n > first + 1) ? strtoll(arg[first + 1],NULL,10) : latest + 1;
+
+    if (strcmp(arg[0],"AGG") == 0)
+    {
+        telem_store_aggregate(s,sig,t0,t1,&agg);
+        query_printf(&q,"# %u %.6g %.6g %.6g\n",agg.count,agg.count ? agg.min : 0,
+                     agg.count ? agg.max : 0,agg.count ? agg.sum / agg.count : 0);
+    }
+    else if (strcmp(arg[0],"INTEG") == 0)
+    {
+        query_printf(&q,"# %.6g\n",telem_store_integrate(s,sig,t0,t1));
+    }
+    else if ((strcmp(arg[0],"DOWN") == 0) && (n == 5))
+    {
+        buckets = malloc(TELEM_QUERY_MAX_BUCKETS * sizeof(*buckets));
+        if (buckets == NULL)
+        {
+            return -1;
+        }
+        bucket_ms = strtoll(arg[4],NULL,10);
+        if (bucket_ms == 0)
+        {
+            bucket_ms = (t1 - t0 + TELEM_QUERY_PLOT_POINTS - 1) / TELEM_QUERY_PLOT_POINTS;
+        }
+        n = telem_store_downsample(s,sig,t0,t1,bucket_ms,buckets,TELEM_QUERY_MAX_BUCKETS);
+        for (i = 0 ; i < n ; i++)
+        {
+            if (buckets[i].count > 0)
+            {
+                query_printf(&q,"# %lld %u %.6g %.6g %.6g\n",(long long)buckets[i].t0,buckets[i].count,
+                             buckets[i].min,buckets[i].max,buckets[i].sum / buckets[i].count);
+            }
+        }
+        free(buckets);
+    }
+    else if (strcmp(arg[0],"JOIN") == 0)
+    {
+        telem_store_join(s,sig,sig_b,t0,t1,(n > 5) ? strtoll(arg[5],NULL,10) : 1000,query_join_cb,&q);
+    }
+    else if (strcmp(arg[0],"SCAN") == 0)
+    {
+        telem_store_scan(s,sig,t0,t1,query_scan_cb,&q);
+    }
+    else
+    {
+        query_printf(&q,"# ?\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef TELEM_STORE_H
+#define TELEM_STORE_H
+
+// Spitfire telemetry receiver, time series store
+// Keeps every sample of every signal in memory as time ordered columns split
+// into fixed size blocks. Each block carries a summary (time range, min, max,
+// sum and trapezoid area) so range queries only touch the samples of the
+// blocks at the edges of the window and read the summaries of the rest.
+// Samples that arrive late (retransmissions) are merged into the newest
+// block, anything older than that is counted and dropped.
+//
+// Every series also keeps rollup tiers of 1 s, 10 s and 1 min buckets that
+// are updated as samples are added. Downsampling to buckets of a second or
+// more reads the coarsest tier that fits instead of the samples, so a plot of
+// a whole race day costs a few thousand reads however fast the signal is.
+//
+// Times are transmitter source times in ms, integrals are in value-seconds
+// (W -> J, divide by 3600 for Wh).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "telem_rx.h"
+
+#define TELEM_BLOCK_LEN    1024 // Samples per block
+#define TELEM_ROLLUP_TIERS 3    // 1 s, 10 s and 1 min
+
+typedef struct
+{
+    int64_t t_min;
+    int64_t t_max;
+    double  v_min;
+    double  v_max;
+    double  sum;
+    double  area;                           // Trapezoid integral across the block's samples
+    int     count;
+    int64_t time[TELEM_BLOCK_LEN];
+    float   value[TELEM_BLOCK_LEN];
+} telem_block_t;
+
+// One bucket of a rollup tier, only buckets holding samples are kept
+typedef struct
+{
+    int64_t  t0;                            // Bucket start, a multiple of the tier's width
+    float    min;
+    float    max;
+    double   sum;
+    uint32_t count;
+} telem_rollup_t;
+
+typedef struct
+{
+    telem_rollup_t * buckets;               // Ordered by start time
+    int              n;
+    int              cap;
+} telem_tier_t;
+
+typedef struct
+{
+    telem_block_t ** blocks;
+    int              n_blocks;
+    int              cap_blocks;
+    uint32_t         n_late;                // Samples too old to merge
+    telem_tier_t     tiers[TELEM_ROLLUP_TIERS];
+} telem_series_t;
+
+typedef struct telem_store_s
+{
+    telem_series_t   series[TELEM_MAX_SIGNALS];
+    pthread_rwlock_t lock;                  // Writers are the ingest, readers the queries
+    uint64_t         n_samples;
+    int64_t          t_latest;              // Newest sample time of any signal
+} telem_store_t;
+
+// Summary of the samples in a time window
+typedef struct
+{
+    int64_t  t0;                            // Window start, inclusive
+    int64_t  t1;                            // Window end, exclusive
+    double   min;
+    double   max;
+    double   sum;
+    uint32_t count;                         // Mean is sum / count
+} telem_agg_t;
+
+typedef void (*telem_scan_cb_t)(int64_t time_ms, double value, void * ctx);
+typedef void (*telem_join_cb_t)(int64_t time_ms, double a, double b, void * ctx);
+typedef void (*telem_write_cb_t)(const char * text, int len, void * ctx);
+
+// Text queries, shared by the query tool and the live telemetry server.
+// Times are in ms, a negative t0 is relative to the newest sample and a
+// missing t1 means up to the newest sample. Every reply line starts with '#'.
+//
+//   AGG <signal> <t0> [t1]                 # count min max mean
+//   INTEG <signal> <t0> [t1]               # integral (value-seconds)
+//   DOWN <signal> <t0> <t1> <bucket_ms>    # t count min max mean, per bucket
+//                                          # a bucket_ms of 0 gives about
+//                                          # TELEM_QUERY_PLOT_POINTS buckets
+//   JOIN <a> <b> <t0> [t1] [tolerance_ms]  # t a b, per sample of a
+//   SCAN <signal> <t0> [t1]                # t value, per sample
+#define TELEM_QUERY_MAX_BUCKETS 10000
+#define TELEM_QUERY_PLOT_POINTS 2000
+
+int     telem_store_init(telem_store_t * s);
+void    telem_store_free(telem_store_t * s);
+int     telem_store_add(telem_store_t * s, int signal, int64_t time_ms, double value);
+size_t  telem_store_add_column(telem_store_t * s, int signal, const int64_t * time_ms, const double * value, size_t n);
+int     telem_store_load_csv(telem_store_t * s, const char * path);
+int64_t telem_store_latest_time(telem_store_t * s);
+
+int    telem_store_scan(telem_store_t * s, int signal, int64_t t0, int64_t t1, telem_scan_cb_t cb, void * ctx);
+int    telem_store_aggregate(telem_store_t * s, int signal, int64_t t0, int64_t t1, telem_agg_t * out);
+int    telem_store_downsample(telem_store_t * s, int signal, int64_t t0, int64_t t1, int64_t bucket_ms, telem_agg_t * out, int max);
+double telem_store_integrate(telem_store_t * s, int signal, int64_t t0, int64_t t1);
+int    telem_store_join(telem_store_t * s, int a, int b, int64_t t0, int64_t t1, int64_t tolerance_ms, telem_join_cb_t cb, void * ctx);
+int    telem_store_query(telem_store_t * s, const char * query, telem_write_cb_t write, void * ctx);
+
+#endif
@@ -0,0 +1,82 @@
+// Spitfire telemetry receiver, shared memory reader
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Follows the ground station daemon's shared memory segment and prints new
+// samples, or the newest value of the named signals with -l. Also serves as
+// an example of reading the segment, see telem_shm.h
+//
+// Usage: telem_tail [-l] [signal...]
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "telem_shm.h"
+
+#define TAIL_MAX_SELECT 64
+
+int main(int argc, char ** argv)
+{
+    telem_shm_t        shm;
+    telem_shm_cursor_t cursor;
+    telem_shm_sample_t sample;
+    struct timespec    ts = {0, 10000000};
+    int                select[TAIL_MAX_SELECT];
+    int                n_select = 0;
+    int                b_latest = 0;
+    int                i;
+    int64_t            time_ms;
+    double             value;
+
+    if (telem_shm_open(&shm,TELEM_SHM_NAME) != 0)
+    {
+        fprintf(stderr,"no telemetry segment %s, is telemd running?\n",TELEM_SHM_NAME);
+        return 1;
+    }
+    for (i = 1 ; i < argc ; i++)
+    {
+        if (strcmp(argv[i],"-l") == 0)
+        {
+            b_latest = 1;
+        }
+        else if (n_select < TAIL_MAX_SELECT)
+        {
+            select[n_select] = telem_shm_lookup(&shm,argv[i]);
+            if (select[n_select] < 0)
+            {
+                fprintf(stderr,"unknown signal %s\n",argv[i]);
+                return 1;
+            }
+            n_select++;
+        }
+    }
+
+    if (b_latest)
+    {
+        for (i = 0 ; i < n_select ; i++)
+        {
+            if (telem_shm_latest(&shm,select[i],&time_ms,&value))
+            {
+                printf("%lld,%s,%.6g\n",(long long)time_ms,shm.shm->names[select[i]],value);
+            }
+        }
+        telem_shm_close(&shm);
+        return 0;
+    }
+
+    telem_shm_cursor_init(&shm,&cursor);
+    for (;;)
+    {
+        while (telem_shm_next(&shm,&cursor,&sample))
+        {
+            for (i = 0 ; (i < n_select) && (select[i] != sample.signal) ; i++)
+            {
+            }
+            if ((n_select == 0) || (i < n_select))
+            {
+                printf("%lld,%s,%.6g\n",(long long)sample.time_ms,shm.shm->names[sample.signal],sample.value);
+            }
+        }
+        fflush(stdout);
+        nanosleep(&ts,NULL);
+    }
+}
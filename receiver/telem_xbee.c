@@ -0,0 +1,196 @@
+// Spitfire telemetry receiver, XBee API mode
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Unwraps the API frames of the ground station radio and wraps commands for
+// the transmitter in transmit requests, see transmitter/xbee_api.h
+
+#include <string.h>
+#include "telem_rx.h"
+
+// Reader states
+enum
+{
+    XBEE_RX_START,
+    XBEE_RX_LEN_HI,
+    XBEE_RX_LEN_LO,
+    XBEE_RX_DATA,
+    XBEE_RX_CHECKSUM
+};
+
+void telem_xbee_init(telem_xbee_t * x)
+{
+    memset(x,0,sizeof(*x));
+    x->state = XBEE_RX_START;
+}
+
+// Handles a complete API frame with a good checksum
+static void xbee_frame(telem_xbee_t * x, telem_parser_t * p, telem_frame_cb_t cb, void * ctx)
+{
+    switch (x->data[0])
+    {
+        case XBEE_RX_PACKET:
+            if (x->len > XBEE_RX_HEADER_LEN)
+            {
+                x->n_packets++;
+                memcpy(x->src64,&x->data[1],8);
+                x->src_valid = 1;
+                telem_parser_feed_buf(p,&x->data[XBEE_RX_HEADER_LEN],x->len - XBEE_RX_HEADER_LEN,cb,ctx);
+            }
+            break;
+        case XBEE_TX_STATUS:        // Frame ID, dest16, retries, delivery, discovery
+            if (x->len >= 6)
+            {
+                x->n_retries += x->data[4];
+                if (x->data[5] == XBEE_DELIVERY_OK)
+                {
+                    x->n_tx_ok++;
+                }
+                else
+                {
+                    x->n_tx_fail++;
+                }
+            }
+            break;
+        case XBEE_AT_RESPONSE:      // Frame ID, command, status, value
+            if ((x->len >= 6) && (x->data[2] == 'D') && (x->data[3] == 'B') && (x->data[4] == 0))
+            {
+                x->rssi = -(int)x->data[5];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Consumes one byte from the radio, frames found in received packets are
+// passed to cb through the frame parser
+void telem_xbee_feed(telem_xbee_t * x, telem_parser_t * p, uint8_t c, telem_frame_cb_t cb, void * ctx)
+{
+    if (c == XBEE_START)
+    {
+        // An unescaped start byte always begins a new frame
+        x->state = XBEE_RX_LEN_HI;
+        x->escape = 0;
+        return;
+    }
+    if (x->state == XBEE_RX_START)
+    {
+        return;
+    }
+    if (c == XBEE_ESCAPE)
+    {
+        x->escape = 1;
+        return;
+    }
+    if (x->escape)
+    {
+        c ^= XBEE_ESCAPE_XOR;
+        x->escape = 0;
+    }
+
+    switch (x->state)
+    {
+        case XBEE_RX_LEN_HI:
+            x->len = c << 8;
+            x->state = XBEE_RX_LEN_LO;
+            break;
+        case XBEE_RX_LEN_LO:
+            x->len |= c;
+            x->count = 0;
+            x->sum = 0;
+            x->state = ((x->len > 0) && (x->len <= TELEM_XBEE_MAX_DATA)) ? XBEE_RX_DATA : XBEE_RX_START;
+            break;
+        case XBEE_RX_DATA:
+            x->data[x->count++] = c;
+            x->sum += c;
+            if (x->count >= x->len)
+            {
+                x->state = XBEE_RX_CHECKSUM;
+            }
+            break;
+        case XBEE_RX_CHECKSUM:
+        default:
+            if ((uint8_t)(x->sum + c) == 0xFF)
+            {
+                xbee_frame(x,p,cb,ctx);
+            }
+            else
+            {
+                x->n_checksum_errors++;
+            }
+            x->state = XBEE_RX_START;
+            break;
+    }
+}
+
+void telem_xbee_feed_buf(telem_xbee_t * x, telem_parser_t * p, const uint8_t * buf, int len, telem_frame_cb_t cb, void * ctx)
+{
+    int i;
+    for (i = 0 ; i < len ; i++)
+    {
+        telem_xbee_feed(x,p,buf[i],cb,ctx);
+    }
+}
+
+// Writes a byte of an API frame, escaping it if necessary
+static int xbee_put(uint8_t c, uint8_t * out)
+{
+    if ((c == XBEE_START) || (c == XBEE_ESCAPE) || (c == XBEE_XON) || (c == XBEE_XOFF))
+    {
+        out[0] = XBEE_ESCAPE;
+        out[1] = c ^ XBEE_ESCAPE_XOR;
+        return 2;
+    }
+    out[0] = c;
+    return 1;
+}
+
+// Escapes and wraps len bytes of frame data into out
+static int xbee_wrap(const uint8_t * data, int len, uint8_t * out)
+{
+    int     i;
+    int     n   = 0;
+    uint8_t sum = 0;
+
+    out[n++] = XBEE_START;
+    n += xbee_put((uint8_t)(len >> 8),&out[n]);
+    n += xbee_put((uint8_t)len,&out[n]);
+    for (i = 0 ; i < len ; i++)
+    {
+        n += xbee_put(data[i],&out[n]);
+        sum += data[i];
+    }
+    n += xbee_put((uint8_t)(0xFF - sum),&out[n]);
+    return n;
+}
+
+// Builds a transmit request carrying data into out, which must hold
+// TELEM_XBEE_MAX_FRAME bytes. dest64 is the big endian address of the
+// transmitter radio, NULL to broadcast.
+// Returns the frame length, or -1 if data does not fit in one packet
+int telem_xbee_tx_request(uint8_t frame_id, const uint8_t * dest64, const uint8_t * data, int len, uint8_t * out)
+{
+    static const uint8_t broadcast[8] = {0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0xFF};
+    uint8_t frame[TELEM_XBEE_MAX_DATA];
+
+    if ((len < 0) || (len > XBEE_MAX_PAYLOAD))
+    {
+        return -1;
+    }
+    frame[0] = XBEE_TX_REQUEST;
+    frame[1] = frame_id;
+    memcpy(&frame[2],(dest64 != NULL) ? dest64 : broadcast,8);
+    frame[10] = 0xFF;                       // 16 bit destination, unknown
+    frame[11] = 0xFE;
+    frame[12] = 0x00;                       // Broadcast radius, maximum hops
+    frame[13] = 0x00;                       // Transmit options, module defaults
+    memcpy(&frame[XBEE_TX_HEADER_LEN],data,len);
+    return xbee_wrap(frame,XBEE_TX_HEADER_LEN + len,out);
+}
+
+// Builds a local AT command query such as "DB" into out
+int telem_xbee_at_command(uint8_t frame_id, const char * cmd, uint8_t * out)
+{
+    uint8_t frame[4] = {XBEE_AT_COMMAND, frame_id, (uint8_t)cmd[0], (uint8_t)cmd[1]};
+    return xbee_wrap(frame,sizeof(frame),out);
+}
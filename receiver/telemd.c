@@ -0,0 +1,206 @@
+// Spitfire telemetry receiver, ground station daemon
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Reads the radio on a serial port through the threaded pipeline, logs every
+// decoded sample to a CSV file and publishes the samples to live subscribers
+// and the shared memory segment, printing the pipeline statistics periodically
+//
+// Usage: telemd [-a] [-p port] [-s soc] <serial device> <output csv>
+//   -a       radio is in XBee API mode (AP=2)
+//   -p port  TCP port of the live telemetry server, default TELEMD_PORT
+//   -s soc   state of charge of the pack at startup in percent, default 100
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "telem_pipeline.h"
+#include "telem_shm.h"
+#include "telem_store.h"
+
+#define TELEMD_BAUD         B115200
+#define TELEMD_STATS_PERIOD 5       // Seconds between statistics
+#define TELEMD_PORT         5760
+
+static volatile sig_atomic_t gb_quit = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    gb_quit = 1;
+}
+
+// Opens the serial port raw at the radio baud rate
+static int open_serial(const char * path)
+{
+    struct termios tio;
+    int            fd = open(path,O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (tcgetattr(fd,&tio) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio,TELEMD_BAUD);
+    cfsetospeed(&tio,TELEMD_BAUD);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd,TCSANOW,&tio) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Storage sink, one CSV line per sample
+static void storage_sink(const telem_sample_t * s, int n, void * ctx)
+{
+    FILE * fp = (FILE *)ctx;
+    int    i;
+
+    if (n == 0)
+    {
+        fflush(fp);
+        return;
+    }
+    for (i = 0 ; i < n ; i++)
+    {
+        fprintf(fp,"%lld,%s,%.6g\n",(long long)s[i].time_ms,telem_signal_name(s[i].signal),s[i].value);
+    }
+}
+
+// Shared memory sink, newest values and history for local tools
+static void shm_sink(const telem_sample_t * s, int n, void * ctx)
+{
+    int i;
+
+    for (i = 0 ; i < n ; i++)
+    {
+        telem_shm_write((telem_shm_t *)ctx,s[i].signal,s[i].time_ms,s[i].value);
+    }
+}
+
+// Store sink, keeps the session in memory for queries
+static void store_sink(const telem_sample_t * s, int n, void * ctx)
+{
+    int i;
+
+    for (i = 0 ; i < n ; i++)
+    {
+        telem_store_add((telem_store_t *)ctx,s[i].signal,s[i].time_ms,s[i].value);
+    }
+}
+
+// Publishes the segment under TELEM_SHM_NAME
+static int start_shm(telem_shm_t * shm)
+{
+    static const char * names[TELEM_MAX_SIGNALS];
+    int                 i;
+
+    for (i = 0 ; i < telem_signal_count() ; i++)
+    {
+        names[i] = telem_signal_name(i);
+    }
+    return telem_shm_create(shm,TELEM_SHM_NAME,names,telem_signal_count());
+}
+
+int main(int argc, char ** argv)
+{
+    static telem_pipeline_t pipeline;
+    static telem_pubsub_t   pubsub;
+    static telem_shm_t      shm;
+    static telem_store_t    store;
+    FILE * fp;
+    int    fd;
+    int    xbee_api = 0;
+    double soc = 100;
+    int    port = TELEMD_PORT;
+    int    arg;
+    int    c;
+
+    while ((c = getopt(argc,argv,"ap:s:")) != -1)
+    {
+        if (c == 'a')
+        {
+            xbee_api = 1;
+        }
+        else if (c == 'p')
+        {
+            port = atoi(optarg);
+        }
+        else if (c == 's')
+        {
+            soc = atof(optarg);
+        }
+    }
+    arg = optind;
+    if (argc - arg < 2)
+    {
+        fprintf(stderr,"usage: %s [-a] [-p port] [-s soc] <serial device> <output csv>\n",argv[0]);
+        return 1;
+    }
+    fd = open_serial(argv[arg]);
+    if (fd < 0)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    fp = fopen(argv[arg + 1],"w");
+    if (fp == NULL)
+    {
+        perror(argv[arg + 1]);
+        return 1;
+    }
+    fprintf(fp,"time_ms,signal,value\n");
+
+    signal(SIGINT,on_signal);
+    signal(SIGTERM,on_signal);
+
+    if ((telem_store_init(&store) != 0) || (telem_pubsub_start(&pubsub,port) != 0))
+    {
+        perror("telemetry server");
+        return 1;
+    }
+    pubsub.store = &store;
+    if (start_shm(&shm) != 0)
+    {
+        perror(TELEM_SHM_NAME);
+        return 1;
+    }
+    if ((telem_pipeline_init(&pipeline,fd,xbee_api) != 0)
+        || (telem_derive_set_param(&pipeline.derive,"PACK_SOC",soc) != 0)
+        || (telem_pipeline_add_sink(&pipeline,"storage",storage_sink,fp) != 0)
+        || (telem_pipeline_add_sink(&pipeline,"pubsub",telem_pubsub_sink,&pubsub) != 0)
+        || (telem_pipeline_add_sink(&pipeline,"shm",shm_sink,&shm) != 0)
+        || (telem_pipeline_add_sink(&pipeline,"store",store_sink,&store) != 0)
+        || (telem_pipeline_start(&pipeline) != 0))
+    {
+        fprintf(stderr,"failed to start the pipeline\n");
+        return 1;
+    }
+    while (!gb_quit)
+    {
+        sleep(TELEMD_STATS_PERIOD);
+        telem_pipeline_print_stats(&pipeline,stderr);
+        telem_pubsub_print_stats(&pubsub,stderr);
+    }
+    telem_pipeline_stop(&pipeline);
+    telem_pubsub_stop(&pubsub);
+    telem_shm_close(&shm);
+    telem_store_free(&store);
+    telem_pipeline_print_stats(&pipeline,stderr);
+
+    fclose(fp);
+    close(fd);
+    return 0;
+}
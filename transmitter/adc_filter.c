@@ -0,0 +1,107 @@
+// Spitfire telemetry ADC filtering
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// CIC decimation and IIR smoothing of ADC channels, see adc_filter.h
+
+#include "adc_filter.h"
+
+// Sets up a filter, order is clamped to 1..ADC_FILTER_MAX_ORDER and
+// rate_shift to 0..7 and to what the integrators can hold at that order
+void adc_filter_init(adc_filter_t * f, adc_u8 order, adc_u8 rate_shift, adc_u8 iir_shift)
+{
+    adc_u8 i;
+
+    if (order < 1)
+    {
+        order = 1;
+    }
+    if (order > ADC_FILTER_MAX_ORDER)
+    {
+        order = ADC_FILTER_MAX_ORDER;
+    }
+    if (rate_shift > 7)
+    {
+        rate_shift = 7;
+    }
+    if (order * rate_shift > ADC_FILTER_GAIN_BITS)
+    {
+        rate_shift = ADC_FILTER_GAIN_BITS / order;
+    }
+    for (i = 0 ; i < ADC_FILTER_MAX_ORDER ; i++)
+    {
+        f->integ[i] = 0;
+        f->comb[i] = 0;
+    }
+    f->iir = 0;
+    f->out = 0;
+    f->count = 0;
+    f->order = order;
+    f->rate_shift = rate_shift;
+    f->iir_shift = iir_shift;
+    f->warmup = order - 1;
+    f->started = 0;
+}
+
+// Feeds one conversion to a filter
+// Returns 1 when a new output is ready in f->out, 0 otherwise
+adc_u8 adc_filter_push(adc_filter_t * f, adc_u16 sample)
+{
+    adc_u8  i;
+    adc_u8  shift;
+    adc_u32 x = sample;
+    adc_u32 prev;
+
+    for (i = 0 ; i < f->order ; i++)
+    {
+        f->integ[i] += x;
+        x = f->integ[i];
+    }
+    f->count++;
+    if (f->count < ((adc_u8)1 << f->rate_shift))
+    {
+        return 0;
+    }
+    f->count = 0;
+
+    for (i = 0 ; i < f->order ; i++)
+    {
+        prev = f->comb[i];
+        f->comb[i] = x;
+        x -= prev;
+    }
+
+    // The first order-1 outputs only cover part of the CIC's window
+    if (f->warmup)
+    {
+        f->warmup--;
+        return 0;
+    }
+
+    // Remove the CIC gain, keeping ADC_FILTER_FRAC_BITS, rounded
+    shift = f->order * f->rate_shift;
+    if (shift > ADC_FILTER_FRAC_BITS)
+    {
+        shift -= ADC_FILTER_FRAC_BITS;
+        x = (x + ((adc_u32)1 << (shift - 1))) >> shift;
+    }
+    else
+    {
+        x <<= ADC_FILTER_FRAC_BITS - shift;
+    }
+
+    if (f->iir_shift)
+    {
+        if (f->started)
+        {
+            f->iir += x - (f->iir >> f->iir_shift);
+        }
+        else
+        {
+            f->iir = x << f->iir_shift;
+        }
+        x = (f->iir + ((adc_u32)1 << (f->iir_shift - 1))) >> f->iir_shift;
+    }
+    f->started = 1;
+    f->out = (adc_u16)x;
+    return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef ADC_FILTER_H
+#define ADC_FILTER_H
+
+// Spitfire telemetry ADC filtering
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Fixed-point filter for one ADC channel: a CIC decimator (order 1 is a plain
+// moving average) followed by an optional single pole IIR low pass.
+//
+// A CIC of order N decimating by R = 2^rate_shift has a gain of R^N, so it
+// needs 12 + N*rate_shift bits; the integrators wrap modulo 2^32 and the
+// combs undo the wrap, which holds as long as that is at most 32, so
+// adc_filter_init lowers rate_shift until it is. Outputs are scaled back to
+// ADC units with ADC_FILTER_FRAC_BITS fractional bits, and the first N-1 are
+// dropped while the CIC's window fills. The IIR is
+// y += (x - y) / 2^iir_shift at the decimated rate, 0 turns it off, and it
+// starts at the first CIC output so there is no ramp up from 0.
+//
+// The kernel is plain C with its own integer types so it also builds on a PC,
+// for running recorded ADC traces through a filter setting.
+
+#ifdef __PCH__
+typedef unsigned int8  adc_u8;
+typedef unsigned int16 adc_u16;
+typedef unsigned int32 adc_u32;
+#else
+#include <stdint.h>
+typedef uint8_t  adc_u8;
+typedef uint16_t adc_u16;
+typedef uint32_t adc_u32;
+#endif
+
+#define ADC_FILTER_MAX_ORDER  3
+#define ADC_FILTER_FRAC_BITS  4     // Output is in 1/16ths of an ADC unit
+#define ADC_FILTER_GAIN_BITS  20    // Most CIC gain bits on top of a 12 bit sample
+
+typedef struct
+{
+    adc_u32 integ[ADC_FILTER_MAX_ORDER];   // Integrators, at the input rate
+    adc_u32 comb[ADC_FILTER_MAX_ORDER];    // Comb delays, at the output rate
+    adc_u32 iir;                           // IIR output << iir_shift
+    adc_u16 out;                           // Latest output
+    adc_u8  count;                         // Inputs since the last output
+    adc_u8  order;
+    adc_u8  rate_shift;
+    adc_u8  iir_shift;
+    adc_u8  warmup;                        // CIC outputs still to be dropped
+    adc_u8  started;                       // An output has been produced
+} adc_filter_t;
+
+void    adc_filter_init(adc_filter_t * f, adc_u8 order, adc_u8 rate_shift, adc_u8 iir_shift);
+adc_u8  adc_filter_push(adc_filter_t * f, adc_u16 sample);
+
+#endif
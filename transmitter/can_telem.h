@@ -8,33 +8,41 @@
 // CAN BUS DEFINES ///////
 //////////////////////////
 
-#define EXPAND_AS_CAN_ID_ENUM(a,b,c)  a##_ID  = b,
-#define EXPAND_AS_CAN_LEN_ENUM(a,b,c) a##_LEN = c,
-#define EXPAND_AS_CAN_ID_ARRAY(a,b,c)           b,
+#define EXPAND_AS_CAN_ID_ENUM(a,b,c,d,e,f)  a##_ID  = b,
+#define EXPAND_AS_CAN_LEN_ENUM(a,b,c,d,e,f) a##_LEN = c,
+#define EXPAND_AS_CAN_ID_ARRAY(a,b,c,d,e,f)           b,
+#define EXPAND_AS_CAN_LEN_ARRAY(a,b,c,d,e,f)          c,
+#define EXPAND_AS_CAN_PAGE_ARRAY(a,b,c,d,e,f)         d##_INDEX,
+#define EXPAND_AS_CAN_OFFSET_ARRAY(a,b,c,d,e,f)       e,
+#define EXPAND_AS_CAN_TIMEOUT_ARRAY(a,b,c,d,e,f)      f,
 
 // X macro table of CANbus packets
-//        Packet name            ,    ID, Length
-#define CAN_ID_TABLE(ENTRY)                   \
-    ENTRY(CAN_MOTOR_STATUS       , 0x401,  8) \
-    ENTRY(CAN_MOTOR_BUS_VI       , 0x402,  8) \
-    ENTRY(CAN_MOTOR_VELOCITY     , 0x403,  8) \
-    ENTRY(CAN_MOTOR_HS_TEMP      , 0x40B,  8) \
-    ENTRY(CAN_MOTOR_DSP_TEMP     , 0x40C,  8) \
-    ENTRY(CAN_EVDC_DRIVE         , 0x501,  8) \
-    ENTRY(CAN_BPS_VOLTAGE1       , 0x600,  8) \
-    ENTRY(CAN_BPS_VOLTAGE2       , 0x601,  8) \
-    ENTRY(CAN_BPS_VOLTAGE3       , 0x602,  8) \
-    ENTRY(CAN_BPS_VOLTAGE4       , 0x603,  6) \
-    ENTRY(CAN_BPS_TEMPERATURE1   , 0x608,  8) \
-    ENTRY(CAN_BPS_TEMPERATURE2   , 0x609,  8) \
-    ENTRY(CAN_BPS_TEMPERATURE3   , 0x60A,  8) \
-    ENTRY(CAN_BPS_CUR_BAL_STAT   , 0x60B,  8) \
-    ENTRY(CAN_PMS_DATA           , 0x60E,  8) \
-    ENTRY(CAN_MPPT1              , 0x771,  7) \
-    ENTRY(CAN_MPPT2              , 0x772,  7) \
-    ENTRY(CAN_MPPT3              , 0x773,  7) \
-    ENTRY(CAN_MPPT4              , 0x774,  7)
-#define N_CAN_ID 18
+// Each packet is copied into a telemetry page at the given byte offset. A
+// packet that has not been received for its timeout (ms) is considered stale,
+// its part of the page is zeroed and the page is not transmitted once all of
+// its packets are stale
+//        Packet name            ,    ID, Length, Telemetry page        , Offset, Timeout
+#define CAN_ID_TABLE(ENTRY)                                                              \
+    ENTRY(CAN_MOTOR_STATUS       , 0x401,  8, TELEM_MOTOR_STATUS    ,  0, 2000) \
+    ENTRY(CAN_MOTOR_BUS_VI       , 0x402,  8, TELEM_MOTOR_BUS_VI    ,  0, 2000) \
+    ENTRY(CAN_MOTOR_VELOCITY     , 0x403,  8, TELEM_MOTOR_VELOCITY  ,  0, 2000) \
+    ENTRY(CAN_MOTOR_HS_TEMP      , 0x40B,  8, TELEM_MOTOR_HS_TEMP   ,  0, 3000) \
+    ENTRY(CAN_MOTOR_DSP_TEMP     , 0x40C,  8, TELEM_MOTOR_DSP_TEMP  ,  0, 3000) \
+    ENTRY(CAN_EVDC_DRIVE         , 0x501,  8, TELEM_EVDC_DRIVE      ,  0, 2000) \
+    ENTRY(CAN_BPS_VOLTAGE1       , 0x600,  8, TELEM_BPS_VOLTAGE     ,  0, 2000) \
+    ENTRY(CAN_BPS_VOLTAGE2       , 0x601,  8, TELEM_BPS_VOLTAGE     ,  8, 2000) \
+    ENTRY(CAN_BPS_VOLTAGE3       , 0x602,  8, TELEM_BPS_VOLTAGE     , 16, 2000) \
+    ENTRY(CAN_BPS_VOLTAGE4       , 0x603,  6, TELEM_BPS_VOLTAGE     , 24, 2000) \
+    ENTRY(CAN_BPS_TEMPERATURE1   , 0x608,  8, TELEM_BPS_TEMPERATURE ,  0, 2000) \
+    ENTRY(CAN_BPS_TEMPERATURE2   , 0x609,  8, TELEM_BPS_TEMPERATURE ,  8, 2000) \
+    ENTRY(CAN_BPS_TEMPERATURE3   , 0x60A,  8, TELEM_BPS_TEMPERATURE , 16, 2000) \
+    ENTRY(CAN_BPS_CUR_BAL_STAT   , 0x60B,  8, TELEM_BPS_CUR_BAL_STAT,  0, 2000) \
+    ENTRY(CAN_PMS_DATA           , 0x60E,  8, TELEM_PMS_DATA        ,  0, 2000) \
+    ENTRY(CAN_MPPT1              , 0x771,  7, TELEM_MPPT            ,  0, 3000) \
+    ENTRY(CAN_MPPT2              , 0x772,  7, TELEM_MPPT            ,  7, 3000) \
+    ENTRY(CAN_MPPT3              , 0x773,  7, TELEM_MPPT            , 14, 3000) \
+    ENTRY(CAN_MPPT4              , 0x774,  7, TELEM_MPPT            , 21, 3000)
+#define N_CAN_ID 19
 
 enum {CAN_ID_TABLE(EXPAND_AS_CAN_ID_ENUM)};
 enum {CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ENUM)};
@@ -44,31 +52,40 @@ enum {CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ENUM)};
 // TELEMETRY DEFINES /////
 //////////////////////////
 
-#define EXPAND_AS_TELEM_ID_ENUM(a,b,c,d)  a##_ID  = b,
-#define EXPAND_AS_TELEM_LEN_ENUM(a,b,c,d) a##_LEN = c,
-#define EXPAND_AS_TELEM_ID_ARRAY(a,b,c,d)           b,
-#define EXPAND_AS_TELEM_LEN_ARRAY(a,b,c,d)          c,
-#define EXPAND_AS_TELEM_PAGE_ARRAY(a,b,c,d)         d,
-#define EXPAND_AS_TELEM_PAGE_DECLARATIONS(a,b,c,d) static int8 d[c];
+#define EXPAND_AS_TELEM_ID_ENUM(a,b,c,d,e,f)  a##_ID  = b,
+#define EXPAND_AS_TELEM_LEN_ENUM(a,b,c,d,e,f) a##_LEN = c,
+#define EXPAND_AS_TELEM_INDEX_ENUM(a,b,c,d,e,f) a##_INDEX,
+#define EXPAND_AS_TELEM_ID_ARRAY(a,b,c,d,e,f)           b,
+#define EXPAND_AS_TELEM_LEN_ARRAY(a,b,c,d,e,f)          c,
+#define EXPAND_AS_TELEM_PAGE_ARRAY(a,b,c,d,e,f)         d,
+#define EXPAND_AS_TELEM_DELTA_ARRAY(a,b,c,d,e,f)        e,
+#define EXPAND_AS_TELEM_CRITICAL_ARRAY(a,b,c,d,e,f)     f,
+#define EXPAND_AS_TELEM_PAGE_DECLARATIONS(a,b,c,d,e,f) static int8 d[c];
 
 // X macro table of telemetry packets
-//        Packet name            ,    ID, Length, Page array
-#define TELEM_ID_TABLE(ENTRY)                                          \
-    ENTRY(TELEM_MOTOR_STATUS     ,  0x02,  8, g_motor_status_page)     \
-    ENTRY(TELEM_MOTOR_BUS_VI     ,  0x03,  8, g_motor_bus_vi_page)     \
-    ENTRY(TELEM_MOTOR_VELOCITY   ,  0x05,  8, g_motor_velocity_page)   \
-    ENTRY(TELEM_MOTOR_HS_TEMP    ,  0x07,  8, g_motor_hs_temp_page)    \
-    ENTRY(TELEM_MOTOR_DSP_TEMP   ,  0x09,  8, g_motor_dsp_temp_page)   \
-    ENTRY(TELEM_EVDC_DRIVE       ,  0x0A,  8, g_evdc_drive_page)       \
-    ENTRY(TELEM_BPS_VOLTAGE      ,  0x0B, 30, g_bps_voltage_page)      \
-    ENTRY(TELEM_BPS_TEMPERATURE  ,  0x0D, 24, g_bps_temperature_page)  \
-    ENTRY(TELEM_BPS_CUR_BAL_STAT ,  0x11,  8, g_bps_cur_bal_stat_page) \
-    ENTRY(TELEM_PMS_DATA         ,  0x19,  8, g_pms_page)              \
-    ENTRY(TELEM_MPPT             ,  0x1D, 28, g_mppt_page)
-#define N_TELEM_ID 11
+// Delta pages are sent as changes against the last keyframe of the page
+// Critical pages are kept for retransmission when the ground station reports
+// them lost
+// Pages no CAN packet is copied into are measured on board
+//        Packet name            ,    ID, Length, Page array             , Delta, Critical
+#define TELEM_ID_TABLE(ENTRY)                                                    \
+    ENTRY(TELEM_MOTOR_STATUS     ,  0x02,  8, g_motor_status_page    , 0, 0) \
+    ENTRY(TELEM_MOTOR_BUS_VI     ,  0x03,  8, g_motor_bus_vi_page    , 0, 0) \
+    ENTRY(TELEM_MOTOR_VELOCITY   ,  0x05,  8, g_motor_velocity_page  , 0, 0) \
+    ENTRY(TELEM_MOTOR_HS_TEMP    ,  0x07,  8, g_motor_hs_temp_page   , 0, 0) \
+    ENTRY(TELEM_MOTOR_DSP_TEMP   ,  0x09,  8, g_motor_dsp_temp_page  , 0, 0) \
+    ENTRY(TELEM_EVDC_DRIVE       ,  0x0A,  8, g_evdc_drive_page      , 0, 0) \
+    ENTRY(TELEM_BPS_VOLTAGE      ,  0x0B, 30, g_bps_voltage_page     , 1, 1) \
+    ENTRY(TELEM_BPS_TEMPERATURE  ,  0x0D, 24, g_bps_temperature_page , 1, 1) \
+    ENTRY(TELEM_BPS_CUR_BAL_STAT ,  0x11,  8, g_bps_cur_bal_stat_page, 0, 1) \
+    ENTRY(TELEM_PMS_DATA         ,  0x19,  8, g_pms_page             , 0, 0) \
+    ENTRY(TELEM_MPPT             ,  0x1D, 28, g_mppt_page            , 0, 0) \
+    ENTRY(TELEM_AUX_ANALOG       ,  0x21, 19, g_aux_analog_page      , 0, 0)
+#define N_TELEM_ID 12
 
 enum {TELEM_ID_TABLE(EXPAND_AS_TELEM_ID_ENUM)};
 enum {TELEM_ID_TABLE(EXPAND_AS_TELEM_LEN_ENUM)};
+enum {TELEM_ID_TABLE(EXPAND_AS_TELEM_INDEX_ENUM)};
 
 
 //////////////////////////
@@ -93,6 +110,60 @@ enum {TELEM_ID_TABLE(EXPAND_AS_TELEM_LEN_ENUM)};
 enum {CAN_POLLING_TABLE(EXPAND_AS_POLLING_ID_ENUM)};
 
 
+//////////////////////////
+// ENCODING DEFINES //////
+//////////////////////////
+
+// Field kinds
+#define FIELD_F32  0  // IEEE 754 float, little endian, byte aligned
+#define FIELD_BITS 1  // Unsigned integer, MSB first bit offset into the page
+
+#define EXPAND_AS_FIELD_ENUM(a,b,c,d,e,f,g,h,i)          a##_FIELD,
+#define EXPAND_AS_FIELD_PAGE_ARRAY(a,b,c,d,e,f,g,h,i)    b##_INDEX,
+#define EXPAND_AS_FIELD_BITOFF_ARRAY(a,b,c,d,e,f,g,h,i)  c,
+#define EXPAND_AS_FIELD_KIND_ARRAY(a,b,c,d,e,f,g,h,i)    d,
+#define EXPAND_AS_FIELD_SCALE_ARRAY(a,b,c,d,e,f,g,h,i)   e,
+#define EXPAND_AS_FIELD_BIAS_ARRAY(a,b,c,d,e,f,g,h,i)    f,
+#define EXPAND_AS_FIELD_BITS_ARRAY(a,b,c,d,e,f,g,h,i)    g,
+#define EXPAND_AS_FIELD_COUNT_ARRAY(a,b,c,d,e,f,g,h,i)   h,
+#define EXPAND_AS_FIELD_STRIDE_ARRAY(a,b,c,d,e,f,g,h,i)  i,
+
+// X macro table describing the fields of each telemetry page
+// An encoded page is the fields of that page packed MSB first in table order,
+// each one bits wide. Float fields are sent as round(value * scale + bias)
+// clamped to the field width, integer fields are copied unchanged (scale 1,
+// bias 0). Count repeats a field with the given source stride in bits.
+// Pages are only sent encoded when that is shorter than the raw page.
+//        Field name            , Telemetry page        , Bit offset, Kind      , Scale, Bias , Bits, Count, Stride
+#define TELEM_FIELD_TABLE(ENTRY)                                                                                  \
+    ENTRY(MOTOR_STATUS_BYTE     , TELEM_MOTOR_STATUS    ,   0, FIELD_BITS,    1,     0,  8,  8,  8) \
+    ENTRY(MOTOR_BUS_VOLTAGE     , TELEM_MOTOR_BUS_VI    ,   0, FIELD_F32 ,   10,     0, 12,  1,  0) \
+    ENTRY(MOTOR_BUS_CURRENT     , TELEM_MOTOR_BUS_VI    ,  32, FIELD_F32 ,   10,  2048, 12,  1,  0) \
+    ENTRY(MOTOR_RPM             , TELEM_MOTOR_VELOCITY  ,   0, FIELD_F32 ,    1,  4096, 13,  1,  0) \
+    ENTRY(VEHICLE_VELOCITY      , TELEM_MOTOR_VELOCITY  ,  32, FIELD_F32 ,   10,   512, 10,  1,  0) \
+    ENTRY(MOTOR_TEMP            , TELEM_MOTOR_HS_TEMP   ,   0, FIELD_F32 ,    2,    80,  9,  1,  0) \
+    ENTRY(HEATSINK_TEMP         , TELEM_MOTOR_HS_TEMP   ,  32, FIELD_F32 ,    2,    80,  9,  1,  0) \
+    ENTRY(DSP_TEMP              , TELEM_MOTOR_DSP_TEMP  ,   0, FIELD_F32 ,    2,    80,  9,  1,  0) \
+    ENTRY(DRIVE_VELOCITY        , TELEM_EVDC_DRIVE      ,   0, FIELD_F32 ,    1, 32768, 16,  1,  0) \
+    ENTRY(DRIVE_CURRENT         , TELEM_EVDC_DRIVE      ,  32, FIELD_F32 , 1000,     0, 10,  1,  0) \
+    ENTRY(BPS_CELL_VOLTAGE      , TELEM_BPS_VOLTAGE     ,   0, FIELD_BITS,    1,     0,  8, 30,  8) \
+    ENTRY(BPS_CELL_TEMP         , TELEM_BPS_TEMPERATURE ,   0, FIELD_BITS,    1,     0,  8, 24,  8) \
+    ENTRY(BPS_CURRENT           , TELEM_BPS_CUR_BAL_STAT,   0, FIELD_BITS,    1,     0, 16,  1,  0) \
+    ENTRY(BPS_BAL_STAT_BYTE     , TELEM_BPS_CUR_BAL_STAT,  16, FIELD_BITS,    1,     0,  8,  6,  8) \
+    ENTRY(PMS_BYTE              , TELEM_PMS_DATA        ,   0, FIELD_BITS,    1,     0,  8,  8,  8) \
+    ENTRY(MPPT_FLAGS            , TELEM_MPPT            ,   0, FIELD_BITS,    1,     0,  4,  4, 56) \
+    ENTRY(MPPT_VOLTAGE_IN       , TELEM_MPPT            ,   6, FIELD_BITS,    1,     0, 10,  4, 56) \
+    ENTRY(MPPT_CURRENT_IN       , TELEM_MPPT            ,  22, FIELD_BITS,    1,     0, 10,  4, 56) \
+    ENTRY(MPPT_VOLTAGE_OUT      , TELEM_MPPT            ,  38, FIELD_BITS,    1,     0, 10,  4, 56) \
+    ENTRY(MPPT_TEMP             , TELEM_MPPT            ,  48, FIELD_BITS,    1,     0,  8,  4, 56) \
+    ENTRY(AUX_CELL_VOLTAGE      , TELEM_AUX_ANALOG      ,   0, FIELD_F32 , 1000,     0, 13,  4, 32) \
+    ENTRY(ARRAY_CURRENT_ADC     , TELEM_AUX_ANALOG      , 132, FIELD_BITS,    1,     0, 12,  1,  0) \
+    ENTRY(AUX_FLAGS             , TELEM_AUX_ANALOG      , 144, FIELD_BITS,    1,     0,  8,  1,  0)
+#define N_TELEM_FIELD 23
+
+enum {TELEM_FIELD_TABLE(EXPAND_AS_FIELD_ENUM)};
+
+
 ///////////////////////////
 // MISCELLANEOUS DEFINES //
 ///////////////////////////
@@ -103,8 +174,9 @@ enum {CAN_POLLING_TABLE(EXPAND_AS_POLLING_ID_ENUM)};
 // X macro table of miscellaneous CANbus packets
 //        Packet name              , LEN,    ID
 #define CAN_MISC_TABLE(ENTRY)                   \
-    ENTRY(TELEM_MOTOR_SPEED_CURRENT,   2, 0x666)
-#define N_CAN_MISC 1
+    ENTRY(TELEM_MOTOR_SPEED_CURRENT,   2, 0x666) \
+    ENTRY(TELEM_AUX_BROADCAST      ,   8, 0x7A0)
+#define N_CAN_MISC 2
 
 enum {CAN_MISC_TABLE(EXPAND_AS_MISC_ID_ENUM)};
 enum {CAN_MISC_TABLE(EXPAND_AS_MISC_LEN_ENUM)};
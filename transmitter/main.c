@@ -10,19 +10,70 @@
 #include "ieeefloat.c"
 #include "can_telem.h"
 #include "can18F4580_mscp.c"
+#ifdef XBEE_API_MODE
+#include "xbee_api.c"
+#endif
+#include "telem_frame.c"
+#include "adc_filter.c"
+#include "telem_lz.c"
+#include "telem_cmd.c"
+#include "telem_arq.c"
 
-// Timing periods
+// Default timing periods, adjustable from the ground station
 #define SENDING_PERIOD_MS  50
 #define POLLING_PERIOD_MS  200
+#define MIN_SENDING_PERIOD_MS 5
+#define MIN_POLLING_PERIOD_MS 10
+
+// How often a waiting XBee batch is checked for XBEE_FLUSH_MS
+#ifdef XBEE_API_MODE
+#define FLUSH_CHECK_MS 10
+#else
+#define FLUSH_CHECK_MS 0
+#endif
+
+// A stale page is announced once every STALE_NOTICE_PERIOD visits of the
+// round robin, its other slots are given to the next live page
+#define STALE_NOTICE_PERIOD 4
 
 // CAN bus defines
 #define TX_PRI 3
 #define TX_EXT 0
 #define TX_RTR 1
 
-// Sends a packet of telemetry data to the radio module over uart
-#define TELEM_SEND_PACKET(i) \
-    send_data(g_telem_id[i],g_telem_len[i],gp_telem_page[i]);
+// Sends a stale page notice, a header with no payload
+#define TELEM_SEND_STALE(i,now) \
+    send_frame(g_telem_id[i],TELEM_FLAG_STALE,0,0,(int16)(now),page_age(i,now));
+
+// Creates an array of CAN packet IDs
+static int16 g_can_id[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_ID_ARRAY)
+};
+
+// Creates an array of CAN packet lengths
+static int8 g_can_len[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_LEN_ARRAY)
+};
+
+// Creates an array of the telemetry page each CAN packet is copied into
+static int8 g_can_page[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_PAGE_ARRAY)
+};
+
+// Creates an array of the byte offset of each CAN packet in its page
+static int8 g_can_offset[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_OFFSET_ARRAY)
+};
+
+// Creates an array of CAN packet timeouts in ms
+static int16 g_can_timeout[N_CAN_ID] =
+{
+    CAN_ID_TABLE(EXPAND_AS_CAN_TIMEOUT_ARRAY)
+};
 
 // Creates an array of telemetry packet IDs
 static int16 g_telem_id[N_TELEM_ID] =
@@ -49,25 +100,55 @@ static int * gp_telem_page[N_TELEM_ID] =
     TELEM_ID_TABLE(EXPAND_AS_TELEM_PAGE_ARRAY)
 };
 
-static int1          gb_send;
-static int1          gb_poll;
+// Time of the last update of each telemetry page, in ms
+static int32 g_telem_stamp[N_TELEM_ID];
+static int1  gb_telem_fresh[N_TELEM_ID];
+static int8  g_telem_stale_count[N_TELEM_ID];
+
+// Time each CAN packet was last received, in ms
+static int32 g_can_stamp[N_CAN_ID];
+static int1  gb_can_fresh[N_CAN_ID];
+
+// Page encoding uses the page tables above
+#include "telem_encode.c"
+
+// Pages and polling destinations enabled from the ground station
+static int1  gb_telem_enabled[N_TELEM_ID];
+static int1  gb_poll_enabled[N_CAN_POLLING_ID];
+
+static int16         g_sending_period_ms = SENDING_PERIOD_MS;
+static int16         g_polling_period_ms = POLLING_PERIOD_MS;
+static int1          gb_snapshot = false;
+static int32         g_ms;
 static int32         g_can0_id;
 static int8          g_can0_data[8];
 static int8          g_can0_len;
+static int32         g_can0_stamp;
 static int1          gb_can0_hit = false;
 static int32         g_can1_id;
 static int8          g_can1_data[8];
 static int8          g_can1_len;
+static int32         g_can1_stamp;
 static int1          gb_can1_hit = false;
 static int32         g_rx_id;
 static int8          g_rx_len;
 static int8          g_rx_data[8];
-static telem_state_t g_state;
+static int32         g_rx_stamp;
+
+// Rate control uses the sending period above
+#include "telem_link.c"
+
+// Aux pack and array current measurement fills its own page, stamped with
+// the clock above
+#include "telem_aux.c"
 
 // Puts the xbee into bypass mode, toggles Xbee reset pins
 // Documentation: http://xbee-sdk-doc.readthedocs.io/en/stable/doc/tips_tricks/
 void xbee_init(void)
 {
+#if defined(XBEE_API_MODE) && (XBEE_GROUND_SL != 0)
+    xbee_set_dest(XBEE_GROUND_SH,XBEE_GROUND_SL);
+#endif
     delay_ms(10);
     output_low(XBEE_PIN);
     delay_ms(1);
@@ -78,15 +159,117 @@ void xbee_init(void)
     delay_ms(10);
 }
 
-// Sends a page of data over the radio module
-void send_data(int8 id, int len, int * data)
+// Returns the free-running millisecond counter
+// The counter is updated by the timer 2 interrupt, interrupts are disabled
+// while it is copied so the 32 bit read cannot be torn
+int32 get_ms(void)
 {
-    int i;
-    putc(id);
-    for (i = 0 ; i < len ; i++)
+    int32 now;
+    disable_interrupts(GLOBAL);
+    now = g_ms;
+    enable_interrupts(GLOBAL);
+    return now;
+}
+
+// Tasks are released and timed against the counter above
+#include "telem_sched.c"
+
+// Returns the time in ms since a telemetry page was last updated
+int16 page_age(int8 i, int32 now)
+{
+    int32 age = now - g_telem_stamp[i];
+    if (age > TELEM_AGE_MAX)
     {
-        putc(*(data+i));
+        age = TELEM_AGE_MAX;
     }
+    return (int16)age;
+}
+
+// Sends a packet of telemetry data to the radio module over uart, delta coded
+// or encoded when the page has a shorter representation, then compressed
+// against the stream history. Critical pages are kept for retransmission.
+void send_page(int8 i, int32 now)
+{
+    int8  flags = 0;
+    int8  len   = delta_page(i);
+    int8  lz_len;
+    int16 age   = page_age(i,now);
+    int * data  = g_enc_buf;
+    
+    if (len == 0)
+    {
+        len = encode_page(i);
+    }
+    
+    if (len > 0)
+    {
+        flags = g_enc_flags;
+    }
+    else
+    {
+        len  = g_telem_len[i];
+        data = gp_telem_page[i];
+    }
+    
+    if (gb_telem_critical[i])
+    {
+        arq_cache(g_frame_seq,g_telem_id[i],flags,len,data,(int16)now,age);
+    }
+    
+    if (gb_lz)
+    {
+        if (lz_reset_due())
+        {
+            lz_reset();
+            flags |= TELEM_FLAG_LZ_RESET;
+        }
+        lz_len = lz_compress(data,len);
+        if (lz_len > 0)
+        {
+            flags |= TELEM_FLAG_LZ;
+            len  = lz_len;
+            data = g_lz_buf;
+        }
+    }
+    
+    send_frame(g_telem_id[i],flags,len,data,(int16)now,age);
+}
+
+// Copies the received CAN data into a telemetry page and timestamps the page
+// with the arrival time of the CAN frame
+void update_page(int8 i, int8 offset, int8 len)
+{
+    memcpy(gp_telem_page[i]+offset,g_rx_data,len);
+    g_telem_stamp[i] = g_rx_stamp;
+}
+
+// Marks CAN packets that have not been received within their timeout as stale
+// and zeroes their part of the page, like the canTimeout handling of
+// TelemAux. A page stays fresh as long as any of its packets is fresh.
+void check_timeouts(int32 now)
+{
+    int8 i;
+    
+    for (i = 0 ; i < N_TELEM_ID ; i++)
+    {
+        gb_telem_fresh[i] = false;
+    }
+    
+    for (i = 0 ; i < N_CAN_ID ; i++)
+    {
+        if (gb_can_fresh[i] && ((now - g_can_stamp[i]) > g_can_timeout[i]))
+        {
+            gb_can_fresh[i] = false;
+            memset(gp_telem_page[g_can_page[i]]+g_can_offset[i],0,g_can_len[i]);
+        }
+        if (gb_can_fresh[i])
+        {
+            gb_telem_fresh[g_can_page[i]] = true;
+        }
+    }
+    
+    // The aux page is measured on board rather than copied from CAN
+    gb_telem_fresh[TELEM_AUX_ANALOG_INDEX] = aux_fresh(now);
 }
 
 void send_motor_speed_current_page(void)
@@ -116,36 +299,34 @@ void send_motor_speed_current_page(void)
 }
 
 // INT_TIMER2 programmed to trigger every 1ms with a 20MHz clock
-// Telemetry data will be sent out one page at a time with a period of SENDIN_PERIOD_MS
+// The single tick of the firmware, releases the periodic tasks of
+// TELEM_TASK_TABLE and starts one aux ADC conversion
 #int_timer2
 void isr_timer2(void)
 {
-    static int16 ms;
-    if (ms >= SENDING_PERIOD_MS)
-    {
-        ms = 0;         // Reset timer
-        gb_send = true; // Raise data sending flag
-    }
-    else
-    {
-        ms++;
-    }
+    g_ms++;         // Free-running timestamp counter
+    read_adc(ADC_START_ONLY);
+    TELEM_TASK_TABLE(EXPAND_AS_TASK_TICK)
 }
 
-// INT_TIMER4 programmed to trigger every 1ms with a 20MHz clock
-// Polling request flag will be set with a period of POLLING_PERIOD_MS
-#int_timer4
-void isr_timer4(void)
+// UART receive interrupt, command frames from the ground station
+// In API mode the commands arrive as the RF data of xbee receive packets
+#int_rda
+void isr_rda(void)
 {
-    static int16 ms;
-    if (ms >= POLLING_PERIOD_MS)
+    int1 b_was_ready = gb_cmd_ready;
+    
+#ifdef XBEE_API_MODE
+    if (xbee_rx_byte(getc()))
     {
-        ms = 0;         // Reset timer
-        gb_poll = true; // Raise polling request flag
+        cmd_rx_byte(g_xbee_rx_data);
     }
-    else
+#else
+    cmd_rx_byte(getc());
+#endif
+    if (gb_cmd_ready && !b_was_ready)
     {
-        ms++;
+        SCHED_POST(TASK_COMMAND);
     }
 }
 
@@ -158,7 +339,9 @@ void isr_canrx0()
     
     if (can_getd(g_can0_id, g_can0_data, g_can0_len, rxstat))
     {
+        g_can0_stamp = g_ms;
         gb_can0_hit = true;
+        SCHED_POST(TASK_CAN_RX);
     }
     else
     {
@@ -175,7 +358,9 @@ void isr_canrx1()
     
     if (can_getd(g_can1_id, g_can1_data, g_can1_len, rxstat))
     {
+        g_can1_stamp = g_ms;
         gb_can1_hit = true;
+        SCHED_POST(TASK_CAN_RX);
     }
     else
     {
@@ -183,168 +368,280 @@ void isr_canrx1()
     }
 }
 
-void idle_state(void)
+void data_received(void);
+
+// Takes the packets waiting in the CAN receive buffers
+void can_rx_task(void)
 {
     if (gb_can0_hit == true)
     {
         // Data received in buffer 0, transfer contents
         g_rx_id = g_can0_id;
         g_rx_len = g_can0_len;
+        g_rx_stamp = g_can0_stamp;
         memcpy(g_rx_data,g_can0_data,8);
         gb_can0_hit = false;
-        g_state = DATA_RECEIVED;
+        data_received();
     }
-    else if (gb_can1_hit == true)
+    if (gb_can1_hit == true)
     {
         // Data received in buffer 1, transfer contents
         g_rx_id = g_can1_id;
         g_rx_len = g_can1_len;
+        g_rx_stamp = g_can1_stamp;
         memcpy(g_rx_data,g_can1_data,8);
         gb_can1_hit = false;
-        g_state = DATA_RECEIVED;
+        data_received();
     }
-    else if (gb_send == true)
+}
+
+void data_received(void)
+{
+    int8 i;
+    int8 len;
+    
+    // Look up the ID of the received packet and update the corresponding page
+    for (i = 0 ; i < N_CAN_ID ; i++)
     {
-        // Ready to send data
-        g_state = DATA_SENDING;
+        if (g_can_id[i] == g_rx_id)
+        {
+            len = (g_rx_len < g_can_len[i]) ? g_rx_len : g_can_len[i];
+            update_page(g_can_page[i],g_can_offset[i],len);
+            g_can_stamp[i] = g_rx_stamp;
+            gb_can_fresh[i] = true;
+            break;
+        }
     }
-    else if (can_tbe() && (gb_poll == true))
+    
+    // Motor speed and current are forwarded to the driver display
+    if ((g_rx_id == CAN_MOTOR_BUS_VI_ID) || (g_rx_id == CAN_MOTOR_VELOCITY_ID))
     {
-        // Ready to poll
-        g_state = DATA_POLLING;
+        send_motor_speed_current_page();
     }
-    else
+}
+
+void data_sending_task(void)
+{
+    static int i = 0;
+    int8  n;
+    int1  b_sent = false;
+    int32 now;
+    
+    output_toggle(TX_PIN);
+    now = get_ms();
+    check_timeouts(now);
+    
+    // Snapshot requested, send every live page right away
+    if (gb_snapshot)
     {
-        // Nothing, remain idle
-        g_state = IDLE;
+        gb_snapshot = false;
+        for (n = 0 ; n < N_TELEM_ID ; n++)
+        {
+            if (gb_telem_enabled[n] && gb_telem_fresh[n])
+            {
+                send_page(n,now);
+            }
+        }
+#ifdef XBEE_API_MODE
+        xbee_flush();
+#endif
+        return;
+    }
+    
+    // Disabled pages are skipped. Stale pages are skipped so live pages get
+    // their slots, with an occasional notice so the receiver knows the page
+    // is stale
+    for (n = 0 ; (n < N_TELEM_ID) && !b_sent ; n++)
+    {
+        if (!gb_telem_enabled[i])
+        {
+            // Disabled from the ground station
+        }
+        else if (gb_telem_fresh[i])
+        {
+            g_telem_stale_count[i] = 0;
+            send_page(i,now);
+            b_sent = true;
+        }
+        else if (g_telem_stale_count[i]++ % STALE_NOTICE_PERIOD == 0)
+        {
+            TELEM_SEND_STALE(i,now);
+            b_sent = true;
+        }
+        
+        if (i >= (N_TELEM_ID-1))
+        {
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
     }
 }
 
-void data_received_state(void)
+void data_polling_task(void)
 {
-    // Check the ID of the received packet and update the corresponding page
-    switch(g_rx_id)
+    static int i = 0;
+    int8 n;
+    int1 b_sent = false;
+    
+    // Try again on the next tick when the transmit buffers are full
+    if (!can_tbe())
     {
-        // MOTOR DATA
-        case CAN_MOTOR_STATUS_ID:       // Motor status bits
-            memcpy(&g_motor_status_page[0],g_rx_data,g_rx_len);
-            break;
-        case CAN_MOTOR_BUS_VI_ID:       // Motor voltage and current
-            memcpy(&g_motor_bus_vi_page[0],g_rx_data,g_rx_len);
-            send_motor_speed_current_page();
-            break;
-        case CAN_MOTOR_VELOCITY_ID:     // Motor velocity
-            memcpy(&g_motor_velocity_page[0],g_rx_data,g_rx_len);
-            send_motor_speed_current_page();
-            break;
-        case CAN_MOTOR_HS_TEMP_ID:  // Motor heatsink temperature
-            memcpy(&g_motor_hs_temp_page[0],g_rx_data,g_rx_len);
-            break;
-        case CAN_MOTOR_DSP_TEMP_ID:  // Motor DSP temperature
-            memcpy(&g_motor_dsp_temp_page[0],g_rx_data,g_rx_len);
-            break;
-        
-        // EV DRIVER CONTROLS DATA
-        case CAN_EVDC_DRIVE_ID:
-            memcpy(&g_evdc_drive_page[0],g_rx_data,g_rx_len);
-            break;
+        sched_defer(TASK_POLL);
+        return;
+    }
+    
+    // Skip destinations disabled from the ground station
+    for (n = 0 ; (n < N_CAN_POLLING_ID) && !b_sent ; n++)
+    {
+        if (gb_poll_enabled[i])
+        {
+            can_putd(g_polling_id[i],0,8,TX_PRI,TX_EXT,TX_RTR);
+            b_sent = true;
+        }
         
-        // BPS DATA
-        case CAN_BPS_VOLTAGE1_ID:       // BPS voltage 1
-            memcpy(&g_bps_voltage_page[0],g_rx_data,g_rx_len);
-            break;
-        case CAN_BPS_VOLTAGE2_ID:       // BPS voltage 2
-            memcpy(&g_bps_voltage_page[8],g_rx_data,g_rx_len);
-           break;
-        case CAN_BPS_VOLTAGE3_ID:       // BPS voltage 3
-            memcpy(&g_bps_voltage_page[16],g_rx_data,g_rx_len);
-            break;
-        case CAN_BPS_VOLTAGE4_ID:       // BPS voltage 4
-            memcpy(&g_bps_voltage_page[24],g_rx_data,g_rx_len);
-            break;
-        case CAN_BPS_TEMPERATURE1_ID:   // BPS temperature 1
-            memcpy(&g_bps_temperature_page[0],g_rx_data,g_rx_len);
-            break;
-        case CAN_BPS_TEMPERATURE2_ID:   // BPS temperature 2
-            memcpy(&g_bps_temperature_page[8],g_rx_data,g_rx_len);
-            break;
-        case CAN_BPS_TEMPERATURE3_ID:   // BPS temperature 3
-            memcpy(&g_bps_temperature_page[16],g_rx_data,g_rx_len);
+        if (i >= (N_CAN_POLLING_ID-1))
+        {
+            i = 0;
+#ifdef XBEE_API_MODE
+            xbee_request_rssi();    // Once per round of polls
+#endif
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Handles a command frame from the ground station and acknowledges it
+void command_task(void)
+{
+    int8  i;
+    int8  status = CMD_STATUS_OK;
+    int16 arg = make16(g_cmd_args[1],g_cmd_args[0]);
+    
+    switch (g_cmd_code)
+    {
+        case CMD_SET_SEND_PERIOD:
+            if ((g_cmd_len != CMD_SET_SEND_PERIOD_LEN) || (arg < MIN_SENDING_PERIOD_MS))
+            {
+                status = CMD_STATUS_BAD_ARGS;
+                break;
+            }
+            link_set_floor(arg);
             break;
-        case CAN_BPS_CUR_BAL_STAT_ID:   // BPS current, balancing bits, status
-            memcpy(&g_bps_cur_bal_stat_page[0],g_rx_data,g_rx_len);
+        case CMD_SET_POLL_PERIOD:
+            if ((g_cmd_len != CMD_SET_POLL_PERIOD_LEN) || (arg < MIN_POLLING_PERIOD_MS))
+            {
+                status = CMD_STATUS_BAD_ARGS;
+                break;
+            }
+            disable_interrupts(GLOBAL);
+            g_polling_period_ms = arg;
+            enable_interrupts(GLOBAL);
             break;
-        
-        // PMS DATA
-        case CAN_PMS_DATA_ID:           // PMS data (aux voltage/temperature, DC/DC temperature)
-            memcpy(&g_pms_page[0],g_rx_data,g_rx_len);
+        case CMD_PAGE_ENABLE:           // Args: telemetry ID, enable
+            status = CMD_STATUS_BAD_ARGS;
+            for (i = 0 ; (i < N_TELEM_ID) && (g_cmd_len == CMD_PAGE_ENABLE_LEN) ; i++)
+            {
+                if (g_telem_id[i] == g_cmd_args[0])
+                {
+                    gb_telem_enabled[i] = (g_cmd_args[1] != 0);
+                    status = CMD_STATUS_OK;
+                }
+            }
             break;
-        
-        // MPPT DATA
-        case CAN_MPPT1_ID:              // MPPT 1 data
-            memcpy(&g_mppt_page[0],g_rx_data,g_rx_len);
+        case CMD_SNAPSHOT:
+            gb_snapshot = true;
+            sched_post(TASK_SEND);
             break;
-        case CAN_MPPT2_ID:              // MPPT 2 data
-            memcpy(&g_mppt_page[7],g_rx_data,g_rx_len);
+        case CMD_NACK:                  // Args: lost sequence numbers
+            for (i = 0 ; i < g_cmd_len ; i++)
+            {
+                arq_retransmit(g_cmd_args[i]);
+                link_nack(g_cmd_args[i]);
+            }
             break;
-        case CAN_MPPT3_ID:              // MPPT 3 data
-            memcpy(&g_mppt_page[14],g_rx_data,g_rx_len);
+        case CMD_LINK_REPORT:           // Args: loss, RSSI
+            if (g_cmd_len == CMD_LINK_REPORT_LEN)
+            {
+                link_report(g_cmd_args[0],g_cmd_args[1]);
+            }
             break;
-        case CAN_MPPT4_ID:              // MPPT 4 data
-            memcpy(&g_mppt_page[21],g_rx_data,g_rx_len);
+        case CMD_POLL_ENABLE:           // Args: polling table index, enable
+            if ((g_cmd_len != CMD_POLL_ENABLE_LEN) || (g_cmd_args[0] >= N_CAN_POLLING_ID))
+            {
+                status = CMD_STATUS_BAD_ARGS;
+                break;
+            }
+            gb_poll_enabled[g_cmd_args[0]] = (g_cmd_args[1] != 0);
             break;
-        
-        // Invalid CAN id
         default:
+            status = CMD_STATUS_UNKNOWN;
             break;
     }
     
-    // Data received, return to idle
-    g_state = IDLE;
+    // Retransmissions are the answer to a NACK, link reports are periodic
+    if ((g_cmd_code != CMD_NACK) && (g_cmd_code != CMD_LINK_REPORT))
+    {
+        send_cmd_ack(status,(int16)get_ms());
+    }
+#ifdef XBEE_API_MODE
+    xbee_flush();   // The ground station is waiting for the answer
+#endif
+    gb_cmd_ready = false;
 }
 
-void data_sending_state(void)
+// Adapts the sending rate and compression to the link and reports its state
+void link_update_task(void)
 {
-    static int i = 0;
-    
-    gb_send = false;
-    output_toggle(TX_PIN);
-    TELEM_SEND_PACKET(i);
-    
-    if (i >= (N_TELEM_ID-1))
-    {
-        i = 0;
-    }
-    else
+    link_update((int16)get_ms());
+}
+
+// Reads the aux pack and array current into their page
+void aux_update_task(void)
+{
+    aux_update(get_ms());
+}
+
+// Sends the batch of frames waiting for the radio once it has waited long
+// enough
+void data_flushing_task(void)
+{
+#ifdef XBEE_API_MODE
+    if (xbee_flush_due(get_ms()))
     {
-        i++;
+        xbee_flush();
     }
-    
-    g_state = IDLE;
+#endif
 }
 
-void data_polling_state(void)
+void main()
 {
-    static int i = 0;
+    int8 i;
     
-    gb_poll = false;
-    can_putd(g_polling_id[i],0,8,TX_PRI,TX_EXT,TX_RTR);
-    
-    if (i >= (N_CAN_POLLING_ID-1))
+    // Everything is sent and polled until the ground station says otherwise
+    for (i = 0 ; i < N_TELEM_ID ; i++)
     {
-        i = 0;
+        gb_telem_enabled[i] = true;
     }
-    else
+    for (i = 0 ; i < N_CAN_POLLING_ID ; i++)
     {
-        i++;
+        gb_poll_enabled[i] = true;
     }
     
-    // Polling data sent, return to idle
-    g_state = IDLE;
-}
-
-void main()
-{
+    // Everything the interrupts use is set up before they are enabled
+    can_init();
+    encode_init();
+    aux_init();
+    
+    // Setup CAN gpio pins
+    set_tris_b((*0xF93 & 0xFB ) | 0x08);   //b3 is out, b2 is in (default)
+    delay_us(200);
+    
     // Enable CAN receive interrupts
     clear_interrupt(INT_CANRX0);
     enable_interrupts(INT_CANRX0);
@@ -352,40 +649,22 @@ void main()
     enable_interrupts(INT_CANRX1);
     
     // Setup timer interrupts
-    setup_timer_2(T2_DIV_BY_4,79,16); // Timer 2 set up to interrupt every 1ms with a 20MHz clock
-    setup_timer_4(T4_DIV_BY_4,79,16); // Timer 4 set up to interrupt every 1ms with a 20MHz clock
+    setup_timer_2(T2_DIV_BY_4,249,5); // Timer 2 set up to interrupt every 1ms with a 20MHz clock (5MHz/4/250/5)
+    sched_init();
     enable_interrupts(INT_TIMER2);
-    enable_interrupts(INT_TIMER4);
+    enable_interrupts(INT_RDA);
     enable_interrupts(GLOBAL);
     
+    // The uart transmit buffer drains from its interrupt
     xbee_init();
-    can_init();
-    
-    // Setup CAN gpio pins
-    set_tris_b((*0xF93 & 0xFB ) | 0x08);   //b3 is out, b2 is in (default)
-    delay_us(200);
-    
-    // Start in idle state
-    g_state = IDLE;
     
+    // Run whatever has been released, highest priority first, and idle
+    // until the next interrupt when there is nothing
     while(true)
     {
-        switch(g_state)
+        if (!sched_run())
         {
-            case IDLE:
-                idle_state();
-                break;
-            case DATA_RECEIVED:
-                data_received_state();
-                break;
-            case DATA_SENDING:
-                data_sending_state();
-                break;
-            case DATA_POLLING:
-                data_polling_state();
-                break;
-            default:
-                break;
+            sched_idle();
         }
     }
 }
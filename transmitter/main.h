@@ -1,5 +1,5 @@
 #include <18F26K80.h>
-#device adc=16
+#device adc=12
 
 #FUSES NOWDT                    //No Watch Dog Timer
 #FUSES SOSC_DIG                 //Digital mode, I/O port functionality of RC0 and RC1
@@ -13,18 +13,22 @@
 #FUSES NOPROTECT
 
 #use delay(clock = 20000000)
-#use rs232(baud = 115200, xmit = PIN_C6, rcv = PIN_C7)
+// Radio output goes out of a buffer from the transmit interrupt, so the core
+// can idle while a batch drains
+#use rs232(baud = 115200, xmit = PIN_C6, rcv = PIN_C7, ERRORS, TRANSMIT_BUFFER = 256, TXISR)
 
 #define RX_PIN   PIN_C2
 #define TX_PIN   PIN_C3
 #define XBEE_PIN PIN_C4
 
-// State machine states
-typedef enum
-{
-    IDLE,
-    DATA_RECEIVED,
-    DATA_SENDING,
-    DATA_POLLING,
-    N_STATES
-} telem_state_t;
+// Talk to the radio in escaped API mode (AP=2 in the xbee profiles), comment
+// out for transparent mode (AP=0)
+#define XBEE_API_MODE
+
+// 64 bit address of the ground station radio (SH/SL on its label), to match
+// DH/DL in the TX profile. Frames are unicast to it so the module acknowledges
+// and retries them and its TX status reports real delivery. With
+// XBEE_GROUND_SL left at 0 the address is taken from the first packet the
+// ground station sends, frames are broadcast until then.
+#define XBEE_GROUND_SH 0x0013A200
+#define XBEE_GROUND_SL 0x00000000
@@ -0,0 +1,74 @@
+// Spitfire telemetry selective retransmission
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Keeps the last few frames of critical pages so they can be resent when the
+// ground station reports their sequence numbers lost with CMD_NACK
+
+#define ARQ_CACHE_SIZE  4
+#define ARQ_PAYLOAD_LEN 32
+
+typedef struct
+{
+    int8  seq;
+    int8  id;
+    int8  flags;
+    int8  len;
+    int16 time;
+    int16 age;
+    int8  data[ARQ_PAYLOAD_LEN];
+} arq_entry_t;
+
+// Creates an array of retransmission enables
+static int1 gb_telem_critical[N_TELEM_ID] =
+{
+    TELEM_ID_TABLE(EXPAND_AS_TELEM_CRITICAL_ARRAY)
+};
+
+static arq_entry_t g_arq_cache[ARQ_CACHE_SIZE];
+static int1        gb_arq_valid[ARQ_CACHE_SIZE];
+static int8        g_arq_next = 0;
+
+// Stores a frame about to be sent with the given sequence number
+// The payload is stored before stream compression so a retransmission does
+// not depend on the compression history
+void arq_cache(int8 seq, int8 id, int8 flags, int8 len, int * data, int16 time, int16 age)
+{
+    arq_entry_t * e;
+    
+    if (len > ARQ_PAYLOAD_LEN)
+    {
+        return;
+    }
+    e = &g_arq_cache[g_arq_next];
+    e->seq   = seq;
+    e->id    = id;
+    e->flags = flags & ~(TELEM_FLAG_LZ | TELEM_FLAG_LZ_RESET);
+    e->len   = len;
+    e->time  = time;
+    e->age   = age;
+    memcpy(e->data,data,len);
+    gb_arq_valid[g_arq_next] = true;
+    
+    if (++g_arq_next >= ARQ_CACHE_SIZE)
+    {
+        g_arq_next = 0;
+    }
+}
+
+// Resends a cached frame, returns false if it is no longer cached
+int1 arq_retransmit(int8 seq)
+{
+    int8 i;
+    arq_entry_t * e;
+    
+    for (i = 0 ; i < ARQ_CACHE_SIZE ; i++)
+    {
+        e = &g_arq_cache[i];
+        if (gb_arq_valid[i] && (e->seq == seq))
+        {
+            put_frame(e->id,e->flags | TELEM_FLAG_RETX,e->seq,e->len,e->data,e->time,e->age);
+            return true;
+        }
+    }
+    return false;
+}
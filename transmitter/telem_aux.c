@@ -0,0 +1,175 @@
+// Spitfire telemetry aux pack and array current measurement
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// The analog side of the old TelemAux board. The aux pack taps (AN0-AN3,
+// through a divider chain) and the array current hall sensor (AN10) are
+// converted one per timer 2 tick in the background and filtered with
+// adc_filter.c. Every AUX_PERIOD_MS the cell voltages, array current and low
+// voltage flags are put in the TELEM_AUX_ANALOG page, and every
+// AUX_CAN_PERIOD_MS they are broadcast to the driver display in TelemAux's
+// 0x7A0 format.
+
+#include "adc_filter.h"
+
+#define AUX_N_CELLS         4
+#define AUX_N_ADC           5       // Aux pack taps then the hall sensor
+#define AUX_HALL_SEQ        4       // Position of the hall sensor in the sequence
+#define AUX_CIC_ORDER       2
+#define AUX_CIC_SHIFT       3       // 25 readings/s per channel at 1 conversion per ms
+#define AUX_CELL_IIR_SHIFT  2       // Damps the noise the cell subtraction amplifies
+#define AUX_HALL_IIR_SHIFT  0
+#define AUX_ADC_ONE         (1 << ADC_FILTER_FRAC_BITS)
+#define AUX_VOLTS_PER_UNIT  (5.0 / 4096 / AUX_ADC_ONE)
+#define AUX_CELL_WARN       2785    // Low voltage warning, 12 bit units (3.4V)
+#define AUX_CELL_ERR        2539    // Low voltage error, 12 bit units (3.1V)
+
+#define AUX_PERIOD_MS       50
+#define AUX_CAN_PERIOD_MS   250
+#define AUX_TIMEOUT_MS      500     // Page goes stale if the ADC stops
+
+const int8 g_aux_channel[AUX_N_ADC] = {0, 1, 2, 3, 10};
+
+static adc_filter_t g_aux_filter[AUX_N_ADC];
+static int16 g_aux_ready[AUX_N_ADC];    // Latest filter output of each channel
+static int8  g_aux_seq = 0;             // Position in the sequence being converted
+static int16 g_aux_cell[AUX_N_CELLS];   // 12 bit units, for the CAN broadcast
+static int16 g_aux_current;             // 12 bit units
+static int8  g_aux_flags;               // Bits 0-3 warning, 4-7 error, per cell
+static int32 g_aux_out_ms;              // g_ms at the last output of the sequence's last channel
+static int32 g_aux_can_stamp;
+static int1  gb_aux_valid = false;
+
+// Conversion done, filter it and select the next channel, which then has until
+// the next timer 2 tick to settle
+#int_ad
+void isr_ad(void)
+{
+    if (adc_filter_push(&g_aux_filter[g_aux_seq],read_adc(ADC_READ_ONLY)))
+    {
+        g_aux_ready[g_aux_seq] = g_aux_filter[g_aux_seq].out;
+        if (g_aux_seq == AUX_N_ADC - 1)
+        {
+            g_aux_out_ms = g_ms;
+        }
+    }
+    if (++g_aux_seq >= AUX_N_ADC)
+    {
+        g_aux_seq = 0;
+    }
+    set_adc_channel(g_aux_channel[g_aux_seq]);
+}
+
+void aux_init(void)
+{
+    int8 i;
+
+    for (i = 0 ; i < AUX_N_ADC ; i++)
+    {
+        adc_filter_init(&g_aux_filter[i],AUX_CIC_ORDER,AUX_CIC_SHIFT,
+                        (i == AUX_HALL_SEQ) ? AUX_HALL_IIR_SHIFT : AUX_CELL_IIR_SHIFT);
+    }
+
+    // The divider chain is high impedance, long acquisition time
+    setup_adc(ADC_CLOCK_DIV_64 | ADC_TAD_MUL_20);
+    setup_adc_ports(sAN0 | sAN1 | sAN2 | sAN3 | sAN10);
+    set_adc_channel(g_aux_channel[0]);
+    clear_interrupt(INT_AD);
+    enable_interrupts(INT_AD);
+}
+
+// Sends the cells, array current and flags to the driver display
+void aux_broadcast(void)
+{
+    int8 i;
+    int8 data[TELEM_AUX_BROADCAST_LEN];
+
+    for (i = 0 ; i < AUX_N_CELLS ; i++)
+    {
+        data[i] = (int8)(g_aux_cell[i] >> 4);
+    }
+    data[4] = make8(g_aux_current,0);
+    data[5] = make8(g_aux_current,1);
+    data[6] = g_aux_flags;
+    data[7] = 0;
+    can_putd(TELEM_AUX_BROADCAST_ID,data,TELEM_AUX_BROADCAST_LEN,3,0,0);
+}
+
+// Reads the latest filtered channels into the aux page
+void aux_update(int32 now)
+{
+    int8  i;
+    int16 ready[AUX_N_ADC];
+    int32 out_ms;
+    int32 raw;
+    signed int32 cell[AUX_N_CELLS];
+
+    disable_interrupts(GLOBAL);
+    memcpy(ready,g_aux_ready,sizeof(ready));
+    out_ms = g_aux_out_ms;
+    enable_interrupts(GLOBAL);
+
+    // Each tap is the sum of the cells below it, divided down by its
+    // position in the chain
+    cell[0] = ready[3];
+    cell[1] = 2*(signed int32)ready[2] - ready[3];
+    cell[2] = 3*(signed int32)ready[1] - 2*(signed int32)ready[2];
+    cell[3] = 4*(signed int32)ready[0] - 3*(signed int32)ready[1];
+
+    for (i = 0 ; i < AUX_N_CELLS ; i++)
+    {
+        if (cell[i] < 0)
+        {
+            cell[i] = 0;
+        }
+        g_aux_cell[i] = (int16)((cell[i] + AUX_ADC_ONE/2) / AUX_ADC_ONE);
+
+        bit_clear(g_aux_flags,i);
+        bit_clear(g_aux_flags,i+4);
+        if (g_aux_cell[i] <= AUX_CELL_ERR)
+        {
+            bit_set(g_aux_flags,i);
+            bit_set(g_aux_flags,i+4);
+        }
+        else if (g_aux_cell[i] <= AUX_CELL_WARN)
+        {
+            bit_set(g_aux_flags,i);
+        }
+
+        // Cell voltages go in the page at the filter's resolution
+        raw = f_PICtoIEEE((float32)cell[i] * AUX_VOLTS_PER_UNIT);
+        g_aux_analog_page[4*i+0] = make8(raw,0);
+        g_aux_analog_page[4*i+1] = make8(raw,1);
+        g_aux_analog_page[4*i+2] = make8(raw,2);
+        g_aux_analog_page[4*i+3] = make8(raw,3);
+    }
+    g_aux_current = (ready[AUX_HALL_SEQ] + AUX_ADC_ONE/2) / AUX_ADC_ONE;
+    g_aux_analog_page[16] = make8(g_aux_current,1);
+    g_aux_analog_page[17] = make8(g_aux_current,0);
+    g_aux_analog_page[18] = g_aux_flags;
+    g_telem_stamp[TELEM_AUX_ANALOG_INDEX] = out_ms;     // Ages with the ADC, not this update
+
+    // Readings are valid once the last channel in the sequence has been
+    // through its filter
+    if (!gb_aux_valid)
+    {
+        gb_aux_valid = g_aux_filter[AUX_HALL_SEQ].started;
+        g_aux_can_stamp = now;
+    }
+    else if (((now - g_aux_can_stamp) >= AUX_CAN_PERIOD_MS) && can_tbe())
+    {
+        g_aux_can_stamp = now;
+        aux_broadcast();
+    }
+}
+
+// Whether the aux page holds live readings, the filters must have produced
+// an output within AUX_TIMEOUT_MS
+int1 aux_fresh(int32 now)
+{
+    int32 out_ms;
+
+    disable_interrupts(GLOBAL);
+    out_ms = g_aux_out_ms;
+    enable_interrupts(GLOBAL);
+    return gb_aux_valid && ((now - out_ms) <= AUX_TIMEOUT_MS);
+}
@@ -0,0 +1,86 @@
+// Spitfire telemetry ground station commands
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Receives command frames from the ground station on the radio uart, see
+// telem_frame.h for the frame layout
+
+// Command receiver states
+#define CMD_RX_SYNC  0
+#define CMD_RX_CMD   1
+#define CMD_RX_LEN   2
+#define CMD_RX_ARGS  3
+#define CMD_RX_CRC   4
+
+static int8 g_cmd_rx_state = CMD_RX_SYNC;
+static int8 g_cmd_rx_count;
+static int8 g_cmd_rx_crc;
+static int8 g_cmd_code;
+static int8 g_cmd_len;
+static int8 g_cmd_args[TELEM_CMD_MAX_ARGS];
+static int1 gb_cmd_ready = false;
+
+// Feeds one received byte into the command receiver, called from the uart
+// receive interrupt. gb_cmd_ready is raised when a complete command with a
+// valid CRC is waiting, further bytes are dropped until it is handled.
+void cmd_rx_byte(int8 c)
+{
+    if (gb_cmd_ready)
+    {
+        return;
+    }
+    
+    switch (g_cmd_rx_state)
+    {
+        case CMD_RX_SYNC:
+            if (c == TELEM_CMD_SYNC)
+            {
+                g_cmd_rx_crc = 0;
+                g_cmd_rx_state = CMD_RX_CMD;
+            }
+            break;
+        case CMD_RX_CMD:
+            g_cmd_code = c;
+            g_cmd_rx_crc = g_crc8_table[g_cmd_rx_crc ^ c];
+            g_cmd_rx_state = CMD_RX_LEN;
+            break;
+        case CMD_RX_LEN:
+            g_cmd_len = c;
+            g_cmd_rx_count = 0;
+            g_cmd_rx_crc = g_crc8_table[g_cmd_rx_crc ^ c];
+            if (c > TELEM_CMD_MAX_ARGS)
+            {
+                g_cmd_rx_state = CMD_RX_SYNC;
+            }
+            else
+            {
+                g_cmd_rx_state = (c > 0) ? CMD_RX_ARGS : CMD_RX_CRC;
+            }
+            break;
+        case CMD_RX_ARGS:
+            g_cmd_args[g_cmd_rx_count++] = c;
+            g_cmd_rx_crc = g_crc8_table[g_cmd_rx_crc ^ c];
+            if (g_cmd_rx_count >= g_cmd_len)
+            {
+                g_cmd_rx_state = CMD_RX_CRC;
+            }
+            break;
+        case CMD_RX_CRC:
+        default:
+            if (c == g_cmd_rx_crc)
+            {
+                gb_cmd_ready = true;
+            }
+            g_cmd_rx_state = CMD_RX_SYNC;
+            break;
+    }
+}
+
+// Sends the acknowledge for a handled command
+void send_cmd_ack(int8 status, int16 time)
+{
+    int8 ack[2];
+    
+    ack[0] = g_cmd_code;
+    ack[1] = status;
+    send_frame(TELEM_ACK_ID,0,2,ack,time,0);
+}
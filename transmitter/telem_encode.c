@@ -0,0 +1,291 @@
+// Spitfire telemetry page encoding
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Packs telemetry pages into the fixed-point fields described by
+// TELEM_FIELD_TABLE before they are sent over the radio
+
+#define ENC_BUF_LEN 32
+
+// Delta coding of slowly changing pages
+#define DELTA_BASE_LEN      64  // Keyframe storage for all delta pages
+#define DELTA_KEY_PERIOD    10  // Sends between forced keyframes
+
+// Field descriptions, kept in program memory
+const int8 g_field_page[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_PAGE_ARRAY)
+};
+const int16 g_field_bitoff[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BITOFF_ARRAY)
+};
+const int8 g_field_kind[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_KIND_ARRAY)
+};
+const float32 g_field_scale[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_SCALE_ARRAY)
+};
+const float32 g_field_bias[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BIAS_ARRAY)
+};
+const int8 g_field_bits[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_BITS_ARRAY)
+};
+const int8 g_field_count[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_COUNT_ARRAY)
+};
+const int8 g_field_stride[N_TELEM_FIELD] =
+{
+    TELEM_FIELD_TABLE(EXPAND_AS_FIELD_STRIDE_ARRAY)
+};
+
+// Creates an array of delta coding enables
+static int1 gb_telem_delta[N_TELEM_ID] =
+{
+    TELEM_ID_TABLE(EXPAND_AS_TELEM_DELTA_ARRAY)
+};
+
+static int8  g_enc_buf[ENC_BUF_LEN];
+static int16 g_enc_bitpos;
+static int8  g_enc_flags;            // Frame flags for the contents of g_enc_buf
+static int8  g_enc_len[N_TELEM_ID];  // Encoded length of each page, 0 if sent raw
+static int1  gb_encode = true;       // Send pages encoded when shorter
+static int1  gb_delta = true;        // Send delta pages as deltas
+
+static int8  g_delta_base[DELTA_BASE_LEN];   // Last keyframe of each delta page
+static int8  g_delta_offset[N_TELEM_ID];     // Offset of each page in g_delta_base
+static int8  g_delta_tag[N_TELEM_ID];        // Tag of the last keyframe
+static int8  g_delta_count[N_TELEM_ID];      // Sends since the last keyframe
+
+// Reads an unsigned field of up to 16 bits from a page, MSB first
+int16 get_page_bits(int * page, int16 bitoff, int8 bits)
+{
+    int16 value = 0;
+    int8  i;
+
+    for (i = 0 ; i < bits ; i++)
+    {
+        value <<= 1;
+        if (bit_test(*(page + (bitoff >> 3)), 7 - (bitoff & 7)))
+        {
+            value |= 1;
+        }
+        bitoff++;
+    }
+    return value;
+}
+
+// Appends a field of up to 16 bits to the encoding buffer, MSB first
+void put_enc_bits(int16 value, int8 bits)
+{
+    int8 i;
+
+    for (i = bits ; i > 0 ; i--)
+    {
+        if (bit_test(value, i - 1))
+        {
+            bit_set(g_enc_buf[g_enc_bitpos >> 3], 7 - (g_enc_bitpos & 7));
+        }
+        g_enc_bitpos++;
+    }
+}
+
+// Converts a little endian IEEE float in a page to a clamped fixed-point value
+int16 encode_f32(int * page, int8 field, int16 bitoff)
+{
+    int8    i;
+    int32   raw = 0;
+    int32   max;
+    float32 value;
+
+    for (i = 0 ; i < 4 ; i++)
+    {
+        raw += (int32)(*(page + (bitoff >> 3) + i)) << (8*i);
+    }
+    value = f_IEEEtoPIC(raw) * g_field_scale[field] + g_field_bias[field];
+    max = ((int32)1 << g_field_bits[field]) - 1;
+
+    if (value <= 0)
+    {
+        return 0;
+    }
+    else if (value >= (float32)max)
+    {
+        return (int16)max;
+    }
+    return (int16)(value + 0.5);
+}
+
+// Works out the encoded length of every page, pages that would not get any
+// shorter are left raw
+void encode_init(void)
+{
+    int8  i;
+    int16 bits[N_TELEM_ID];
+
+    memset(bits,0,sizeof(bits));
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        bits[g_field_page[i]] += (int16)g_field_bits[i] * g_field_count[i];
+    }
+    for (i = 0 ; i < N_TELEM_ID ; i++)
+    {
+        g_enc_len[i] = (int8)((bits[i] + 7) >> 3);
+        if ((g_enc_len[i] >= g_telem_len[i]) || (g_enc_len[i] > ENC_BUF_LEN))
+        {
+            g_enc_len[i] = 0;
+        }
+    }
+    
+    // Reserve keyframe storage, delta coding is turned off for pages that
+    // do not fit
+    bits[0] = 0;
+    for (i = 0 ; i < N_TELEM_ID ; i++)
+    {
+        if (gb_telem_delta[i])
+        {
+            if ((bits[0] + g_telem_len[i] > DELTA_BASE_LEN) || (g_telem_len[i] + 1 > ENC_BUF_LEN))
+            {
+                gb_telem_delta[i] = false;
+            }
+            else
+            {
+                g_delta_offset[i] = (int8)bits[0];
+                bits[0] += g_telem_len[i];
+            }
+        }
+        g_delta_count[i] = 0;
+    }
+}
+
+// Copies a delta page into g_enc_buf as a new keyframe
+int8 keyframe_page(int8 page)
+{
+    int8 len = (int8)g_telem_len[page];
+    
+    g_delta_tag[page]++;
+    g_delta_count[page] = 1;
+    memcpy(&g_delta_base[g_delta_offset[page]],gp_telem_page[page],len);
+    g_enc_buf[0] = g_delta_tag[page];
+    memcpy(&g_enc_buf[1],gp_telem_page[page],len);
+    g_enc_flags = TELEM_FLAG_KEYFRAME;
+    return len + 1;
+}
+
+// Encodes a delta page into g_enc_buf against its last keyframe, falls back to
+// a keyframe when one is due or the delta would not be shorter
+// Returns the payload length, or 0 if the page is not delta coded
+int8 delta_page(int8 page)
+{
+    int8  i;
+    int8  len;
+    int8  nbitmap;
+    int8  zz;
+    int16 limit;
+    signed int16 d;
+    int * data;
+    int * base;
+    
+    if (!gb_delta || !gb_telem_delta[page])
+    {
+        return 0;
+    }
+    if ((g_delta_count[page] == 0) || (g_delta_count[page] >= DELTA_KEY_PERIOD))
+    {
+        return keyframe_page(page);
+    }
+    
+    len     = (int8)g_telem_len[page];
+    nbitmap = (len + 7) >> 3;
+    data    = gp_telem_page[page];
+    base    = &g_delta_base[g_delta_offset[page]];
+    limit   = (int16)len << 3;  // Anything longer than a keyframe is pointless
+    
+    memset(g_enc_buf,0,ENC_BUF_LEN);
+    g_enc_buf[0] = g_delta_tag[page];
+    g_enc_bitpos = (int16)(1 + nbitmap) << 3;
+    for (i = 0 ; i < len ; i++)
+    {
+        if (data[i] == base[i])
+        {
+            continue;
+        }
+        
+        // Wrap the difference into a signed byte, then zigzag it
+        d = (signed int16)data[i] - (signed int16)base[i];
+        if (d > 127)
+        {
+            d -= 256;
+        }
+        else if (d < -128)
+        {
+            d += 256;
+        }
+        zz = (d >= 0) ? (int8)(d << 1) : (int8)((-d << 1) - 1);
+        
+        if (g_enc_bitpos + 12 > limit)
+        {
+            return keyframe_page(page);
+        }
+        bit_set(g_enc_buf[1 + (i >> 3)], 7 - (i & 7));
+        if (zz < TELEM_DELTA_ESCAPE)
+        {
+            put_enc_bits(zz,4);
+        }
+        else
+        {
+            put_enc_bits(TELEM_DELTA_ESCAPE,4);
+            put_enc_bits(zz,8);
+        }
+    }
+    
+    g_delta_count[page]++;
+    g_enc_flags = TELEM_FLAG_DELTA;
+    return (int8)((g_enc_bitpos + 7) >> 3);
+}
+
+// Encodes a page into g_enc_buf, returns the encoded length or 0 if the page
+// should be sent raw
+int8 encode_page(int8 page)
+{
+    int8  i;
+    int8  n;
+    int16 bitoff;
+    int16 value;
+
+    if (!gb_encode || (g_enc_len[page] == 0))
+    {
+        return 0;
+    }
+
+    memset(g_enc_buf,0,ENC_BUF_LEN);
+    g_enc_bitpos = 0;
+    g_enc_flags = TELEM_FLAG_ENCODED;
+    for (i = 0 ; i < N_TELEM_FIELD ; i++)
+    {
+        if (g_field_page[i] != page)
+        {
+            continue;
+        }
+        bitoff = g_field_bitoff[i];
+        for (n = 0 ; n < g_field_count[i] ; n++)
+        {
+            if (g_field_kind[i] == FIELD_F32)
+            {
+                value = encode_f32(gp_telem_page[page],i,bitoff);
+            }
+            else
+            {
+                value = get_page_bits(gp_telem_page[page],bitoff,g_field_bits[i]);
+            }
+            put_enc_bits(value,g_field_bits[i]);
+            bitoff += g_field_stride[i];
+        }
+    }
+    return g_enc_len[page];
+}
@@ -0,0 +1,137 @@
+#ifndef TELEM_FRAME_H
+#define TELEM_FRAME_H
+
+// Radio frame layout shared by the transmitter firmware and the receiver
+// library. Every telemetry page is wrapped as:
+//
+//   SYNC | ID | FLAGS | SEQ | LEN | TIME_LO | TIME_HI | AGE_LO | AGE_HI | PAYLOAD[LEN] | CRC
+//
+// TIME is the transmitter's free-running millisecond counter at the moment the
+// frame is sent, AGE is the number of milliseconds since the page was last
+// updated from CAN (saturated at 0xFFFF). The source timestamp of the page is
+// therefore TIME - AGE in the transmitter's clock domain.
+// FLAGS describe the payload, a stale page is sent as a header with
+// TELEM_FLAG_STALE set and no payload.
+// SEQ counts every frame sent so the receiver can spot lost frames, a
+// retransmitted frame keeps its original SEQ, TIME and AGE.
+// CRC is a CRC-8 (polynomial 0x07, init 0x00) over ID through the last payload
+// byte, SYNC is not included.
+// IDs from TELEM_CONTROL_ID_BASE up are control frames generated by the
+// transmitter itself rather than telemetry pages.
+
+#define TELEM_SYNC            0xA5
+#define TELEM_CRC_POLY        0x07
+
+#define TELEM_HEADER_ID       0
+#define TELEM_HEADER_FLAGS    1
+#define TELEM_HEADER_SEQ      2
+#define TELEM_HEADER_LEN      3
+#define TELEM_HEADER_TIME     4
+#define TELEM_HEADER_AGE      6
+#define TELEM_HEADER_SIZE     8   // Header bytes following SYNC
+#define TELEM_FRAME_OVERHEAD  10  // SYNC + header + CRC
+
+// Frame flags
+#define TELEM_FLAG_STALE      0x01  // No CAN data within the timeout, no payload
+#define TELEM_FLAG_ENCODED    0x02  // Payload packed per TELEM_FIELD_TABLE
+#define TELEM_FLAG_KEYFRAME   0x04  // Payload is TAG | raw page, new delta base
+#define TELEM_FLAG_DELTA      0x08  // Payload is TAG | BITMAP | NIBBLES
+
+// Delta frames carry the tag of the keyframe they were taken against, a bitmap
+// with one bit per page byte (MSB first) marking changed bytes, and for each
+// changed byte the zigzag encoded difference to the keyframe as a nibble.
+// Differences that do not fit in a nibble are sent as the escape nibble
+// followed by the full zigzag byte.
+#define TELEM_DELTA_ESCAPE    0x0F
+
+#define TELEM_FLAG_LZ         0x10  // Payload is LZ compressed against the stream history
+#define TELEM_FLAG_LZ_RESET   0x20  // Stream history is cleared before this frame
+#define TELEM_FLAG_RETX       0x40  // Retransmission of a critical frame
+
+// LZ compressed payloads reference a 256 byte history of the uncompressed
+// payloads of every page frame sent since the last reset, compressed or not.
+// Control frames and retransmissions are never compressed and are not part
+// of the history. The payload is POS | (FLAGS | 8 tokens)... where POS is the
+// history position (bytes since the reset, mod 256) before this frame so the
+// receiver can tell it has missed a frame. Each FLAGS bit (MSB first) selects
+// a match token, DIST | LEN copying LEN bytes from DIST bytes back, or a
+// literal byte.
+#define TELEM_LZ_WINDOW       256
+#define TELEM_LZ_MIN_MATCH    3
+#define TELEM_LZ_HASH_SIZE    64
+#define TELEM_LZ_HASH(a,b,c)  (((a) ^ ((b) << 1) ^ ((c) << 2)) & (TELEM_LZ_HASH_SIZE-1))
+
+#define TELEM_AGE_MAX         0xFFFF
+
+#define TELEM_CONTROL_ID_BASE 0x40
+#define TELEM_ACK_ID          0x40  // Command acknowledge, payload CMD | STATUS
+#define TELEM_LINK_ID         0x41  // Link statistics, see below
+#define TELEM_SCHED_ID        0x42  // Scheduler statistics, see below
+
+// Link statistics are sent every LINK_PERIOD_MS:
+//
+//   RSSI | TX_OK | TX_FAIL | RETRIES | NACKS | LOSS | PERIOD | MODE
+//
+// RSSI, LOSS and MODE are single bytes, the others 16 bit little endian.
+// RSSI is -dBm of the last packet the transmitter radio received (0 if
+// unknown). TX_OK, TX_FAIL and RETRIES are the running XBee TX status
+// counters, NACKS the running count of frames the ground station asked for
+// (repeated NACKs for the same frame count once). LOSS is the loss the rate
+// controller acted on, in 1/256ths, PERIOD the resulting sending period in ms
+// and MODE the TELEM_LINK_MODE_* bits in use.
+#define TELEM_LINK_LEN        13
+#define TELEM_LINK_MODE_LZ    0x01
+
+// Scheduler statistics are sent every SCHED_STATS_PERIOD_MS:
+//
+//   N | (RUNS | BUSY | MAX | LATE | SKIPPED) x N | DUTY
+//
+// N, LATE and SKIPPED are single bytes, RUNS, BUSY, MAX and DUTY 16 bit
+// little endian, so each task entry is TELEM_SCHED_TASK_LEN bytes. There is
+// one entry per task of TELEM_TASK_TABLE (telem_sched.h) in table order,
+// all counted since the previous statistics frame. BUSY is the share of the
+// time spent running the task in 1/1000ths, MAX its longest run in us
+// (saturated at 0xFFFF), LATE the runs that missed their deadline and SKIPPED
+// the releases that came while the task was still waiting to run. DUTY is the
+// share of the time the core was not idle, interrupts included, in 1/1000ths.
+#define TELEM_SCHED_TASK_LEN  8
+
+// Command frames sent from the ground station to the transmitter:
+//
+//   CMD_SYNC | CMD | LEN | ARGS[LEN] | CRC
+//
+// CRC is the same CRC-8 over CMD through the last argument byte. 16 bit
+// arguments are little endian. Every command is answered with a
+// TELEM_ACK_ID frame, except CMD_NACK which is answered by the retransmitted
+// frames and CMD_LINK_REPORT which is sent periodically anyway. CMD_NACK
+// carries 1 to TELEM_CMD_MAX_ARGS sequence numbers of lost frames, only
+// frames of pages marked critical in TELEM_ID_TABLE are kept for
+// retransmission. CMD_LINK_REPORT carries the loss the ground station sees in
+// 1/256ths and its RSSI in -dBm (0 if unknown).
+#define TELEM_CMD_SYNC        0x5A
+#define TELEM_CMD_MAX_ARGS    8
+
+#define EXPAND_AS_CMD_ENUM(a,b,c)     a = b,
+#define EXPAND_AS_CMD_LEN_ENUM(a,b,c) a##_LEN = c,
+
+// X macro table of ground station commands
+//        Command              , Code, Argument length
+#define TELEM_CMD_TABLE(ENTRY)              \
+    ENTRY(CMD_SET_SEND_PERIOD  , 0x01, 2)   \
+    ENTRY(CMD_SET_POLL_PERIOD  , 0x02, 2)   \
+    ENTRY(CMD_PAGE_ENABLE      , 0x03, 2)   \
+    ENTRY(CMD_SNAPSHOT         , 0x04, 0)   \
+    ENTRY(CMD_POLL_ENABLE      , 0x05, 2)   \
+    ENTRY(CMD_NACK             , 0x06, TELEM_CMD_MAX_ARGS)   \
+    ENTRY(CMD_LINK_REPORT      , 0x07, 2)
+#define N_TELEM_CMD 7
+
+enum {TELEM_CMD_TABLE(EXPAND_AS_CMD_ENUM)};
+enum {TELEM_CMD_TABLE(EXPAND_AS_CMD_LEN_ENUM)};
+
+// Acknowledge status codes
+#define CMD_STATUS_OK         0x00
+#define CMD_STATUS_BAD_ARGS   0x01
+#define CMD_STATUS_UNKNOWN    0x02
+
+#endif
@@ -0,0 +1,195 @@
+// Spitfire telemetry link quality
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Adapts the sending period and stream compression to the loss seen on the
+// radio link and reports the link statistics to the ground station, see
+// telem_frame.h for the statistics frame
+
+#define LINK_PERIOD_MS       500    // Time between controller updates
+#define LINK_MAX_PERIOD_MS   500    // Slowest the sending period backs off to
+#define LINK_PERIOD_STEP_MS  5      // Sending period decrease per clean update
+#define LINK_LOSS_HIGH       13     // Loss that halves the page rate, ~5%
+#define LINK_LOSS_LZ_OFF     26     // Loss that turns off compression, ~10%
+#define LINK_CLEAN_LZ_ON     6      // Clean updates before compression returns
+#define LINK_REPORT_TIMEOUT  4      // Updates without a report before backing off
+#define LINK_RSSI_WEAK       95     // Ground RSSI (-dBm) at which the rate is held
+
+static int16 g_link_floor_ms = SENDING_PERIOD_MS;   // Fastest period, set from the ground station
+static int8  g_link_loss = 0;       // Last loss reported by the ground station, 1/256ths
+static int8  g_link_rssi = 0;       // Last RSSI reported by the ground station, -dBm
+static int1  gb_link_reported = false;
+static int8  g_link_silent = 0;     // Updates since the last report
+static int8  g_link_clean = 0;      // Updates in a row below LINK_LOSS_HIGH
+static int16 g_link_nacks = 0;      // Sequence numbers NACKed, running count
+static int16 g_link_last_nacks = 0;
+static int8  g_link_last_seq = 0;
+static int8  g_link_nacked[32];     // One bit per sequence number already counted
+static int8  g_link_clear_seq = 0;  // First sequence number sent since the bits were cleared
+
+// Records a link report from the ground station
+void link_report(int8 loss, int8 rssi)
+{
+    g_link_loss = loss;
+    g_link_rssi = rssi;
+    g_link_silent = 0;
+    gb_link_reported = true;
+}
+
+// Forgets the NACKs of earlier uses of the sequence numbers sent since the
+// last call
+void link_clear_nacked(void)
+{
+    while (g_link_clear_seq != g_frame_seq)
+    {
+        bit_clear(g_link_nacked[g_link_clear_seq >> 3],g_link_clear_seq & 7);
+        g_link_clear_seq++;
+    }
+}
+
+// Counts a sequence number NACKed by the ground station
+// The receiver repeats a NACK until the frame arrives or it gives up, only
+// the first one for each frame sent is counted
+void link_nack(int8 seq)
+{
+    link_clear_nacked();
+    if (!bit_test(g_link_nacked[seq >> 3],seq & 7))
+    {
+        bit_set(g_link_nacked[seq >> 3],seq & 7);
+        g_link_nacks++;
+    }
+}
+
+// Sets the fastest sending period the controller may use
+void link_set_floor(int16 period_ms)
+{
+    g_link_floor_ms = period_ms;
+    disable_interrupts(GLOBAL);
+    g_sending_period_ms = period_ms;
+    enable_interrupts(GLOBAL);
+}
+
+// Works out the current loss in 1/256ths, the worse of the ground station's
+// report and the share of frames sent since the last update that were NACKed
+int8 link_loss(void)
+{
+    int8  sent   = g_frame_seq - g_link_last_seq;
+    int16 nacked = g_link_nacks - g_link_last_nacks;
+    int16 loss   = 0;
+    
+    link_clear_nacked();
+    if (sent > 0)
+    {
+        loss = (nacked >= sent) ? 255 : (int16)(((int32)nacked << 8) / sent);
+    }
+    if (gb_link_reported)
+    {
+        if (g_link_silent >= LINK_REPORT_TIMEOUT)
+        {
+            loss = 255;     // Reports stopped arriving, the uplink is gone
+        }
+        else
+        {
+            g_link_silent++;
+            if (g_link_loss > loss)
+            {
+                loss = g_link_loss;
+            }
+        }
+    }
+    
+    g_link_last_seq = g_frame_seq;
+    g_link_last_nacks = g_link_nacks;
+    return (int8)loss;
+}
+
+// Sends the link statistics frame
+void send_link_stats(int8 loss, int16 time)
+{
+    int8  stats[TELEM_LINK_LEN];
+    int16 tx_ok = 0;
+    int16 tx_fail = 0;
+    int16 retries = 0;
+    int8  rssi = 0;
+    
+#ifdef XBEE_API_MODE
+    tx_ok = g_xbee_tx_ok;
+    tx_fail = g_xbee_tx_fail;
+    retries = g_xbee_retries;
+    rssi = g_xbee_rssi;
+#endif
+    stats[0]  = rssi;
+    stats[1]  = make8(tx_ok,0);
+    stats[2]  = make8(tx_ok,1);
+    stats[3]  = make8(tx_fail,0);
+    stats[4]  = make8(tx_fail,1);
+    stats[5]  = make8(retries,0);
+    stats[6]  = make8(retries,1);
+    stats[7]  = make8(g_link_nacks,0);
+    stats[8]  = make8(g_link_nacks,1);
+    stats[9]  = loss;
+    stats[10] = make8(g_sending_period_ms,0);
+    stats[11] = make8(g_sending_period_ms,1);
+    stats[12] = gb_lz ? TELEM_LINK_MODE_LZ : 0;
+    send_frame(TELEM_LINK_ID,0,TELEM_LINK_LEN,stats,time,0);
+}
+
+// Runs the rate controller, every LINK_PERIOD_MS
+// The page rate backs off multiplicatively when loss goes above
+// LINK_LOSS_HIGH and creeps back up by LINK_PERIOD_STEP_MS per clean update,
+// it is held while the ground station reports a weak signal.
+// Stream compression is turned off under heavy loss, a single lost frame
+// leaves the receiver unable to expand anything until the next history reset,
+// and comes back once the link has been clean for a while.
+void link_update(int16 time)
+{
+    int8  loss = link_loss();
+    int16 period = g_sending_period_ms;
+    
+    if (loss >= LINK_LOSS_HIGH)
+    {
+        g_link_clean = 0;
+        period <<= 1;
+        if (period > LINK_MAX_PERIOD_MS)
+        {
+            period = LINK_MAX_PERIOD_MS;
+        }
+    }
+    else if ((g_link_rssi >= LINK_RSSI_WEAK) && (period > g_link_floor_ms))
+    {
+        // Still getting through but close to the sensitivity limit, hold
+        g_link_clean = 0;
+    }
+    else
+    {
+        if (g_link_clean < 255)
+        {
+            g_link_clean++;
+        }
+        if (period >= g_link_floor_ms + LINK_PERIOD_STEP_MS)
+        {
+            period -= LINK_PERIOD_STEP_MS;
+        }
+        else
+        {
+            period = g_link_floor_ms;
+        }
+    }
+    if (period < g_link_floor_ms)
+    {
+        period = g_link_floor_ms;
+    }
+    disable_interrupts(GLOBAL);
+    g_sending_period_ms = period;
+    enable_interrupts(GLOBAL);
+    
+    if ((loss >= LINK_LOSS_LZ_OFF) && gb_lz)
+    {
+        lz_enable(false);
+    }
+    else if (!gb_lz && (g_link_clean >= LINK_CLEAN_LZ_ON))
+    {
+        lz_enable(true);
+    }
+    
+    send_link_stats(loss,time);
+}
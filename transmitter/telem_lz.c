@@ -0,0 +1,140 @@
+// Spitfire telemetry stream compression
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Small LZ compressor for frame payloads, matches are found in a 256 byte
+// history of everything sent since the last reset, see telem_frame.h
+
+#define LZ_BUF_LEN       40
+#define LZ_RESET_PERIOD  64  // Frames between history resets
+
+static int8 g_lz_ring[TELEM_LZ_WINDOW];
+static int8 g_lz_hash[TELEM_LZ_HASH_SIZE];
+static int8 g_lz_buf[LZ_BUF_LEN];
+static int8 g_lz_pos;        // Next history position, wraps with the window
+static int8 g_lz_frames;     // Frames since the last reset
+static int1 gb_lz = true;    // Compress frame payloads
+
+// Clears the history, the receiver does the same on TELEM_FLAG_LZ_RESET
+void lz_reset(void)
+{
+    memset(g_lz_ring,0,TELEM_LZ_WINDOW);
+    memset(g_lz_hash,0,TELEM_LZ_HASH_SIZE);
+    g_lz_pos = 0;
+}
+
+// Returns true if the next frame has to reset the history
+int1 lz_reset_due(void)
+{
+    int1 b_due = (g_lz_frames == 0);
+    
+    if (++g_lz_frames >= LZ_RESET_PERIOD)
+    {
+        g_lz_frames = 0;
+    }
+    return b_due;
+}
+
+// Turns compression on or off, the first frame after turning it back on
+// resets the history since the receiver kept adding to its copy meanwhile
+void lz_enable(int1 b_enable)
+{
+    if (b_enable && !gb_lz)
+    {
+        g_lz_frames = 0;
+    }
+    gb_lz = b_enable;
+}
+
+// Compresses a payload into g_lz_buf and adds it to the history
+// Returns the compressed length, or 0 if compression did not make the payload
+// shorter, the payload is added to the history either way
+int8 lz_compress(int * data, int8 len)
+{
+    int8 i = 0;
+    int8 k;
+    int8 out = 0;
+    int8 flag = 0;
+    int8 bit = 0;
+    int8 h;
+    int8 cand;
+    int8 dist;
+    int8 n;
+    int1 b_fail = false;
+    
+    if (len <= TELEM_LZ_MIN_MATCH)
+    {
+        while (i < len)
+        {
+            g_lz_ring[g_lz_pos++] = data[i++];
+        }
+        return 0;
+    }
+    
+    g_lz_buf[out++] = g_lz_pos;
+    while (i < len)
+    {
+        if (bit == 0)
+        {
+            flag = out++;
+            g_lz_buf[flag] = 0;
+            bit = 0x80;
+        }
+        
+        // Look for a match at the last position these three bytes were seen
+        n = 0;
+        if (i + TELEM_LZ_MIN_MATCH <= len)
+        {
+            h = TELEM_LZ_HASH(data[i],data[i+1],data[i+2]);
+            cand = g_lz_hash[h];
+            dist = g_lz_pos - cand;
+            g_lz_hash[h] = g_lz_pos;
+            while ((dist != 0) && (n < dist) && (i + n < len) && (g_lz_ring[(int8)(cand+n)] == data[i+n]))
+            {
+                n++;
+            }
+        }
+        
+        if (n >= TELEM_LZ_MIN_MATCH)
+        {
+            if (out + 2 >= len)
+            {
+                b_fail = true;
+            }
+            else
+            {
+                g_lz_buf[flag] |= bit;
+                g_lz_buf[out++] = dist;
+                g_lz_buf[out++] = n;
+            }
+        }
+        else
+        {
+            n = 1;
+            if (out + 1 >= len)
+            {
+                b_fail = true;
+            }
+            else
+            {
+                g_lz_buf[out++] = data[i];
+            }
+        }
+        
+        for (k = 0 ; k < n ; k++)
+        {
+            g_lz_ring[g_lz_pos++] = data[i++];
+        }
+        bit >>= 1;
+        
+        // Not worth it, just finish adding the payload to the history
+        if (b_fail)
+        {
+            while (i < len)
+            {
+                g_lz_ring[g_lz_pos++] = data[i++];
+            }
+            return 0;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,208 @@
+// Spitfire telemetry task scheduler
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Cooperative run to completion scheduler for the tasks in TELEM_TASK_TABLE
+// with per task run time and deadline accounting, see telem_sched.h
+
+#include "telem_sched.h"
+
+#bit OSCCON_IDLEN = 0xFD3.7     // sleep() idles the core instead of stopping the clock
+
+TELEM_TASK_TABLE(EXPAND_AS_TASK_PROTOTYPE)
+
+// Deadline of each task after its release, in ms
+const int16 g_task_deadline[N_TELEM_TASK] =
+{
+    TELEM_TASK_TABLE(EXPAND_AS_TASK_DEADLINE_ARRAY)
+};
+
+// Released tasks, whole bytes since the tick and the main loop both write them
+static int8  g_task_ready[N_TELEM_TASK];
+static int8  g_task_deferred[N_TELEM_TASK]; // Ready again at the next tick
+static int1  gb_sched_deferred;             // The running task deferred itself
+static int32 g_task_release[N_TELEM_TASK];  // g_ms at the last release
+static int16 g_task_ms[N_TELEM_TASK];       // Ticks since the last periodic release
+
+// Accounting since the last statistics frame
+static int16 g_task_runs[N_TELEM_TASK];
+static int32 g_task_busy[N_TELEM_TASK];     // Timer 1 ticks spent running
+static int16 g_task_max[N_TELEM_TASK];      // Longest run in timer 1 ticks
+static int8  g_task_late[N_TELEM_TASK];
+static int8  g_task_skipped[N_TELEM_TASK];
+static int32 g_sched_idle;                  // Timer 1 ticks spent idle
+static int32 g_sched_window;                // Timer 1 ticks since the last statistics frame
+static int16 g_sched_t1;                    // Timer 1 when g_sched_window was last updated
+
+// Releases a task, only from interrupts or with interrupts disabled
+#define SCHED_POST(t)                                         \
+    if (g_task_ready[t] || g_task_deferred[t])                \
+    {                                                         \
+        if (g_task_skipped[t] < 255) g_task_skipped[t]++;     \
+    }                                                         \
+    else                                                      \
+    {                                                         \
+        g_task_ready[t] = true;                               \
+        g_task_release[t] = g_ms;                             \
+    }
+
+// Releases a task from the main loop
+void sched_post(int8 task)
+{
+    disable_interrupts(GLOBAL);
+    SCHED_POST(task);
+    enable_interrupts(GLOBAL);
+}
+
+// Runs a task again at the next tick, from the task itself when it cannot do
+// its work yet. It keeps its release time so the wait counts towards its
+// deadline
+void sched_defer(int8 task)
+{
+    disable_interrupts(GLOBAL);
+    g_task_deferred[task] = true;
+    enable_interrupts(GLOBAL);
+    gb_sched_deferred = true;
+}
+
+void sched_init(void)
+{
+    setup_timer_1(T1_INTERNAL | T1_DIV_BY_8);
+    g_sched_t1 = get_timer1();
+    OSCCON_IDLEN = 1;
+}
+
+// Adds the timer 1 ticks since the last call to the statistics window
+// Called on every pass of the main loop, so the timer cannot wrap in between
+void sched_mark(void)
+{
+    int16 t1 = get_timer1();
+
+    g_sched_window += (int16)(t1 - g_sched_t1);
+    g_sched_t1 = t1;
+}
+
+// Runs the highest priority released task to completion
+// Returns false if no task was released
+int1 sched_run(void)
+{
+    int8  i;
+    int8  task = N_TELEM_TASK;
+    int16 start;
+    int16 ticks;
+    int32 release;
+
+    sched_mark();
+    disable_interrupts(GLOBAL);
+    for (i = 0 ; i < N_TELEM_TASK ; i++)
+    {
+        if (g_task_ready[i])
+        {
+            g_task_ready[i] = false;
+            release = g_task_release[i];
+            task = i;
+            break;
+        }
+    }
+    enable_interrupts(GLOBAL);
+    if (task == N_TELEM_TASK)
+    {
+        return false;
+    }
+
+    gb_sched_deferred = false;
+    start = get_timer1();
+    switch (task)
+    {
+        TELEM_TASK_TABLE(EXPAND_AS_TASK_CASE)
+    }
+    ticks = get_timer1() - start;
+
+    g_task_runs[task]++;
+    g_task_busy[task] += ticks;
+    if (ticks > g_task_max[task])
+    {
+        g_task_max[task] = ticks;
+    }
+    // A deferred task is judged when it does finish
+    if (!gb_sched_deferred && ((get_ms() - release) > g_task_deadline[task]))
+    {
+        if (g_task_late[task] < 255)
+        {
+            g_task_late[task]++;
+        }
+    }
+    return true;
+}
+
+// Idles the core until the next interrupt unless a task has been released
+// Interrupts stay disabled from the check until after the wake up so a post
+// cannot slip in between, an enabled interrupt still wakes the core and is
+// serviced once they are enabled again. No interrupt goes more than 1ms
+// without the tick, so the idle time fits the 16 bit timer.
+void sched_idle(void)
+{
+    int8  i;
+    int16 start;
+
+    disable_interrupts(GLOBAL);
+    for (i = 0 ; i < N_TELEM_TASK ; i++)
+    {
+        if (g_task_ready[i])
+        {
+            enable_interrupts(GLOBAL);
+            return;
+        }
+    }
+    start = get_timer1();
+    sleep();
+    g_sched_idle += (int16)(get_timer1() - start);
+    enable_interrupts(GLOBAL);
+}
+
+// Sends the scheduler statistics frame and starts counting afresh
+void sched_stats_task(void)
+{
+    int8  i;
+    int8  stats[1 + N_TELEM_TASK*TELEM_SCHED_TASK_LEN + 2];
+    int8  * p = stats + 1;
+    int16 busy;
+    int32 us;
+
+    // Shares are of the time since the last frame as timer 1 measured it
+    sched_mark();
+    stats[0] = N_TELEM_TASK;
+    for (i = 0 ; i < N_TELEM_TASK ; i++)
+    {
+        busy = (int16)((g_task_busy[i] * 1000) / g_sched_window);
+        us = ((int32)g_task_max[i] * 1000) / SCHED_TICKS_PER_MS;
+        if (us > 0xFFFF)
+        {
+            us = 0xFFFF;
+        }
+        *p++ = make8(g_task_runs[i],0);
+        *p++ = make8(g_task_runs[i],1);
+        *p++ = make8(busy,0);
+        *p++ = make8(busy,1);
+        *p++ = make8(us,0);
+        *p++ = make8(us,1);
+        *p++ = g_task_late[i];
+        disable_interrupts(GLOBAL);
+        *p++ = g_task_skipped[i];
+        g_task_skipped[i] = 0;
+        enable_interrupts(GLOBAL);
+        g_task_runs[i] = 0;
+        g_task_busy[i] = 0;
+        g_task_max[i] = 0;
+        g_task_late[i] = 0;
+    }
+
+    // Everything that is not idle counts, interrupts included, the idle time
+    // lies within the window
+    busy = 1000 - (int16)((g_sched_idle * 1000) / g_sched_window);
+    *p++ = make8(busy,0);
+    *p++ = make8(busy,1);
+    g_sched_idle = 0;
+    g_sched_window = 0;
+
+    send_frame(TELEM_SCHED_ID,0,sizeof(stats),stats,(int16)get_ms(),0);
+}
@@ -0,0 +1,60 @@
+#ifndef TELEM_SCHED_H
+#define TELEM_SCHED_H
+
+// Spitfire telemetry task scheduler
+// Every piece of work the transmitter does is a task in TELEM_TASK_TABLE. A
+// task is released every Period ms by the timer 2 tick, or posted by an
+// interrupt when it has work. The main loop runs the first released task in
+// table order to completion, then looks again from the top, so the order is
+// the priority. A task that is released again before it has run is counted as
+// skipped, one that finishes more than Deadline ms after its release as late.
+// A task that cannot do its work yet defers itself to the next tick, keeping
+// its release time.
+// Run time is measured with timer 1 as a free-running 1.6us counter, so a
+// single run must take less than 104ms to be timed correctly.
+//
+// When nothing is released the core idles (IDLEN set, peripherals keep their
+// clock) until the next interrupt: the tick, CAN receive, the uart receive or
+// the uart transmit buffer emptying. The time spent idle gives the duty cycle
+// in the statistics frame.
+//
+// The table is shared with the receiver for the task names, the functions and
+// periods only mean something in transmitter/main.c.
+
+#define SCHED_STATS_PERIOD_MS 1000    // Time between scheduler statistics frames
+#define SCHED_TICKS_PER_MS    625     // Timer 1 at Fosc/4/8 with a 20MHz clock
+
+#define EXPAND_AS_TASK_ENUM(a,b,c,d)           a,
+#define EXPAND_AS_TASK_NAME_ARRAY(a,b,c,d)     #a,
+#define EXPAND_AS_TASK_DEADLINE_ARRAY(a,b,c,d) d,
+#define EXPAND_AS_TASK_PROTOTYPE(a,b,c,d)      void b(void);
+#define EXPAND_AS_TASK_CASE(a,b,c,d)           case a: b(); break;
+#define EXPAND_AS_TASK_TICK(a,b,c,d)                  \
+    if (g_task_deferred[a])                           \
+    {                                                 \
+        g_task_deferred[a] = false;                   \
+        g_task_ready[a] = true;                       \
+    }                                                 \
+    if (((c) > 0) && (++g_task_ms[a] >= (c)))         \
+    {                                                 \
+        g_task_ms[a] = 0;                             \
+        SCHED_POST(a);                                \
+    }
+
+// X macro table of transmitter tasks, highest priority first
+// Period is in ms and may be a variable, 0 for tasks that only run when posted
+//        Task         , Function           , Period               , Deadline
+#define TELEM_TASK_TABLE(ENTRY)                                                \
+    ENTRY(TASK_CAN_RX  , can_rx_task        , 0                    ,  5) \
+    ENTRY(TASK_COMMAND , command_task       , 0                    , 20) \
+    ENTRY(TASK_SEND    , data_sending_task  , g_sending_period_ms  , 10) \
+    ENTRY(TASK_POLL    , data_polling_task  , g_polling_period_ms  , 20) \
+    ENTRY(TASK_LINK    , link_update_task   , LINK_PERIOD_MS       , 50) \
+    ENTRY(TASK_AUX     , aux_update_task    , AUX_PERIOD_MS        , 20) \
+    ENTRY(TASK_FLUSH   , data_flushing_task , FLUSH_CHECK_MS       , 10) \
+    ENTRY(TASK_STATS   , sched_stats_task   , SCHED_STATS_PERIOD_MS, 50)
+#define N_TELEM_TASK 8
+
+enum {TELEM_TASK_TABLE(EXPAND_AS_TASK_ENUM)};
+
+#endif
@@ -0,0 +1,262 @@
+// Spitfire telemetry XBee API mode driver
+// Author: Andy Li
+// Copyright 2016, McMaster Solar Car Project
+// Batches radio frames into XBee transmit requests and reads TX status, RSSI
+// and received data back from the module, see xbee_api.h
+
+#include "xbee_api.h"
+
+#define XBEE_BATCH_LEN      200     // RF payload per transmit request
+#define XBEE_FLUSH_MS       100     // Longest a frame waits for a batch to fill
+#define XBEE_RX_BUF_LEN     9       // Frame data kept, up to a packet's source address
+
+// 64 bit destination address, big endian, broadcast until the ground station
+// radio is known
+static int8  g_xbee_dest[8] = {0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0xFF};
+static int1  gb_xbee_dest_known = false;
+
+static int8  g_xbee_batch[XBEE_BATCH_LEN];
+static int8  g_xbee_batch_len = 0;
+static int8  g_xbee_batch_start;    // Low byte of g_ms when the batch was started
+static int8  g_xbee_frame_id = 0;
+
+// Link statistics from the module
+static int16 g_xbee_tx_ok = 0;      // Transmit requests delivered
+static int16 g_xbee_tx_fail = 0;    // Transmit requests that failed
+static int16 g_xbee_retries = 0;    // MAC retries reported in TX status
+static int8  g_xbee_rssi = 0;       // -dBm of the last received packet
+
+// API receive state
+static int8  g_xbee_rx_state = 0;
+static int16 g_xbee_rx_len;
+static int16 g_xbee_rx_count;
+static int8  g_xbee_rx_sum;
+static int1  gb_xbee_rx_escape = false;
+static int8  g_xbee_rx_buf[XBEE_RX_BUF_LEN];
+static int8  g_xbee_rx_data;        // Last RF data byte received
+
+// Writes a byte of an API frame to the module, escaping it if necessary
+void xbee_putc(int8 c)
+{
+    if ((c == XBEE_START) || (c == XBEE_ESCAPE) || (c == XBEE_XON) || (c == XBEE_XOFF))
+    {
+        putc(XBEE_ESCAPE);
+        putc(c ^ XBEE_ESCAPE_XOR);
+    }
+    else
+    {
+        putc(c);
+    }
+}
+
+// Sets the 64 bit address frames are unicast to
+void xbee_set_dest(int32 sh, int32 sl)
+{
+    disable_interrupts(GLOBAL);
+    g_xbee_dest[0] = make8(sh,3);
+    g_xbee_dest[1] = make8(sh,2);
+    g_xbee_dest[2] = make8(sh,1);
+    g_xbee_dest[3] = make8(sh,0);
+    g_xbee_dest[4] = make8(sl,3);
+    g_xbee_dest[5] = make8(sl,2);
+    g_xbee_dest[6] = make8(sl,1);
+    g_xbee_dest[7] = make8(sl,0);
+    gb_xbee_dest_known = true;
+    enable_interrupts(GLOBAL);
+}
+
+// Sends the current batch as one transmit request
+void xbee_flush(void)
+{
+    int8  i;
+    int8  sum;
+    int16 len;
+    int8  dest[8];
+    
+    if (g_xbee_batch_len == 0)
+    {
+        return;
+    }
+    if (++g_xbee_frame_id == 0)
+    {
+        g_xbee_frame_id = 1;    // Frame ID 0 disables the TX status
+    }
+    
+    // The receive interrupt may learn the address meanwhile
+    disable_interrupts(GLOBAL);
+    memcpy(dest,g_xbee_dest,8);
+    enable_interrupts(GLOBAL);
+    
+    len = XBEE_TX_HEADER_LEN + g_xbee_batch_len;
+    putc(XBEE_START);
+    xbee_putc(make8(len,1));
+    xbee_putc(make8(len,0));
+    
+    sum = XBEE_TX_REQUEST + g_xbee_frame_id + 0xFF + 0xFE;
+    xbee_putc(XBEE_TX_REQUEST);
+    xbee_putc(g_xbee_frame_id);
+    for (i = 0 ; i < 8 ; i++)
+    {
+        xbee_putc(dest[i]);
+        sum += dest[i];
+    }
+    xbee_putc(0xFF);            // 16 bit destination, unknown
+    xbee_putc(0xFE);
+    xbee_putc(0x00);            // Broadcast radius, maximum hops
+    xbee_putc(0x00);            // Transmit options, module defaults
+    for (i = 0 ; i < g_xbee_batch_len ; i++)
+    {
+        xbee_putc(g_xbee_batch[i]);
+        sum += g_xbee_batch[i];
+    }
+    xbee_putc(0xFF - sum);
+    
+    g_xbee_batch_len = 0;
+}
+
+// Makes room for a radio frame of len bytes in the batch, flushing the batch
+// first if the frame does not fit. tick is the low byte of the current time.
+void xbee_reserve(int16 len, int8 tick)
+{
+    if ((int16)g_xbee_batch_len + len > XBEE_BATCH_LEN)
+    {
+        xbee_flush();
+    }
+    if (g_xbee_batch_len == 0)
+    {
+        g_xbee_batch_start = tick;
+    }
+}
+
+// Adds a byte of a radio frame to the batch
+void xbee_batch_putc(int8 c)
+{
+    if (g_xbee_batch_len < XBEE_BATCH_LEN)
+    {
+        g_xbee_batch[g_xbee_batch_len++] = c;
+    }
+}
+
+// Returns true if the batch has waited long enough and should be sent
+int1 xbee_flush_due(int32 now)
+{
+    return (g_xbee_batch_len > 0) && ((int8)(make8(now,0) - g_xbee_batch_start) >= XBEE_FLUSH_MS);
+}
+
+// Asks the module for the RSSI of the last received packet (AT DB)
+void xbee_request_rssi(void)
+{
+    int8 sum = XBEE_AT_COMMAND + 0x01 + 'D' + 'B';
+    
+    putc(XBEE_START);
+    xbee_putc(0x00);
+    xbee_putc(0x04);
+    xbee_putc(XBEE_AT_COMMAND);
+    xbee_putc(0x01);
+    xbee_putc('D');
+    xbee_putc('B');
+    xbee_putc(0xFF - sum);
+}
+
+// Handles a complete frame whose first bytes are in g_xbee_rx_buf
+void xbee_rx_frame(void)
+{
+    switch (g_xbee_rx_buf[0])
+    {
+        case XBEE_TX_STATUS:    // Frame ID, dest16, retries, delivery, discovery
+            g_xbee_retries += g_xbee_rx_buf[4];
+            if (g_xbee_rx_buf[5] == XBEE_DELIVERY_OK)
+            {
+                g_xbee_tx_ok++;
+            }
+            else
+            {
+                g_xbee_tx_fail++;
+            }
+            break;
+        case XBEE_RX_PACKET:    // Source64, source16, options, data
+            if (!gb_xbee_dest_known)
+            {
+                memcpy(g_xbee_dest,&g_xbee_rx_buf[1],8);
+                gb_xbee_dest_known = true;
+            }
+            break;
+        case XBEE_AT_RESPONSE:  // Frame ID, command, status, value
+            if ((g_xbee_rx_buf[2] == 'D') && (g_xbee_rx_buf[3] == 'B') && (g_xbee_rx_buf[4] == 0))
+            {
+                g_xbee_rssi = g_xbee_rx_buf[5];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Feeds one byte from the module into the API receiver, called from the uart
+// receive interrupt. Returns true when the byte completed an RF data byte of a
+// received packet, left in g_xbee_rx_data for the command receiver. RF data is
+// passed on as it arrives, commands carry their own CRC.
+int1 xbee_rx_byte(int8 c)
+{
+    int1 b_data = false;
+    
+    if (c == XBEE_START)
+    {
+        g_xbee_rx_state = 1;
+        gb_xbee_rx_escape = false;
+        return false;
+    }
+    if (g_xbee_rx_state == 0)
+    {
+        return false;
+    }
+    if (c == XBEE_ESCAPE)
+    {
+        gb_xbee_rx_escape = true;
+        return false;
+    }
+    if (gb_xbee_rx_escape)
+    {
+        c ^= XBEE_ESCAPE_XOR;
+        gb_xbee_rx_escape = false;
+    }
+    
+    switch (g_xbee_rx_state)
+    {
+        case 1:                 // Length MSB
+            g_xbee_rx_len = (int16)c << 8;
+            g_xbee_rx_state = 2;
+            break;
+        case 2:                 // Length LSB
+            g_xbee_rx_len |= c;
+            g_xbee_rx_count = 0;
+            g_xbee_rx_sum = 0;
+            g_xbee_rx_state = (g_xbee_rx_len > 0) ? 3 : 0;
+            break;
+        case 3:                 // Frame data
+            if (g_xbee_rx_count < XBEE_RX_BUF_LEN)
+            {
+                g_xbee_rx_buf[g_xbee_rx_count] = c;
+            }
+            if ((g_xbee_rx_buf[0] == XBEE_RX_PACKET) && (g_xbee_rx_count >= XBEE_RX_HEADER_LEN))
+            {
+                g_xbee_rx_data = c;
+                b_data = true;
+            }
+            g_xbee_rx_sum += c;
+            if (++g_xbee_rx_count >= g_xbee_rx_len)
+            {
+                g_xbee_rx_state = 4;
+            }
+            break;
+        case 4:                 // Checksum
+        default:
+            if ((int8)(g_xbee_rx_sum + c) == 0xFF)
+            {
+                xbee_rx_frame();
+            }
+            g_xbee_rx_state = 0;
+            break;
+    }
+    return b_data;
+}
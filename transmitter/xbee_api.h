@@ -0,0 +1,34 @@
+#ifndef XBEE_API_H
+#define XBEE_API_H
+
+// XBee API mode definitions shared by the transmitter firmware and the
+// receiver library. Both radios run escaped API mode (AP=2):
+//
+//   START | LEN_HI | LEN_LO | FRAME DATA[LEN] | CHECKSUM
+//
+// CHECKSUM is 0xFF minus the low byte of the sum of the frame data. After
+// START, any START, ESCAPE, XON or XOFF byte is sent as ESCAPE followed by the
+// byte XOR 0x20.
+// Documentation: XBee-PRO 900HP User Guide, API operation
+
+#define XBEE_START            0x7E
+#define XBEE_ESCAPE           0x7D
+#define XBEE_XON              0x11
+#define XBEE_XOFF             0x13
+#define XBEE_ESCAPE_XOR       0x20
+
+// API frame types
+#define XBEE_AT_COMMAND       0x08
+#define XBEE_TX_REQUEST       0x10
+#define XBEE_AT_RESPONSE      0x88
+#define XBEE_TX_STATUS        0x8B
+#define XBEE_RX_PACKET        0x90
+
+#define XBEE_TX_HEADER_LEN    14    // Type, frame ID, dest64, dest16, radius, options
+#define XBEE_RX_HEADER_LEN    12    // Type, source64, source16, options
+#define XBEE_MAX_PAYLOAD      256   // NP of the 900HP
+
+// TX status delivery status
+#define XBEE_DELIVERY_OK      0x00
+
+#endif